@@ -0,0 +1,121 @@
+/************************************************************************//**
+ * \file  bloom.c
+ * \brief Bloom filter for packed telephone numbers. Tells if a number is
+ * definitely not in a list, or if it might be in the list.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \note This module does not depend on the hardware, and is also built by
+ * the host tools under src/balidx.
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bloom.h"
+
+/// FNV-1a 32-bit offset basis
+#define FNV_OFFSET	2166136261UL
+/// FNV-1a 32-bit prime
+#define FNV_PRIME	16777619UL
+
+/************************************************************************//**
+ * \brief Computes the FNV-1a hash of a packed number.
+ *
+ * \param[in] key Packed number.
+ *
+ * \return 32-bit hash. Masked so the host tools (where DWORD can be wider
+ * than 32 bits) obtain the same result than the firmware.
+ ****************************************************************************/
+static DWORD BloomFnv(const BYTE key[])
+{
+	DWORD h = FNV_OFFSET;
+	BYTE i;
+
+	for (i = 0; i < TN_PACK_LEN; i++)
+		h = ((h ^ key[i]) * FNV_PRIME) & 0xFFFFFFFFUL;
+
+	return h;
+}
+
+/************************************************************************//**
+ * \brief Computes the optimal number of hash functions for a filter.
+ *
+ * \param[in] len Filter length in bytes.
+ * \param[in] n   Number of elements to add to the filter.
+ *
+ * \return Number of hash functions (up to BLOOM_MAX_HASHES), or 0 if the
+ * filter is too small to be useful with n elements.
+ ****************************************************************************/
+BYTE BloomHashes(WORD len, DWORD n)
+{
+	DWORD k;
+
+	if (!n) return 1;
+	/// k = ln(2) * m / n, rounded. 709/1024 ~= ln(2)
+	k = ((DWORD)len * 8 * 709 / 1024 + n / 2) / n;
+
+	return k > BLOOM_MAX_HASHES?BLOOM_MAX_HASHES:k;
+}
+
+/************************************************************************//**
+ * \brief Adds a number to the filter.
+ *
+ * \param[in,out] bits Filter bit array.
+ * \param[in]     len  Filter length in bytes.
+ * \param[in]     k    Number of hash functions.
+ * \param[in]     key  Packed number to add.
+ ****************************************************************************/
+void BloomAdd(BYTE bits[], WORD len, BYTE k, const BYTE key[])
+{
+	DWORD h = BloomFnv(key);
+	WORD h1 = h, h2 = (h>>16) | 1;
+	WORD mask = len * 8 - 1;
+	WORD bit;
+
+	while (k--)
+	{
+		bit = h1 & mask;
+		bits[bit>>3] |= 1<<(bit & 7);
+		h1 += h2;
+	}
+}
+
+/************************************************************************//**
+ * \brief Checks if a number might be in the filter.
+ *
+ * \param[in] bits Filter bit array.
+ * \param[in] len  Filter length in bytes.
+ * \param[in] k    Number of hash functions.
+ * \param[in] key  Packed number to check.
+ *
+ * \return FALSE if the number is not in the filter, TRUE if it might be.
+ ****************************************************************************/
+char BloomCheck(const BYTE bits[], WORD len, BYTE k, const BYTE key[])
+{
+	DWORD h = BloomFnv(key);
+	WORD h1 = h, h2 = (h>>16) | 1;
+	WORD mask = len * 8 - 1;
+	WORD bit;
+
+	while (k--)
+	{
+		bit = h1 & mask;
+		if (!(bits[bit>>3] & (1<<(bit & 7)))) return FALSE;
+		h1 += h2;
+	}
+
+	return TRUE;
+}
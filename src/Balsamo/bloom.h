@@ -0,0 +1,78 @@
+/************************************************************************//**
+ * \file  bloom.h
+ * \brief Bloom filter for packed telephone numbers. Tells if a number is
+ * definitely not in a list, or if it might be in the list.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BLOOM_H_
+#define _BLOOM_H_
+
+#include "types.h"
+#include "tel_num.h"
+
+/** \defgroup bloom_api bloom
+ *
+ * Bloom filter for packed telephone numbers. The filter is a bit array of
+ * len bytes (len must be a power of 2, up to 8 KiB). Each number sets k
+ * bits, obtained by double hashing of a 32-bit FNV-1a hash of the packed
+ * number. The module does not hold any state, so it can be used by the
+ * firmware and by the host tools.
+ * \{ */
+
+/// Maximum number of hash functions
+#define BLOOM_MAX_HASHES	8
+
+/************************************************************************//**
+ * \brief Computes the optimal number of hash functions for a filter.
+ *
+ * \param[in] len Filter length in bytes.
+ * \param[in] n   Number of elements to add to the filter.
+ *
+ * \return Number of hash functions (up to BLOOM_MAX_HASHES), or 0 if the
+ * filter is too small to be useful with n elements.
+ ****************************************************************************/
+BYTE BloomHashes(WORD len, DWORD n);
+
+/************************************************************************//**
+ * \brief Adds a number to the filter.
+ *
+ * \param[in,out] bits Filter bit array.
+ * \param[in]     len  Filter length in bytes.
+ * \param[in]     k    Number of hash functions.
+ * \param[in]     key  Packed number to add.
+ ****************************************************************************/
+void BloomAdd(BYTE bits[], WORD len, BYTE k, const BYTE key[]);
+
+/************************************************************************//**
+ * \brief Checks if a number might be in the filter.
+ *
+ * \param[in] bits Filter bit array.
+ * \param[in] len  Filter length in bytes.
+ * \param[in] k    Number of hash functions.
+ * \param[in] key  Packed number to check.
+ *
+ * \return FALSE if the number is not in the filter, TRUE if it might be.
+ ****************************************************************************/
+char BloomCheck(const BYTE bits[], WORD len, BYTE k, const BYTE key[]);
+
+/** \} */
+
+#endif /*_BLOOM_H_*/
@@ -0,0 +1,172 @@
+/************************************************************************//**
+ * \file  call_act.c
+ * \brief Actions taken on filtered calls.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \note This module does not depend on the hardware, and is also built by
+ * the host tools.
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "call_act.h"
+#include <string.h>
+
+/// Names of the actions, indexed by action value, up to CA_NOEXIST
+static const char * const caNames[] = {
+	"", "RING", "SILENT", "BUSY", "NOEXIST"
+};
+/// List action directives, indexed by CA_LIST_* value
+static const char * const caLists[CA_LIST_NUM] = {
+	"REJECT_ACTION=", "HIDDEN_ACTION=", "REPEAT_ACTION="
+};
+/// Name of the last message action, returned by CaName()
+static char caMsgName[5] = "MSG0";
+
+/************************************************************************//**
+ * \brief Parses an action name.
+ *
+ * \param[in] p   Name to parse.
+ * \param[in] len Length of the name.
+ *
+ * \return The action, or CA_INVALID if the name is not valid.
+ ****************************************************************************/
+static BYTE CaWord(const char *p, BYTE len)
+{
+	BYTE i;
+
+	if ((4 == len) && !strncmp(p, "MSG", 3) && (p[3] >= '0') &&
+		(p[3] < '0' + CA_MSG_NUM)) return CA_MSG(p[3] - '0');
+	for (i = CA_RING; i <= CA_NOEXIST; i++)
+		if ((strlen(caNames[i]) == len) && !strncmp(p, caNames[i], len))
+			return i;
+	return CA_INVALID;
+}
+
+/************************************************************************//**
+ * \brief Splits the action from a number line. If the last word of the
+ * line is an action, it is cut from the line. The line ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[inout] line Configuration line.
+ *
+ * \return The action, CA_DEFAULT if the line has no action, or CA_INVALID
+ * if the last word starts with a letter, but it is not an action.
+ ****************************************************************************/
+BYTE CaParse(char line[])
+{
+	char *end, *word;
+	BYTE act;
+
+	/// Find the last word, skipping trailing blanks
+	for (end = line; *end && ('\r' != *end) && ('\n' != *end); end++);
+	while ((end > line) && ((' ' == end[-1]) || ('\t' == end[-1]))) end--;
+	for (word = end; (word > line) && (' ' != word[-1]) &&
+			('\t' != word[-1]); word--);
+	/// Numbers have no letters, so any other word is not a number
+	if ((word == end) || (*word < 'A') || (*word > 'Z')) return CA_DEFAULT;
+	if ((word == line) || (CA_INVALID == (act = CaWord(word, end - word))))
+		return CA_INVALID;
+	*word = '\0';
+	return act;
+}
+
+/************************************************************************//**
+ * \brief Parses a configuration line setting a list action, e.g.
+ * "REJECT_ACTION=BUSY". The line ends with the first '\0', '\r' or '\n'.
+ *
+ * \param[in]  line Configuration line.
+ * \param[out] acts Buffer of CA_LIST_NUM bytes holding the list actions,
+ *             indexed by CA_LIST_* value. Only the set action is changed.
+ *
+ * \return 0 if the action was set, 1 if the line is not an action
+ * directive, 2 if the action is not valid. RING is not valid here.
+ ****************************************************************************/
+char CaCfgParse(const char line[], BYTE acts[])
+{
+	const char *p;
+	BYTE i, len, act;
+
+	for (i = 0; (i < CA_LIST_NUM) &&
+			strncmp(line, caLists[i], strlen(caLists[i])); i++);
+	if (CA_LIST_NUM == i) return 1;
+
+	p = line + strlen(caLists[i]);
+	for (len = 0; p[len] && ('\r' != p[len]) && ('\n' != p[len]) &&
+			(' ' != p[len]) && ('\t' != p[len]); len++);
+	act = CaWord(p, len);
+	/// Use the filter mode to allow calls
+	if ((CA_INVALID == act) || (CA_RING == act)) return 2;
+	acts[i] = act;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Formats a list action as a configuration line.
+ *
+ * \param[in]  list List (CA_LIST_* value).
+ * \param[in]  act  Action of the list.
+ * \param[out] line Buffer of CA_LINE_LEN characters receiving the null
+ *             terminated line, without line ending. The line is empty if
+ *             the action is CA_DEFAULT.
+ ****************************************************************************/
+void CaCfgFormat(BYTE list, BYTE act, char line[])
+{
+	line[0] = '\0';
+	if (!*CaName(act)) return;
+	strcpy(line, caLists[list]);
+	strcat(line, CaName(act));
+}
+
+/************************************************************************//**
+ * \brief Gets the name of an action, as written in the configuration file.
+ *
+ * \param[in] act Action.
+ *
+ * \return Null terminated name, or an empty string for CA_DEFAULT and
+ * actions not valid. It is overwritten by the next call.
+ ****************************************************************************/
+const char *CaName(BYTE act)
+{
+	if (act <= CA_NOEXIST) return caNames[act];
+	if ((act < CA_MSG(0)) || (act >= CA_MSG(CA_MSG_NUM))) return caNames[0];
+	caMsgName[3] = '0' + act - CA_MSG(0);
+	return caMsgName;
+}
+
+/************************************************************************//**
+ * \brief Gets the file played to calls rejected with an action.
+ *
+ * \param[in]  act  Action.
+ * \param[out] file Buffer of CA_FILE_LEN characters receiving the null
+ *             terminated file name.
+ *
+ * \return 0 if OK, nonzero if the action does not play a file.
+ ****************************************************************************/
+char CaFile(BYTE act, char file[])
+{
+	if (CA_BUSY == act) strcpy(file, CA_FILE_BUSY);
+	else if (CA_NOEXIST == act) strcpy(file, CA_FILE_NOEXIST);
+	else if ((act >= CA_MSG(0)) && (act < CA_MSG(CA_MSG_NUM)))
+	{
+		strcpy(file, CaName(act));
+		strcat(file, ".RAW");
+	}
+	else return 1;
+	return 0;
+}
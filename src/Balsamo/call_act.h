@@ -0,0 +1,151 @@
+/************************************************************************//**
+ * \file  call_act.h
+ * \brief Actions taken on filtered calls.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CALL_ACT_H_
+#define _CALL_ACT_H_
+
+#include "types.h"
+
+/** \defgroup call_act_api call_act
+ *
+ * Actions taken on filtered calls. Each number in the phone book can carry
+ * an action, written after the number in the configuration file:
+ *
+ *     612345678 BUSY
+ *
+ * A number with an action other than RING is rejected with that action,
+ * whatever the filter mode is, and a number with the RING action is always
+ * allowed. Numbers without action follow the filter mode, and if rejected,
+ * the action set for their list is used:
+ *
+ *     REJECT_ACTION=MSG1
+ *     HIDDEN_ACTION=SILENT
+ *     REPEAT_ACTION=NOEXIST
+ *
+ * REJECT_ACTION applies to numbers rejected by the black/whitelist,
+ * HIDDEN_ACTION to rejected hidden numbers, and REPEAT_ACTION to numbers
+ * calling too often (see rep_call.h). Without them, the default messages
+ * are played.
+ *
+ * Actions are stored in a single byte, so they can be kept next to the
+ * packed numbers in the phone book, the configuration image, the EEPROM
+ * snapshot and the on-card index.
+ * \{ */
+
+/// Default action: allow or reject as the filter mode says, and play the
+/// default message to rejected calls
+#define CA_DEFAULT			0x00
+/// Allow the call, let the phone ring
+#define CA_RING				0x01
+/// Pick up and hang up without playing anything
+#define CA_SILENT			0x02
+/// Pick up and play a busy tone (CA_FILE_BUSY)
+#define CA_BUSY				0x03
+/// Pick up and play the "number does not exist" message (CA_FILE_NOEXIST)
+#define CA_NOEXIST			0x04
+/// Pick up and play message n (from 0 to CA_MSG_NUM - 1), stored in file
+/// MSGn.RAW
+#define CA_MSG(n)			(0x10 + (n))
+/// Number of message files
+#define CA_MSG_NUM			10
+/// Returned by the parsing functions when the action is not valid
+#define CA_INVALID			0xFF
+
+/// Action for numbers rejected by the black/whitelist
+#define CA_LIST_REJECT		0
+/// Action for rejected hidden numbers
+#define CA_LIST_HIDDEN		1
+/// Action for repeat callers
+#define CA_LIST_REPEAT		2
+/// Number of list actions
+#define CA_LIST_NUM			3
+
+/// Busy tone file
+#define CA_FILE_BUSY		"BUSY.RAW"
+/// "Number does not exist" message file
+#define CA_FILE_NOEXIST		"NOEXIST.RAW"
+/// Length of the longest file name, including the terminating '\0'
+#define CA_FILE_LEN			12
+/// Maximum length of an action line, including the terminating '\0'
+#define CA_LINE_LEN			24
+
+/************************************************************************//**
+ * \brief Splits the action from a number line. If the last word of the
+ * line is an action, it is cut from the line. The line ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[inout] line Configuration line.
+ *
+ * \return The action, CA_DEFAULT if the line has no action, or CA_INVALID
+ * if the last word starts with a letter, but it is not an action.
+ ****************************************************************************/
+BYTE CaParse(char line[]);
+
+/************************************************************************//**
+ * \brief Parses a configuration line setting a list action, e.g.
+ * "REJECT_ACTION=BUSY". The line ends with the first '\0', '\r' or '\n'.
+ *
+ * \param[in]  line Configuration line.
+ * \param[out] acts Buffer of CA_LIST_NUM bytes holding the list actions,
+ *             indexed by CA_LIST_* value. Only the set action is changed.
+ *
+ * \return 0 if the action was set, 1 if the line is not an action
+ * directive, 2 if the action is not valid. RING is not valid here.
+ ****************************************************************************/
+char CaCfgParse(const char line[], BYTE acts[]);
+
+/************************************************************************//**
+ * \brief Formats a list action as a configuration line.
+ *
+ * \param[in]  list List (CA_LIST_* value).
+ * \param[in]  act  Action of the list.
+ * \param[out] line Buffer of CA_LINE_LEN characters receiving the null
+ *             terminated line, without line ending. The line is empty if
+ *             the action is CA_DEFAULT.
+ ****************************************************************************/
+void CaCfgFormat(BYTE list, BYTE act, char line[]);
+
+/************************************************************************//**
+ * \brief Gets the name of an action, as written in the configuration file.
+ *
+ * \param[in] act Action.
+ *
+ * \return Null terminated name, or an empty string for CA_DEFAULT and
+ * actions not valid. It is overwritten by the next call.
+ ****************************************************************************/
+const char *CaName(BYTE act);
+
+/************************************************************************//**
+ * \brief Gets the file played to calls rejected with an action.
+ *
+ * \param[in]  act  Action.
+ * \param[out] file Buffer of CA_FILE_LEN characters receiving the null
+ *             terminated file name.
+ *
+ * \return 0 if OK, nonzero if the action does not play a file.
+ ****************************************************************************/
+char CaFile(BYTE act, char file[]);
+
+/** \} */
+
+#endif /*_CALL_ACT_H_*/
@@ -0,0 +1,312 @@
+/************************************************************************//**
+ * \file  call_hist.c
+ * \brief Persistent call history.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "call_hist.h"
+#include "crc.h"
+#include "rtc.h"
+#include "fatfs/ff.h"
+#include <string.h>
+
+/// No sector cached
+#define CH_NO_PAGE		0xFFFF
+
+/// Call history file
+static FIL fHist;
+/// TRUE if the call history file is open
+static BYTE histOpen = FALSE;
+/// Position of the next record to write
+static WORD head;
+/// Number of valid records
+static WORD count;
+/// Records in the history: CH_MAX_RECS if the file is open, CH_PAGE_RECS
+/// (the RAM cache) otherwise
+static WORD maxRecs;
+/// Numbers of the records in the cached sector
+static char cache[CH_PAGE_RECS][CH_NUM_LEN];
+/// Cached sector, in CH_PAGE_RECS records units
+static WORD cachePage;
+/// Number returned by ChNum()
+static char numBuf[CH_NUM_LEN + 1];
+/// Records not written to the file yet, the oldest first. The newest one
+/// is at the record before the head.
+static BYTE queue[CH_QUEUE_RECS][CH_REC_LEN];
+/// Number of records in queue
+static BYTE qCount;
+
+/************************************************************************//**
+ * \brief Module initialization. Starts with an empty RAM history, not
+ * bound to any file.
+ ****************************************************************************/
+void ChInit(void)
+{
+	histOpen = FALSE;
+	head = count = 0;
+	maxRecs = CH_PAGE_RECS;
+	cachePage = 0;
+	qCount = 0;
+}
+
+/************************************************************************//**
+ * \brief Gets the position in the file of a queued record.
+ *
+ * \param[in] i Position of the record in the queue.
+ *
+ * \return The record position in the file.
+ ****************************************************************************/
+static WORD ChQueueSlot(BYTE i)
+{
+	WORD slot = head + maxRecs - qCount + i;
+
+	return (slot >= maxRecs)?slot - maxRecs:slot;
+}
+
+/************************************************************************//**
+ * \brief Writes the header to the call history file, and flushes it along
+ * with any record written before.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char ChHdrWrite(void)
+{
+	BYTE hdr[CH_HDR_FIELDS];
+	UINT bw;
+
+	memcpy(hdr + CH_HDR_MAGIC, CH_MAGIC, 4);
+	ST_WORD(hdr + CH_HDR_VERSION, CH_VERSION);
+	ST_WORD(hdr + CH_HDR_RECLEN, CH_REC_LEN);
+	ST_WORD(hdr + CH_HDR_NRECS, CH_MAX_RECS);
+	ST_WORD(hdr + CH_HDR_HEAD, head);
+	ST_WORD(hdr + CH_HDR_COUNT, count);
+	ST_WORD(hdr + CH_HDR_CRC, Crc16(CRC16_INIT, hdr, CH_HDR_CRC));
+
+	if (f_lseek(&fHist, 0) || f_write(&fHist, hdr, CH_HDR_FIELDS, &bw) ||
+		(bw != CH_HDR_FIELDS) || f_sync(&fHist)) return 1;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Opens the call history file in the SD card, creating it if it
+ * does not exist or is not valid. The file is kept open until ChClose() is
+ * called. Calls stored only in RAM are discarded.
+ *
+ * \return 0 if OK, nonzero otherwise. On error, the RAM history is used.
+ ****************************************************************************/
+char ChOpen(void)
+{
+	BYTE hdr[CH_HDR_FIELDS];
+	DWORD size = CH_HDR_LEN + (DWORD)CH_MAX_RECS * CH_REC_LEN;
+	UINT br;
+
+	ChClose();
+	if (f_open(&fHist, CH_FILE, FA_READ | FA_WRITE | FA_OPEN_ALWAYS))
+		return 1;
+	histOpen = TRUE;
+	maxRecs = CH_MAX_RECS;
+	cachePage = CH_NO_PAGE;
+
+	if (!f_read(&fHist, hdr, CH_HDR_FIELDS, &br) && (br == CH_HDR_FIELDS) &&
+		!memcmp(hdr + CH_HDR_MAGIC, CH_MAGIC, 4) &&
+		(LD_WORD(hdr + CH_HDR_VERSION) == CH_VERSION) &&
+		(LD_WORD(hdr + CH_HDR_RECLEN) == CH_REC_LEN) &&
+		(LD_WORD(hdr + CH_HDR_NRECS) == CH_MAX_RECS) &&
+		(LD_WORD(hdr + CH_HDR_CRC) == Crc16(CRC16_INIT, hdr, CH_HDR_CRC)) &&
+		(LD_WORD(hdr + CH_HDR_HEAD) < CH_MAX_RECS) &&
+		(LD_WORD(hdr + CH_HDR_COUNT) <= CH_MAX_RECS) &&
+		(f_size(&fHist) >= size))
+	{
+		head = LD_WORD(hdr + CH_HDR_HEAD);
+		count = LD_WORD(hdr + CH_HDR_COUNT);
+		return 0;
+	}
+
+	/// Start a new history. The whole file is allocated now, so adding a
+	/// call never needs to allocate clusters. The clusters are contiguous
+	/// unless the card is too fragmented to find such a block.
+	if (f_lseek(&fHist, 0) || f_truncate(&fHist) ||
+		(f_expand(&fHist, size, 1) &&
+		(f_lseek(&fHist, size) || (f_tell(&fHist) != size))) || ChHdrWrite())
+	{
+		ChClose();
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Stops using the call history file, e.g. because the card has been
+ * removed, and starts again with an empty RAM history.
+ ****************************************************************************/
+void ChClose(void)
+{
+	if (histOpen) f_close(&fHist);
+	ChInit();
+}
+
+/************************************************************************//**
+ * \brief Loads the numbers of the records in a sector of the call history
+ * file to the cache. Records that cannot be read or are corrupted are
+ * cached as empty numbers.
+ *
+ * \param[in] page Sector to load, in CH_PAGE_RECS records units.
+ ****************************************************************************/
+static void ChPageLoad(WORD page)
+{
+	BYTE rec[CH_REC_LEN];
+	WORD i, slot;
+	UINT br;
+	char err;
+
+	cachePage = page;
+	err = f_lseek(&fHist, CH_HDR_LEN + (DWORD)page * CH_PAGE_RECS * CH_REC_LEN);
+	/// With _FS_TINY, all the records come from the volume window, so the
+	/// sector is read from the card only once
+	for (i = 0; i < CH_PAGE_RECS; i++)
+	{
+		if (err || f_read(&fHist, rec, CH_REC_LEN, &br) || (br != CH_REC_LEN) ||
+			(LD_WORD(rec + CH_REC_CRC) != Crc16(CRC16_INIT, rec, CH_REC_CRC)))
+			cache[i][0] = '\0';
+		else memcpy(cache[i], rec + CH_REC_NUM, CH_NUM_LEN);
+	}
+	/// Queued records are not in the file yet
+	for (i = 0; i < qCount; i++)
+	{
+		slot = ChQueueSlot(i);
+		if (slot / CH_PAGE_RECS == page)
+			memcpy(cache[slot % CH_PAGE_RECS], queue[i] + CH_REC_NUM, CH_NUM_LEN);
+	}
+}
+
+/************************************************************************//**
+ * \brief Adds a call to the history, with the current date and time. If
+ * the history is full, the oldest call is overwritten. The record is
+ * queued in RAM, and written to the card by the next ChTask() call.
+ *
+ * \param[in] num      Caller number, as received in the caller ID. Only the
+ *                     first CH_NUM_LEN characters are stored.
+ * \param[in] decision CH_CALL_ALLOWED or CH_CALL_BLOCKED.
+ * \param[in] reason   TF_* code of the filter decision (see tel_filt.h).
+ * \param[in] act      CA_* action performed (see call_act.h).
+ *
+ * \return 0 if OK, nonzero if the queue is full and the call is dropped.
+ ****************************************************************************/
+char ChAdd(const char num[], BYTE decision, BYTE reason, BYTE act)
+{
+	BYTE *rec;
+	WORD i, y, slot;
+
+	/// Without the file, the RAM cache is the whole history
+	if (histOpen)
+	{
+		if (qCount >= CH_QUEUE_RECS) return 1;
+		rec = queue[qCount];
+	}
+	else rec = queue[0];
+
+	/// Build the record, padding the number with blanks
+	memset(rec, 0, CH_REC_LEN);
+	for (i = 0; (i < CH_NUM_LEN) && num[i]; i++) rec[CH_REC_NUM + i] = num[i];
+	for (; i < CH_NUM_LEN; i++) rec[CH_REC_NUM + i] = ' ';
+	RtcGetDateTime(&y, rec + CH_REC_MONTH, rec + CH_REC_DAY,
+			rec + CH_REC_HOUR, rec + CH_REC_MIN, rec + CH_REC_SEC);
+	ST_WORD(rec + CH_REC_YEAR, y);
+	rec[CH_REC_DECISION] = decision;
+	rec[CH_REC_REASON] = reason;
+	rec[CH_REC_ACTION] = act;
+	ST_WORD(rec + CH_REC_CRC, Crc16(CRC16_INIT, rec, CH_REC_CRC));
+
+	slot = head;
+	if (++head == maxRecs) head = 0;
+	if (count < maxRecs) count++;
+	if (histOpen) qCount++;
+
+	/// Update the cache if it holds the record sector. Otherwise it is
+	/// loaded when browsed, without accessing the card now.
+	if (slot / CH_PAGE_RECS == cachePage)
+		memcpy(cache[slot % CH_PAGE_RECS], rec + CH_REC_NUM, CH_NUM_LEN);
+	else cachePage = CH_NO_PAGE;
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Writes the queued records to the call history file, and then the
+ * header. Must be called only while the system is idle.
+ *
+ * \return 0 if OK, nonzero if the records could not be written. They are
+ * dropped from the queue anyway.
+ ****************************************************************************/
+char ChTask(void)
+{
+	BYTE i;
+	UINT bw;
+	char retVal = 0;
+
+	if (!qCount) return 0;
+	/// Write the records and then the header, once for all of them. If
+	/// power fails in between, the records are just overwritten by the
+	/// next calls.
+	for (i = 0; (i < qCount) && !retVal; i++)
+		if (f_lseek(&fHist, CH_HDR_LEN + (DWORD)ChQueueSlot(i) * CH_REC_LEN) ||
+			f_write(&fHist, queue[i], CH_REC_LEN, &bw) ||
+			(bw != CH_REC_LEN)) retVal = 1;
+	qCount = 0;
+	if (!retVal && ChHdrWrite()) retVal = 1;
+
+	return retVal;
+}
+
+/************************************************************************//**
+ * \brief Gets the number of calls in the history.
+ *
+ * \return Number of calls.
+ ****************************************************************************/
+WORD ChCount(void)
+{
+	return count;
+}
+
+/************************************************************************//**
+ * \brief Gets the number of a call in the history. The sector holding the
+ * call is read if it is not cached.
+ *
+ * \param[in] age Age of the call, 0 being the newest one.
+ *
+ * \return The number of the call, or NULL if there is no such call. It is
+ * overwritten by the next call. If the record cannot be read, an empty
+ * string is returned.
+ ****************************************************************************/
+char *ChNum(WORD age)
+{
+	WORD slot;
+
+	if (age >= count) return NULL;
+	slot = head + maxRecs - 1 - age;
+	if (slot >= maxRecs) slot -= maxRecs;
+
+	if (histOpen && (slot / CH_PAGE_RECS != cachePage))
+		ChPageLoad(slot / CH_PAGE_RECS);
+	memcpy(numBuf, cache[slot % CH_PAGE_RECS], CH_NUM_LEN);
+	numBuf[CH_NUM_LEN] = '\0';
+	return numBuf;
+}
@@ -0,0 +1,168 @@
+/************************************************************************//**
+ * \file  call_hist.h
+ * \brief Persistent call history.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _CALL_HIST_H_
+#define _CALL_HIST_H_
+
+#include "types.h"
+
+/** \defgroup call_hist_api call_hist
+ *
+ * Persistent call history. Each call with caller ID is stored as a fixed
+ * length record in CH_FILE, in the root of the SD card. The file is a
+ * circular buffer of CH_MAX_RECS records, preceded by a header sector
+ * holding the position of the next record to write (the head) and the
+ * number of valid records. The file is allocated when created, so adding
+ * a record never grows it.
+ *
+ * ChAdd() runs while a call is being processed, so it does not access the
+ * card: the record is queued in RAM, and written along with the header by
+ * the next ChTask() call, when the system is idle.
+ *
+ * Records are browsed by age (0 is the newest call). The numbers of the
+ * records in the sector being browsed are cached in RAM, and this cache
+ * follows the newest records when calls are added. If the card is not
+ * available, the cache works as a small RAM ring of CH_PAGE_RECS records
+ * that is lost on reset.
+ * \{ */
+
+/// Call history file name
+#define CH_FILE			"BALSAMO.HIS"
+/// File magic number
+#define CH_MAGIC		"BHIS"
+/// File format version
+#define CH_VERSION		1
+/// Records in the file
+#define CH_MAX_RECS		4096
+/// Length of the header. Records start in the second sector.
+#define CH_HDR_LEN		512
+/// Record length
+#define CH_REC_LEN		32
+/// Records in each sector, cached together
+#define CH_PAGE_RECS	(512 / CH_REC_LEN)
+/// Length of the stored numbers, as received in the caller ID
+#define CH_NUM_LEN		16
+/// Records queued in RAM until ChTask() writes them
+#define CH_QUEUE_RECS	4
+
+/// \name Header fields
+/// \{
+#define CH_HDR_MAGIC	0	///< Magic number (4 bytes)
+#define CH_HDR_VERSION	4	///< Format version (WORD)
+#define CH_HDR_RECLEN	6	///< Record length (WORD)
+#define CH_HDR_NRECS	8	///< Records in the file (WORD)
+#define CH_HDR_HEAD		10	///< Next record to write (WORD)
+#define CH_HDR_COUNT	12	///< Number of valid records (WORD)
+#define CH_HDR_CRC		14	///< CRC16 of the previous fields (WORD)
+#define CH_HDR_FIELDS	16	///< Length of the header fields
+/// \}
+
+/// \name Record fields
+/// \{
+#define CH_REC_NUM		0	///< Caller number, blank padded (CH_NUM_LEN)
+#define CH_REC_YEAR		16	///< Year (WORD)
+#define CH_REC_MONTH	18	///< Month, 1 to 12 (BYTE)
+#define CH_REC_DAY		19	///< Day of month (BYTE)
+#define CH_REC_HOUR		20	///< Hour (BYTE)
+#define CH_REC_MIN		21	///< Minute (BYTE)
+#define CH_REC_SEC		22	///< Second (BYTE)
+#define CH_REC_DECISION	23	///< CH_CALL_ALLOWED or CH_CALL_BLOCKED (BYTE)
+#define CH_REC_REASON	24	///< TF_* code of the filter decision (BYTE)
+#define CH_REC_ACTION	25	///< CA_* action performed (BYTE)
+#define CH_REC_CRC		30	///< CRC16 of the previous bytes (WORD)
+/// \}
+
+/// \name Call decisions
+/// \{
+#define CH_CALL_ALLOWED	0	///< The call was allowed
+#define CH_CALL_BLOCKED	1	///< The call was blocked
+/// \}
+
+/************************************************************************//**
+ * \brief Module initialization. Starts with an empty RAM history, not
+ * bound to any file.
+ ****************************************************************************/
+void ChInit(void);
+
+/************************************************************************//**
+ * \brief Opens the call history file in the SD card, creating it if it
+ * does not exist or is not valid. The file is kept open until ChClose() is
+ * called. Calls stored only in RAM are discarded.
+ *
+ * \return 0 if OK, nonzero otherwise. On error, the RAM history is used.
+ ****************************************************************************/
+char ChOpen(void);
+
+/************************************************************************//**
+ * \brief Stops using the call history file, e.g. because the card has been
+ * removed, and starts again with an empty RAM history.
+ ****************************************************************************/
+void ChClose(void);
+
+/************************************************************************//**
+ * \brief Adds a call to the history, with the current date and time. If
+ * the history is full, the oldest call is overwritten. The record is
+ * queued in RAM, and written to the card by the next ChTask() call.
+ *
+ * \param[in] num      Caller number, as received in the caller ID. Only the
+ *                     first CH_NUM_LEN characters are stored.
+ * \param[in] decision CH_CALL_ALLOWED or CH_CALL_BLOCKED.
+ * \param[in] reason   TF_* code of the filter decision (see tel_filt.h).
+ * \param[in] act      CA_* action performed (see call_act.h).
+ *
+ * \return 0 if OK, nonzero if the queue is full and the call is dropped.
+ ****************************************************************************/
+char ChAdd(const char num[], BYTE decision, BYTE reason, BYTE act);
+
+/************************************************************************//**
+ * \brief Writes the queued records to the call history file, and then the
+ * header. Must be called only while the system is idle.
+ *
+ * \return 0 if OK, nonzero if the records could not be written. They are
+ * dropped from the queue anyway.
+ ****************************************************************************/
+char ChTask(void);
+
+/************************************************************************//**
+ * \brief Gets the number of calls in the history.
+ *
+ * \return Number of calls.
+ ****************************************************************************/
+WORD ChCount(void);
+
+/************************************************************************//**
+ * \brief Gets the number of a call in the history. The sector holding the
+ * call is read if it is not cached.
+ *
+ * \param[in] age Age of the call, 0 being the newest one.
+ *
+ * \return The number of the call, or NULL if there is no such call. It is
+ * overwritten by the next call. If the record cannot be read, an empty
+ * string is returned.
+ ****************************************************************************/
+char *ChNum(WORD age);
+
+/** \} */
+
+#endif /*_CALL_HIST_H_*/
@@ -43,10 +43,12 @@
 /// Calculates delay cycles to sleep nanoseconds
 #define DELAY_NS_COUNT(ns) ((ns*(Fcy/8))/(1000000000L))
 
-/// Temporary disables interrupts
+#ifndef _DI
+/// Temporary disables interrupts. The host tools define it empty.
 #define _DI()		__asm__ volatile("disi #0x3FFF")
 /// Enables interrupts
 #define _EI()		__asm__ volatile("disi #0")
+#endif
 
 /// Disables all interrupts and puts system to sleep
 #define PANIC()				\
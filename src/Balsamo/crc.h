@@ -0,0 +1,52 @@
+/************************************************************************//**
+ * \file  crc.h
+ * \brief CRC calculation routines.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include "types.h"
+
+/** \defgroup crc_api crc
+ *
+ * CRC calculation routines. CRC16 is the CCITT variant (polynomial 0x1021,
+ * no reflection, no final XOR), the same one used by SD cards to protect
+ * data blocks. It is computed using a 256 entry table.
+ * \{ */
+
+/// Initial value for CRC16 calculations
+#define CRC16_INIT	0x0000
+
+/************************************************************************//**
+ * \brief Updates a CRC16 with new data.
+ *
+ * \param[in] crc  Current CRC value (CRC16_INIT for the first data chunk).
+ * \param[in] data Data to add to the CRC.
+ * \param[in] len  Length of data in bytes.
+ *
+ * \return Updated CRC value.
+ ****************************************************************************/
+WORD Crc16(WORD crc, const BYTE data[], WORD len);
+
+/** \} */
+
+#endif /*_CRC_H_*/
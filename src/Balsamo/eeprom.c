@@ -0,0 +1,91 @@
+/************************************************************************//**
+ * \file  eeprom.c
+ * \brief Data EEPROM access. Allows reading and writing data stored in the
+ * dsPIC30F6014 internal data EEPROM, that keeps it without the microSD card.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "eeprom.h"
+#include <libpic30.h>
+#include <string.h>
+
+#if (EE_ROW_LEN != _EE_ROW)
+#error "EEPROM row length does not match the target device"
+#endif
+
+/// Whole data EEPROM
+static int __attribute__((space(eedata), aligned(_EE_ROW)))
+	eeData[EE_LEN / 2];
+
+/************************************************************************//**
+ * \brief Reads data from the EEPROM.
+ *
+ * \param[in]  ofs Offset to read from. Must be even.
+ * \param[out] buf Buffer receiving read data.
+ * \param[in]  len Number of bytes to read. Must be even.
+ ****************************************************************************/
+void EeRead(WORD ofs, void *buf, WORD len)
+{
+	_prog_addressT addr;
+
+	_init_prog_address(addr, eeData);
+	_memcpy_p2d16(buf, addr + ofs, len);
+}
+
+/************************************************************************//**
+ * \brief Writes data to the EEPROM. Only the rows with changes are erased
+ * and written.
+ *
+ * \param[in] ofs Offset to write to. Must be even.
+ * \param[in] buf Data to write.
+ * \param[in] len Number of bytes to write. Must be even.
+ *
+ * \warning Each written row stalls the CPU for a few milliseconds.
+ ****************************************************************************/
+void EeWrite(WORD ofs, const void *buf, WORD len)
+{
+	int row[EE_ROW_LEN / 2];
+	_prog_addressT addr;
+	const BYTE *src = buf;
+	WORD rowOfs, pos, chunk;
+
+	_init_prog_address(addr, eeData);
+	while (len)
+	{
+		/// Merge new data with the row contents
+		rowOfs = ofs - ofs % EE_ROW_LEN;
+		pos = ofs - rowOfs;
+		chunk = EE_ROW_LEN - pos;
+		if (chunk > len) chunk = len;
+		_memcpy_p2d16(row, addr + rowOfs, EE_ROW_LEN);
+		if (memcmp((BYTE*)row + pos, src, chunk))
+		{
+			memcpy((BYTE*)row + pos, src, chunk);
+			_erase_eedata(addr + rowOfs, _EE_ROW);
+			_wait_eedata();
+			_write_eedata_row(addr + rowOfs, row);
+			_wait_eedata();
+		}
+		ofs += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
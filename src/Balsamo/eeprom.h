@@ -0,0 +1,74 @@
+/************************************************************************//**
+ * \file  eeprom.h
+ * \brief Data EEPROM access. Allows reading and writing data stored in the
+ * dsPIC30F6014 internal data EEPROM, that keeps it without the microSD card.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#include "types.h"
+
+/** \defgroup eeprom_api eeprom
+ *
+ * Data EEPROM access. Data is addressed by its byte offset from the start
+ * of the EEPROM. Writes only erase and program the rows whose contents
+ * change, to save time and wear.
+ * \{ */
+
+/// Data EEPROM length in bytes
+#define EE_LEN			4096
+/// Length of an EEPROM row in bytes
+#define EE_ROW_LEN		32
+
+/** \addtogroup ee_map EEPROM map. Offsets of the data stored by each module.
+ * \{ */
+/// Configuration snapshot (see tel_filt.h), up to 1248 bytes
+#define EE_TF_SNAP_OFS	0
+/// Repeat caller table (see rep_call.h), up to 320 bytes
+#define EE_RC_OFS		1280
+/** \} */
+
+/************************************************************************//**
+ * \brief Reads data from the EEPROM.
+ *
+ * \param[in]  ofs Offset to read from. Must be even.
+ * \param[out] buf Buffer receiving read data.
+ * \param[in]  len Number of bytes to read. Must be even.
+ ****************************************************************************/
+void EeRead(WORD ofs, void *buf, WORD len);
+
+/************************************************************************//**
+ * \brief Writes data to the EEPROM. Only the rows with changes are erased
+ * and written.
+ *
+ * \param[in] ofs Offset to write to. Must be even.
+ * \param[in] buf Data to write.
+ * \param[in] len Number of bytes to write. Must be even.
+ *
+ * \warning Each written row stalls the CPU for a few milliseconds.
+ ****************************************************************************/
+void EeWrite(WORD ofs, const void *buf, WORD len);
+
+/** \} */
+
+#endif /*_EEPROM_H_*/
@@ -0,0 +1,553 @@
+/************************************************************************//**
+ * \file  ev_log.c
+ * \brief Buffered event log.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ev_log.h"
+#include "rtc.h"
+#include "tel_num.h"
+#include "fatfs/ff.h"
+#include "fatfs/diskio.h"
+#include <string.h>
+
+/// Length of the date and time stamp ("dd/mm/yyyy, hh:mm --> ")
+#define LOG_STAMP_LEN	22
+/// Length of the log file header, lines are stored after it
+#define LOG_HDR_LEN		_MAX_SS
+/// Log file header line start, followed by the head offset (8 hex digits)
+/// and a line feed
+#define LOG_HDR_MAGIC	"BALSAMO LOG HEAD="
+/// Log file header line length
+#define LOG_HDR_TXT_LEN	(sizeof(LOG_HDR_MAGIC) - 1 + 8 + 1)
+
+#if (LOG_FILE_LEN % LOG_HDR_LEN) || (LOG_FILE_LEN <= LOG_HDR_LEN)
+#error "LOG_FILE_LEN must be a multiple of the sector length"
+#endif
+
+#if LOG_FILE_BUF && _FS_TINY
+#if !_FS_FILEBUF
+#error "LOG_FILE_BUF needs _FS_FILEBUF enabled in ffconf.h"
+#endif
+#endif
+
+/// Log file
+static FIL fLog;
+/// TRUE if the log file is open
+static BYTE logOpen = FALSE;
+#if LOG_FILE_BUF && _FS_TINY
+/// Log file sector buffer
+static BYTE logSect[_MAX_SS];
+#endif
+/// Head offset recorded in the log file header
+static DWORD hdrHead;
+/// Log lines ring
+static char ring[LOG_BUF_LEN];
+/// Ring write position
+static WORD rHead;
+/// Ring read position
+static WORD rTail;
+/// Bytes written to the file and not synced yet
+static WORD unsynced;
+/// Lines dropped because the ring was full
+static WORD lost;
+#if LOG_BIN_RECS
+/// Binary log file
+static FIL fBin;
+/// TRUE if the binary log file is open
+static BYTE binOpen = FALSE;
+/// Binary records not written yet
+static BYTE bin[LOG_BIN_RECS][LOG_REC_LEN];
+/// Position of the next record in bin
+static BYTE binHead;
+/// Number of records in bin
+static BYTE binCount;
+/// TRUE if records were dropped since the last one buffered
+static BYTE binLost;
+#endif
+
+#if MMC_CACHE_SECTS
+/************************************************************************//**
+ * \brief Pins in the SD card sector cache the directory sector holding the
+ * log file entry, that each log sync rewrites. The log file is allocated
+ * at once, so syncs do not touch the FAT.
+ ****************************************************************************/
+static void LogPin(void)
+{
+	DWORD sect;
+
+	sect = 0;
+	disk_ioctl(0, MMC_CACHE_PIN, &sect);
+	sect = fLog.dir_sect;
+	disk_ioctl(0, MMC_CACHE_PIN, &sect);
+}
+#endif
+
+/************************************************************************//**
+ * \brief Opens the log file, and gives it its private sector buffer.
+ *
+ * \param[in] mode FA_OPEN_ALWAYS or FA_CREATE_NEW.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char LogFileOpen(BYTE mode)
+{
+	if (f_open(&fLog, LOG_FILE, FA_READ | FA_WRITE | mode)) return 1;
+#if LOG_FILE_BUF && _FS_TINY
+	fLog.buf = logSect;
+#endif
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Records the cursor position as the head in the log file header,
+ * and moves the cursor back to it.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char LogHdrWrite(void)
+{
+	char hdr[LOG_HDR_TXT_LEN];
+	DWORD head = f_tell(&fLog);
+	UINT bw;
+	BYTE i;
+
+	/// e.g. "BALSAMO LOG HEAD=00001F3A\n"
+	memcpy(hdr, LOG_HDR_MAGIC, sizeof(LOG_HDR_MAGIC) - 1);
+	for (i = 0; i < 8; i++)
+		hdr[LOG_HDR_TXT_LEN - 2 - i] = "0123456789ABCDEF"[(head>>(4 * i)) & 0xF];
+	hdr[LOG_HDR_TXT_LEN - 1] = '\n';
+	if (f_lseek(&fLog, 0) || f_write(&fLog, hdr, LOG_HDR_TXT_LEN, &bw) ||
+		(bw != LOG_HDR_TXT_LEN) || f_lseek(&fLog, head)) return 1;
+	hdrHead = head;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Reads the head offset recorded in the log file header.
+ *
+ * \param[out] head Head offset, or 0 if the file is not a circular log of
+ *                  LOG_FILE_LEN bytes.
+ *
+ * \return 0 if OK, nonzero if the file could not be read.
+ ****************************************************************************/
+static char LogHdrRead(DWORD *head)
+{
+	char hdr[LOG_HDR_TXT_LEN];
+	UINT br;
+	BYTE i, c;
+
+	*head = 0;
+	if (f_size(&fLog) != LOG_FILE_LEN) return 0;
+	if (f_read(&fLog, hdr, LOG_HDR_TXT_LEN, &br)) return 1;
+	if ((br != LOG_HDR_TXT_LEN) || (hdr[LOG_HDR_TXT_LEN - 1] != '\n') ||
+		memcmp(hdr, LOG_HDR_MAGIC, sizeof(LOG_HDR_MAGIC) - 1)) return 0;
+	for (i = sizeof(LOG_HDR_MAGIC) - 1; i < LOG_HDR_TXT_LEN - 1; i++)
+	{
+		c = hdr[i];
+		if ((c >= '0') && (c <= '9')) c -= '0';
+		else if ((c >= 'A') && (c <= 'F')) c -= 'A' - 10;
+		else return 0;
+		*head = (*head<<4) | c;
+	}
+	if ((*head < LOG_HDR_LEN) || (*head >= LOG_FILE_LEN)) *head = 0;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Allocates the log file, that must be empty, and fills it with NUL
+ * bytes. The clusters are contiguous unless the card is too fragmented to
+ * find such a block. The head is placed at the start of the lines.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char LogCreate(void)
+{
+	char zero[16];
+	DWORD left;
+	UINT bw;
+
+	/// If there is no contiguous block, the writes allocate the clusters
+	f_expand(&fLog, LOG_FILE_LEN, 1);
+	memset(zero, 0, sizeof(zero));
+	for (left = LOG_FILE_LEN; left; left -= bw)
+		if (f_write(&fLog, zero, sizeof(zero), &bw) || (bw != sizeof(zero)))
+			return 1;
+	if (f_lseek(&fLog, LOG_HDR_LEN) || LogHdrWrite() || f_sync(&fLog))
+		return 1;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Places the cursor at the log head: the first NUL byte found from
+ * the offset recorded in the header, that is only updated from time to
+ * time. If there is none (e.g. the padding was lost), the recorded offset
+ * is used.
+ *
+ * \param[in] head Head offset recorded in the header.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char LogSeekHead(DWORD head)
+{
+	char chunk[16];
+	DWORD left;
+	UINT br, i;
+
+	if (f_lseek(&fLog, head)) return 1;
+	for (left = LOG_FILE_LEN - LOG_HDR_LEN; left; left -= br)
+	{
+		if ((f_tell(&fLog) == LOG_FILE_LEN) && f_lseek(&fLog, LOG_HDR_LEN))
+			return 1;
+		if (f_read(&fLog, chunk, left < sizeof(chunk)?left:sizeof(chunk), &br)
+			|| !br) return 1;
+		for (i = 0; i < br; i++)
+			if (!chunk[i]) return f_lseek(&fLog, f_tell(&fLog) - br + i)?1:0;
+	}
+	return f_lseek(&fLog, head)?1:0;
+}
+
+/************************************************************************//**
+ * \brief Fills the log file with NUL bytes from the head to the end of its
+ * sector, so the head can be found on open. The cursor is moved back to the
+ * head, so next lines overwrite the padding.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char LogPad(void)
+{
+	char zero[16];
+	DWORD head = f_tell(&fLog);
+	UINT len, bw;
+
+	if (head >= LOG_FILE_LEN) return 1;
+	memset(zero, 0, sizeof(zero));
+	for (len = _MAX_SS - head % _MAX_SS; len; len -= bw)
+		if (f_write(&fLog, zero, len < sizeof(zero)?len:sizeof(zero), &bw) ||
+			!bw) return 1;
+	return f_lseek(&fLog, head)?1:0;
+}
+
+/************************************************************************//**
+ * \brief Opens the log files, creating them if needed, and places the
+ * cursors at the text log head and at the binary log end. Lines and
+ * records in RAM are written by the next LogTask() call.
+ *
+ * \return 0 if OK, nonzero if the text log could not be opened.
+ ****************************************************************************/
+char LogOpen(void)
+{
+	logOpen = FALSE;
+	unsynced = 0;
+#if LOG_BIN_RECS
+	/// Append to the binary log after its last whole record
+	binOpen = !f_open(&fBin, LOG_BIN_FILE, FA_READ | FA_WRITE | FA_OPEN_ALWAYS)
+		&& !f_lseek(&fBin, f_size(&fBin) & ~(DWORD)(LOG_REC_LEN - 1));
+#endif
+	if (LogFileOpen(FA_OPEN_ALWAYS) || LogHdrRead(&hdrHead)) return 1;
+	if (!hdrHead)
+	{
+		/// Not a circular log of LOG_FILE_LEN bytes, e.g. written by an
+		/// older firmware. Keep it aside and start a new one.
+		if (f_size(&fLog))
+		{
+			f_close(&fLog);
+			f_unlink(LOG_OLD_FILE);
+			if (f_rename(LOG_FILE, LOG_OLD_FILE) ||
+				LogFileOpen(FA_CREATE_NEW)) return 1;
+		}
+		if (LogCreate()) return 1;
+	}
+	if (LogSeekHead(hdrHead)) return 1;
+	logOpen = TRUE;
+#if MMC_CACHE_SECTS
+	LogPin();
+#endif
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Stops writing to the log files, e.g. because the card has been
+ * removed. The files cannot be synced anymore, so they are just dropped.
+ * Lines and records not written yet are kept in RAM.
+ ****************************************************************************/
+void LogClose(void)
+{
+	logOpen = FALSE;
+#if LOG_BIN_RECS
+	binOpen = FALSE;
+#endif
+}
+
+/************************************************************************//**
+ * \brief Writes a number in decimal, with leading zeros.
+ *
+ * \param[out] str    Buffer receiving the digits.
+ * \param[in]  val    Number to write.
+ * \param[in]  digits Number of digits to write.
+ *
+ * \return Pointer to the end of the written digits.
+ ****************************************************************************/
+static char *LogDec(char str[], WORD val, BYTE digits)
+{
+	BYTE i;
+
+	for (i = digits; i; i--, val /= 10) str[i - 1] = '0' + val % 10;
+	return str + digits;
+}
+
+/************************************************************************//**
+ * \brief Appends a string to the ring. There must be room for it.
+ *
+ * \param[in] str String to append.
+ ****************************************************************************/
+static void LogPut(const char str[])
+{
+	while (*str)
+	{
+		ring[rHead] = *str++;
+		rHead = (rHead + 1) & (LOG_BUF_LEN - 1);
+	}
+}
+
+/************************************************************************//**
+ * \brief Appends a line to the ring, made of the date and time stamp and
+ * up to two strings separated by a blank.
+ *
+ * \param[in] str1 First string.
+ * \param[in] str2 Second string, or NULL if none.
+ ****************************************************************************/
+static void LogLine(const char str1[], const char str2[])
+{
+	char stamp[LOG_STAMP_LEN + 1];
+	char *p = stamp;
+	WORD y, len;
+	BYTE mo, d, h, mi, s;
+
+	RtcGetDateTime(&y, &mo, &d, &h, &mi, &s);
+
+	/// e.g. "15/11/2013, 09:51 --> "
+	p = LogDec(p, d, 2);
+	*p++ = '/';
+	p = LogDec(p, mo, 2);
+	*p++ = '/';
+	p = LogDec(p, y, 4);
+	*p++ = ',';
+	*p++ = ' ';
+	p = LogDec(p, h, 2);
+	*p++ = ':';
+	p = LogDec(p, mi, 2);
+	strcpy(p, " --> ");
+
+	/// Drop the line if it does not fit, the ring keeps one byte free
+	len = LOG_STAMP_LEN + strlen(str1) + (str2?strlen(str2) + 1:0) + 1;
+	if (len > ((rTail - rHead - 1) & (LOG_BUF_LEN - 1)))
+	{
+		lost++;
+		return;
+	}
+	LogPut(stamp);
+	LogPut(str1);
+	if (str2)
+	{
+		LogPut(" ");
+		LogPut(str2);
+	}
+	LogPut("\n");
+}
+
+/************************************************************************//**
+ * \brief Logs a string, preceded by the date and time.
+ *
+ * \param[in] str String to log.
+ ****************************************************************************/
+void Log(const char str[])
+{
+	LogLine(str, NULL);
+}
+
+/************************************************************************//**
+ * \brief Logs a number and a string, preceded by the date and time.
+ *
+ * \param[in] num String containing the number to log.
+ * \param[in] str String to log along with num.
+ ****************************************************************************/
+void LogNumStr(const char num[], const char str[])
+{
+	LogLine(num, str);
+}
+
+/************************************************************************//**
+ * \brief Logs a call as a binary record, with the current date and time.
+ * Does nothing if the binary log is disabled.
+ *
+ * \param[in] num    Caller number, as received in the caller ID, or NULL if
+ *                   not received.
+ * \param[in] event  LOG_EV_* call event.
+ * \param[in] reason TF_* code of the filter decision (see tel_filt.h), or
+ *                   LOG_NO_REASON.
+ * \param[in] act    CA_* action performed (see call_act.h).
+ ****************************************************************************/
+void LogCall(const char num[], BYTE event, BYTE reason, BYTE act)
+{
+#if LOG_BIN_RECS
+	BYTE *rec;
+	DWORD t;
+
+	if (binCount == LOG_BIN_RECS)
+	{
+		binLost = TRUE;
+		return;
+	}
+	rec = bin[binHead];
+	if (++binHead == LOG_BIN_RECS) binHead = 0;
+	binCount++;
+
+	t = get_fattime();
+	ST_DWORD(rec + LOG_REC_TIME, t);
+	rec[LOG_REC_FLAGS] = binLost?LOG_F_LOST:0;
+	binLost = FALSE;
+	if (!num || TnPackNorm(num, rec + LOG_REC_NUM))
+	{
+		memset(rec + LOG_REC_NUM, 0xFF, TN_PACK_LEN);
+		rec[LOG_REC_FLAGS] |= LOG_F_NO_NUM;
+	}
+	rec[LOG_REC_EVENT] = event;
+	rec[LOG_REC_REASON] = reason;
+	rec[LOG_REC_ACTION] = act;
+#endif
+}
+
+#if LOG_BIN_RECS
+/************************************************************************//**
+ * \brief Writes the binary records in RAM to the binary log file, without
+ * syncing it. Records that could not be written are kept in RAM.
+ ****************************************************************************/
+static void LogBinDrain(void)
+{
+	BYTE i;
+	UINT bw;
+
+	if (!binOpen) return;
+	while (binCount)
+	{
+		i = binHead + LOG_BIN_RECS - binCount;
+		if (i >= LOG_BIN_RECS) i -= LOG_BIN_RECS;
+		if (f_write(&fBin, bin[i], LOG_REC_LEN, &bw) || (bw != LOG_REC_LEN))
+		{
+			/// Overwrite the partial record next time
+			f_lseek(&fBin, f_tell(&fBin) & ~(DWORD)(LOG_REC_LEN - 1));
+			return;
+		}
+		binCount--;
+		unsynced += LOG_REC_LEN;
+	}
+}
+#endif
+
+/************************************************************************//**
+ * \brief Syncs the log files, if there are bytes written and not synced.
+ ****************************************************************************/
+static void LogFlush(void)
+{
+	char err = 0;
+
+	if (!unsynced) return;
+	/// The header is updated when the head has moved LOG_HDR_STEP bytes
+	/// past the recorded one, or has wrapped (so the subtraction overflows)
+	if (logOpen && (LogPad() || ((f_tell(&fLog) - hdrHead >= LOG_HDR_STEP)
+		&& LogHdrWrite()) || f_sync(&fLog))) err = 1;
+#if LOG_BIN_RECS
+	if (binOpen && f_sync(&fBin)) err = 1;
+#endif
+	if (!err) unsynced = 0;
+}
+
+/************************************************************************//**
+ * \brief Writes the lines in the ring to the log file, without syncing it.
+ * Lines that could not be written are kept in the ring.
+ ****************************************************************************/
+static void LogDrain(void)
+{
+	char str[24];
+	DWORD sect;
+	WORD len, val;
+	BYTE digits;
+	UINT bw;
+
+	if (!logOpen) return;
+	do {
+		/// Write up to the end of the ring, and then from its start
+		while (rTail != rHead)
+		{
+			len = (rHead > rTail?rHead:LOG_BUF_LEN) - rTail;
+			/// Write up to the end of the file, and wrap to its first line
+			if ((f_tell(&fLog) == LOG_FILE_LEN) &&
+				f_lseek(&fLog, LOG_HDR_LEN)) return;
+			if (len > LOG_FILE_LEN - f_tell(&fLog))
+				len = LOG_FILE_LEN - f_tell(&fLog);
+			sect = f_tell(&fLog) / _MAX_SS;
+			if (f_write(&fLog, ring + rTail, len, &bw)) bw = 0;
+			rTail = (rTail + bw) & (LOG_BUF_LEN - 1);
+			unsynced += bw;
+			if (bw != len) return;
+			if ((f_tell(&fLog) == LOG_FILE_LEN) &&
+				f_lseek(&fLog, LOG_HDR_LEN)) return;
+			/// The padding after the head is lost when its sector is
+			/// written back, so the new head sector is padded right away
+			if (f_tell(&fLog) / _MAX_SS != sect) LogFlush();
+		}
+		if (!lost) return;
+		/// Report the lines dropped, now there is room for it
+		for (digits = 1, val = lost; val >= 10; val /= 10) digits++;
+		strcpy(LogDec(str, lost, digits), " LOG LINES LOST");
+		lost = 0;
+		Log(str);
+	} while (TRUE);
+}
+
+/************************************************************************//**
+ * \brief Writes the lines and records in RAM to the log files. The files
+ * are synced if LOG_SYNC_WM bytes or more are pending. Must be called only
+ * while the system is idle.
+ ****************************************************************************/
+void LogTask(void)
+{
+	LogDrain();
+#if LOG_BIN_RECS
+	LogBinDrain();
+#endif
+	if (unsynced >= LOG_SYNC_WM) LogFlush();
+}
+
+/************************************************************************//**
+ * \brief Writes the lines and records in RAM to the log files, and syncs
+ * them. Must be called before sleeping, so the log is on the card if power
+ * fails.
+ ****************************************************************************/
+void LogSync(void)
+{
+	LogDrain();
+#if LOG_BIN_RECS
+	LogBinDrain();
+#endif
+	LogFlush();
+}
@@ -0,0 +1,175 @@
+/************************************************************************//**
+ * \file  ev_log.h
+ * \brief Buffered event log.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _EV_LOG_H_
+#define _EV_LOG_H_
+
+#include "types.h"
+
+/** \defgroup ev_log_api ev_log
+ *
+ * Buffered event log. Lines are stamped with the date and time and
+ * appended to a RAM ring, that takes a few microseconds, so the call path
+ * never waits for the SD card. The ring is written to the log file by
+ * LogTask(), that must be called when the system is idle between calls.
+ * Writes are synced to the card only when LOG_SYNC_WM bytes are pending or
+ * when LogSync() is called, e.g. before sleeping. Lines that do not fit in
+ * the ring are dropped and counted, and the count is logged later.
+ *
+ * While the log file is not open (e.g. the card is not inserted), lines
+ * stay in the ring, and are written when the file is opened.
+ *
+ * The log file is a circular buffer of LOG_FILE_LEN bytes, allocated at
+ * once (in a single contiguous block if the card has one), so appending
+ * lines never allocates clusters nor touches the FAT. A header sector holds
+ * a text line with the offset of the head, updated when the head wraps or
+ * moves LOG_HDR_STEP bytes. The head is always followed by NUL bytes up to
+ * the end of its sector, so on open it is found scanning forward from the
+ * recorded offset. A log file without a valid header (e.g. written by an
+ * older firmware) is renamed to LOG_OLD_FILE and a new one is started.
+ *
+ * Calls are also logged as fixed length binary records to LOG_BIN_FILE,
+ * unless LOG_BIN_RECS is 0. Records are appended in place, and a record
+ * never crosses a sector boundary, so each one costs a single sector
+ * update. A record truncated by a power failure is overwritten by the
+ * next one. The ballog host tool converts the binary log to CSV or JSON.
+ * \{ */
+
+/// Log file name
+#define LOG_FILE		"BALSAMO.LOG"
+/// Log file length, including the header sector. Must be a multiple of the
+/// sector length.
+#define LOG_FILE_LEN	131072UL
+/// Head advance, in bytes, that triggers a log file header update. Bounds
+/// the bytes scanned to find the head on open.
+#define LOG_HDR_STEP	4096
+/// Name a log file without a valid header is renamed to
+#define LOG_OLD_FILE	"BALSAMO.OLD"
+/// Length of the RAM ring. Must be a power of 2.
+#define LOG_BUF_LEN		256
+/// Bytes written and not synced that trigger a sync
+#define LOG_SYNC_WM		192
+/// Give the log file a private sector buffer (1), so appends neither evict
+/// nor are evicted by the sectors in the shared FatFs window, or not (0).
+/// Takes 512 bytes of RAM, and needs _FS_FILEBUF (see ffconf.h).
+#define LOG_FILE_BUF	1
+
+/// Binary log file name
+#define LOG_BIN_FILE	"BALSAMO.BLG"
+/// Binary records buffered in RAM. Set to 0 to disable the binary log.
+#define LOG_BIN_RECS	4
+/// Binary record length. Must divide the sector length.
+#define LOG_REC_LEN		16
+
+/// \name Binary record fields
+/// \{
+#define LOG_REC_TIME	0	///< Date and time as get_fattime() (DWORD)
+#define LOG_REC_NUM		4	///< Packed canonical number (TN_PACK_LEN)
+#define LOG_REC_EVENT	12	///< LOG_EV_* call event (BYTE)
+#define LOG_REC_REASON	13	///< TF_* filter decision or LOG_NO_REASON (BYTE)
+#define LOG_REC_ACTION	14	///< CA_* action performed (BYTE)
+#define LOG_REC_FLAGS	15	///< LOG_F_* quality flags (BYTE)
+/// \}
+
+/// \name Call events
+/// \{
+#define LOG_EV_ALLOWED		0	///< Call allowed
+#define LOG_EV_BLOCKED		1	///< Call blocked
+#define LOG_EV_NOT_SENT		2	///< Caller ID not received
+#define LOG_EV_CID_ERROR	3	///< Caller ID could not be decoded
+/// \}
+
+/// No filter decision was taken (e.g. caller ID not received)
+#define LOG_NO_REASON		0xFF
+
+/// \name Quality flags
+/// \{
+/// The number was not received, or could not be normalized (e.g. hidden
+/// numbers). The number field is filled with 0xFF.
+#define LOG_F_NO_NUM		0x01
+/// Records were dropped before this one because the RAM buffer was full
+#define LOG_F_LOST			0x02
+/// \}
+
+/************************************************************************//**
+ * \brief Opens the log files, creating them if needed, and places the
+ * cursors at the text log head and at the binary log end. Lines and
+ * records in RAM are written by the next LogTask() call.
+ *
+ * \return 0 if OK, nonzero if the text log could not be opened.
+ ****************************************************************************/
+char LogOpen(void);
+
+/************************************************************************//**
+ * \brief Stops writing to the log files, e.g. because the card has been
+ * removed. The files cannot be synced anymore, so they are just dropped.
+ * Lines and records not written yet are kept in RAM.
+ ****************************************************************************/
+void LogClose(void);
+
+/************************************************************************//**
+ * \brief Logs a string, preceded by the date and time.
+ *
+ * \param[in] str String to log.
+ ****************************************************************************/
+void Log(const char str[]);
+
+/************************************************************************//**
+ * \brief Logs a number and a string, preceded by the date and time.
+ *
+ * \param[in] num String containing the number to log.
+ * \param[in] str String to log along with num.
+ ****************************************************************************/
+void LogNumStr(const char num[], const char str[]);
+
+/************************************************************************//**
+ * \brief Logs a call as a binary record, with the current date and time.
+ * Does nothing if the binary log is disabled.
+ *
+ * \param[in] num    Caller number, as received in the caller ID, or NULL if
+ *                   not received.
+ * \param[in] event  LOG_EV_* call event.
+ * \param[in] reason TF_* code of the filter decision (see tel_filt.h), or
+ *                   LOG_NO_REASON.
+ * \param[in] act    CA_* action performed (see call_act.h).
+ ****************************************************************************/
+void LogCall(const char num[], BYTE event, BYTE reason, BYTE act);
+
+/************************************************************************//**
+ * \brief Writes the lines and records in RAM to the log files. The files
+ * are synced if LOG_SYNC_WM bytes or more are pending. Must be called only
+ * while the system is idle.
+ ****************************************************************************/
+void LogTask(void);
+
+/************************************************************************//**
+ * \brief Writes the lines and records in RAM to the log files, and syncs
+ * them. Must be called before sleeping, so the log is on the card if power
+ * fails.
+ ****************************************************************************/
+void LogSync(void);
+
+/** \} */
+
+#endif /*_EV_LOG_H_*/
@@ -11,6 +11,10 @@ extern "C" {
 
 #define _USE_WRITE	1	/* 1: Enable disk_write function */
 #define _USE_IOCTL	1	/* 1: Enable disk_ioctl fucntion */
+#define MMC_CACHE_SECTS	2	/* Sectors in the write-back cache (0: no cache) */
+#define MMC_USE_BENCH	0	/* 1: Enable the MMC_BENCH transfer benchmark */
+#define MMC_BENCH_SECTS	32	/* Sectors read for each MMC_BENCH measure */
+#define MMC_BENCH_CLOCKS	5	/* SPI clocks measured by MMC_BENCH */
 
 #include "../types.h"
 
@@ -71,6 +75,17 @@ void disk_timerproc (void);
 #define MMC_GET_CID			12	/* Get CID */
 #define MMC_GET_OCR			13	/* Get OCR */
 #define MMC_GET_SDSTAT		14	/* Get SD status */
+#define MMC_CHK_CARD		15	/* Check the card still answers (CMD13) */
+#define MMC_STREAM			16	/* Enable/disable streaming reads (CMD18 kept open) */
+#define MMC_CACHE_PIN		17	/* Pin a sector in the cache (0 unpins all) */
+#define MMC_CACHE_STAT		18	/* Get cache hits and misses */
+#define MMC_CACHE_LEND		19	/* Flush the cache and lend its memory */
+#define MMC_CACHE_RETURN	20	/* Get the lent cache memory back */
+#define MMC_GET_CLOCK		21	/* Get the negotiated SPI clock */
+#define MMC_CRC				22	/* Enable/disable CRC checks (CMD59) */
+#define MMC_GET_CRC			23	/* Get CRC checks state and errors found */
+#define MMC_BENCH			24	/* Time reads at each clock with CRC off and on */
+#define MMC_POWER_IDLE		25	/* Power the card down if idle (see CTRL_POWER) */
 
 /* ATA/CF specific ioctl command */
 #define ATA_GET_REV			20	/* Get F/W revision */
@@ -94,6 +94,7 @@
 /                   Changed f_open() and f_opendir reject null object pointer to avoid crash.
 /                   Changed option name _FS_SHARE to _FS_LOCK.
 / Jan 24,'13 R0.09b Added f_setlabel() and f_getlabel(). (_USE_LABEL = 1)
+/                   Backported f_expand() from later revisions. (_USE_EXPAND = 1)
 /---------------------------------------------------------------------------*/
 
 #include "ff.h"			/* FatFs configurations and declarations */
@@ -122,6 +123,17 @@
 #endif
 
 
+/* File data path. In tiny configuration, file data goes through the window
+/  unless the file has been given a private sector buffer (_FS_FILEBUF) */
+#if !_FS_TINY
+#define	TINY_IO(fp)	0
+#elif _FS_FILEBUF
+#define	TINY_IO(fp)	(!(fp)->buf)
+#else
+#define	TINY_IO(fp)	1
+#endif
+
+
 /* Reentrancy related */
 #if _FS_REENTRANT
 #if _USE_LFN == 1
@@ -2422,6 +2434,9 @@ FRESULT f_open (
 			fp->dsect = 0;
 #if _USE_FASTSEEK
 			fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _FS_TINY && _FS_FILEBUF
+			fp->buf = 0;						/* Data through the window */
 #endif
 			fp->fs = dj.fs; fp->id = dj.fs->id;	/* Validate file object */
 		}
@@ -2491,18 +2506,23 @@ FRESULT f_read (
 					ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if _FS_TINY
-				if (fp->fs->wflag && fp->fs->winsect - sect < cc)
-					mem_cpy(rbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), fp->fs->win, SS(fp->fs));
-#else
-				if ((fp->flag & FA__DIRTY) && fp->dsect - sect < cc)
-					mem_cpy(rbuff + ((fp->dsect - sect) * SS(fp->fs)), fp->buf, SS(fp->fs));
+				if (TINY_IO(fp)) {
+					if (fp->fs->wflag && fp->fs->winsect - sect < cc)
+						mem_cpy(rbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), fp->fs->win, SS(fp->fs));
+				} else
 #endif
+				{
+#if !_FS_TINY || _FS_FILEBUF
+					if ((fp->flag & FA__DIRTY) && fp->dsect - sect < cc)
+						mem_cpy(rbuff + ((fp->dsect - sect) * SS(fp->fs)), fp->buf, SS(fp->fs));
+#endif
+				}
 #endif
 				rcnt = SS(fp->fs) * cc;			/* Number of bytes transferred */
 				continue;
 			}
-#if !_FS_TINY
-			if (fp->dsect != sect) {			/* Load data sector if not in cache */
+#if !_FS_TINY || _FS_FILEBUF
+			if (!TINY_IO(fp) && fp->dsect != sect) {	/* Load data sector if not in cache */
 #if !_FS_READONLY
 				if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
 					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
@@ -2519,12 +2539,17 @@ FRESULT f_read (
 		rcnt = SS(fp->fs) - ((UINT)fp->fptr % SS(fp->fs));	/* Get partial sector data from sector buffer */
 		if (rcnt > btr) rcnt = btr;
 #if _FS_TINY
-		if (move_window(fp->fs, fp->dsect))		/* Move sector window */
-			ABORT(fp->fs, FR_DISK_ERR);
-		mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
-#else
-		mem_cpy(rbuff, &fp->buf[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
+		if (TINY_IO(fp)) {
+			if (move_window(fp->fs, fp->dsect))		/* Move sector window */
+				ABORT(fp->fs, FR_DISK_ERR);
+			mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
+		} else
 #endif
+		{
+#if !_FS_TINY || _FS_FILEBUF
+			mem_cpy(rbuff, &fp->buf[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
+#endif
+		}
 	}
 
 	LEAVE_FF(fp->fs, FR_OK);
@@ -2585,15 +2610,20 @@ FRESULT f_write (
 				fp->clust = clst;			/* Update current cluster */
 			}
 #if _FS_TINY
-			if (fp->fs->winsect == fp->dsect && sync_window(fp->fs))	/* Write-back sector cache */
-				ABORT(fp->fs, FR_DISK_ERR);
-#else
-			if (fp->flag & FA__DIRTY) {		/* Write-back sector cache */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+			if (TINY_IO(fp)) {
+				if (fp->fs->winsect == fp->dsect && sync_window(fp->fs))	/* Write-back sector cache */
 					ABORT(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
-			}
+			} else
+#endif
+			{
+#if !_FS_TINY || _FS_FILEBUF
+				if (fp->flag & FA__DIRTY) {		/* Write-back sector cache */
+					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+					fp->flag &= ~FA__DIRTY;
+				}
 #endif
+			}
 			sect = clust2sect(fp->fs, fp->clust);	/* Get current sector */
 			if (!sect) ABORT(fp->fs, FR_INT_ERR);
 			sect += csect;
@@ -2604,44 +2634,59 @@ FRESULT f_write (
 				if (disk_write(fp->fs->drv, wbuff, sect, (BYTE)cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_TINY
-				if (fp->fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
-					mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
-					fp->fs->wflag = 0;
-				}
-#else
-				if (fp->dsect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
-					mem_cpy(fp->buf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
-					fp->flag &= ~FA__DIRTY;
-				}
+				if (TINY_IO(fp)) {
+					if (fp->fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
+						mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
+						fp->fs->wflag = 0;
+					}
+				} else
 #endif
+				{
+#if !_FS_TINY || _FS_FILEBUF
+					if (fp->dsect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
+						mem_cpy(fp->buf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
+						fp->flag &= ~FA__DIRTY;
+					}
+#endif
+				}
 				wcnt = SS(fp->fs) * cc;		/* Number of bytes transferred */
 				continue;
 			}
 #if _FS_TINY
-			if (fp->fptr >= fp->fsize) {	/* Avoid silly cache filling at growing edge */
-				if (sync_window(fp->fs)) ABORT(fp->fs, FR_DISK_ERR);
-				fp->fs->winsect = sect;
-			}
-#else
-			if (fp->dsect != sect) {		/* Fill sector cache with file data */
-				if (fp->fptr < fp->fsize &&
-					disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
-						ABORT(fp->fs, FR_DISK_ERR);
-			}
+			if (TINY_IO(fp)) {
+				if (fp->fptr >= fp->fsize) {	/* Avoid silly cache filling at growing edge */
+					if (sync_window(fp->fs)) ABORT(fp->fs, FR_DISK_ERR);
+					fp->fs->winsect = sect;
+				}
+			} else
+#endif
+			{
+#if !_FS_TINY || _FS_FILEBUF
+				if (fp->dsect != sect) {		/* Fill sector cache with file data */
+					if (fp->fptr < fp->fsize &&
+						disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
+							ABORT(fp->fs, FR_DISK_ERR);
+				}
 #endif
+			}
 			fp->dsect = sect;
 		}
 		wcnt = SS(fp->fs) - ((UINT)fp->fptr % SS(fp->fs));/* Put partial sector into file I/O buffer */
 		if (wcnt > btw) wcnt = btw;
 #if _FS_TINY
-		if (move_window(fp->fs, fp->dsect))	/* Move sector window */
-			ABORT(fp->fs, FR_DISK_ERR);
-		mem_cpy(&fp->fs->win[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
-		fp->fs->wflag = 1;
-#else
-		mem_cpy(&fp->buf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
-		fp->flag |= FA__DIRTY;
+		if (TINY_IO(fp)) {
+			if (move_window(fp->fs, fp->dsect))	/* Move sector window */
+				ABORT(fp->fs, FR_DISK_ERR);
+			mem_cpy(&fp->fs->win[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
+			fp->fs->wflag = 1;
+		} else
+#endif
+		{
+#if !_FS_TINY || _FS_FILEBUF
+			mem_cpy(&fp->buf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
+			fp->flag |= FA__DIRTY;
 #endif
+		}
 	}
 
 	if (fp->fptr > fp->fsize) fp->fsize = fp->fptr;	/* Update file size if needed */
@@ -2669,8 +2714,8 @@ FRESULT f_sync (
 	res = validate(fp);					/* Check validity of the object */
 	if (res == FR_OK) {
 		if (fp->flag & FA__WRITTEN) {	/* Has the file been written? */
-#if !_FS_TINY	/* Write-back dirty buffer */
-			if (fp->flag & FA__DIRTY) {
+#if !_FS_TINY || _FS_FILEBUF	/* Write-back dirty buffer */
+			if (!TINY_IO(fp) && (fp->flag & FA__DIRTY)) {
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 					LEAVE_FF(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
@@ -2926,16 +2971,18 @@ FRESULT f_lseek (
 				if (!dsc) ABORT(fp->fs, FR_INT_ERR);
 				dsc += (ofs - 1) / SS(fp->fs) & (fp->fs->csize - 1);
 				if (fp->fptr % SS(fp->fs) && dsc != fp->dsect) {	/* Refill sector cache if needed */
-#if !_FS_TINY
+#if !_FS_TINY || _FS_FILEBUF
+					if (!TINY_IO(fp)) {
 #if !_FS_READONLY
-					if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
-						if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+						if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
+							if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+								ABORT(fp->fs, FR_DISK_ERR);
+							fp->flag &= ~FA__DIRTY;
+						}
+#endif
+						if (disk_read(fp->fs->drv, fp->buf, dsc, 1) != RES_OK)	/* Load current sector */
 							ABORT(fp->fs, FR_DISK_ERR);
-						fp->flag &= ~FA__DIRTY;
 					}
-#endif
-					if (disk_read(fp->fs->drv, fp->buf, dsc, 1) != RES_OK)	/* Load current sector */
-						ABORT(fp->fs, FR_DISK_ERR);
 #endif
 					fp->dsect = dsc;
 				}
@@ -3001,16 +3048,18 @@ FRESULT f_lseek (
 			}
 		}
 		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
-#if !_FS_TINY
+#if !_FS_TINY || _FS_FILEBUF
+			if (!TINY_IO(fp)) {
 #if !_FS_READONLY
-			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+				if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
+					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+					fp->flag &= ~FA__DIRTY;
+				}
+#endif
+				if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
 					ABORT(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
 			}
-#endif
-			if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
-				ABORT(fp->fs, FR_DISK_ERR);
 #endif
 			fp->dsect = nsect;
 		}
@@ -3729,6 +3778,80 @@ FRESULT f_setlabel (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Cluster Block to the File                       */
+/*-----------------------------------------------------------------------*/
+#if _USE_EXPAND && !_FS_READONLY
+
+FRESULT f_expand (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD fsz,		/* File size to be expanded to */
+	BYTE opt		/* Operation mode 0:Find and prepare or 1:Find and allocate */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, stcl, scl, ncl, tcl;
+
+
+	res = validate(fp);						/* Check validity of the object */
+	if (res == FR_OK && (fp->flag & FA__ERROR)) res = FR_INT_ERR;
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	fs = fp->fs;
+	if (fsz == 0 || fp->fsize != 0 || !(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+
+	n = (DWORD)fs->csize * SS(fs);			/* Cluster size */
+	tcl = fsz / n + ((fsz % n) ? 1 : 0);	/* Number of clusters required */
+	stcl = fs->last_clust;					/* Search from the last allocated cluster */
+	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+
+	scl = clst = stcl; ncl = 0;
+	for (;;) {								/* Find a contiguous cluster block */
+		n = get_fat(fs, clst);
+		if (n == 1) { res = FR_INT_ERR; break; }
+		if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (n == 0) {						/* Free cluster, extend the block */
+			if (++ncl == tcl) break;
+		} else {							/* Not free, restart the block */
+			ncl = 0;
+		}
+		if (++clst >= fs->n_fatent) {		/* Wrap around, a block cannot span it */
+			clst = 2; ncl = 0;
+		}
+		if (ncl == 0) scl = clst;
+		if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous block */
+	}
+
+	if (res == FR_OK) {
+		if (opt) {							/* Create the cluster chain */
+			for (clst = scl, n = tcl; n; clst++, n--) {
+				res = put_fat(fs, clst, (n == 1) ? 0x0FFFFFFF : clst + 1);
+				if (res != FR_OK) break;
+			}
+			if (res == FR_OK) {
+				fs->last_clust = scl + tcl - 1;
+				fp->sclust = scl;
+				fp->fsize = fsz;
+				fp->flag |= FA__WRITTEN;
+				if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSInfo */
+					fs->free_clust -= tcl;
+					fs->fsi_flag = 1;
+				}
+			} else {
+				fp->flag |= FA__ERROR;
+			}
+		} else {							/* Next allocation starts at the block */
+			fs->last_clust = scl - 1;
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_EXPAND && !_FS_READONLY */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Forward data to the stream directly (available on only tiny cfg)      */
 /*-----------------------------------------------------------------------*/
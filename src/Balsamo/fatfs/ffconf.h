@@ -20,6 +20,14 @@
 /  data transfer. This reduces memory consumption 512 bytes each file object. */
 
 
+#define	_FS_FILEBUF		1	/* 0:Disable or 1:Enable */
+/* When _FS_FILEBUF is set to 1 along with _FS_TINY, a file can be given a
+/  private sector buffer of _MAX_SS bytes, setting the buf member of the file
+/  object right after opening it. Data of that file does not go through the
+/  file system object window, so it does not evict (and is not evicted by)
+/  directory, FAT and other files sectors. */
+
+
 #define _FS_READONLY	0	/* 0:Read/Write or 1:Read only */
 /* Setting _FS_READONLY to 1 defines read only configuration. This removes
 /  writing functions, f_write, f_sync, f_unlink, f_mkdir, f_chmod, f_rename,
@@ -40,14 +48,23 @@
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
 
+#ifndef _USE_MKFS
 #define	_USE_MKFS		0	/* 0:Disable or 1:Enable */
-/* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */
+#endif
+/* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0.
+/  The host tools (e.g. balsim) enable it from the command line. */
 
 
-#define	_USE_FASTSEEK	0	/* 0:Disable or 1:Enable */
+#define	_USE_FASTSEEK	1	/* 0:Disable or 1:Enable */
 /* To enable fast seek feature, set _USE_FASTSEEK to 1. */
 
 
+#define	_USE_EXPAND		1	/* 0:Disable or 1:Enable */
+/* To enable f_expand function, set _USE_EXPAND to 1. It allocates a
+/  contiguous cluster block to an empty file (backported from later FatFs
+/  revisions). */
+
+
 #define _USE_LABEL		1	/* 0:Disable or 1:Enable */
 /* To enable volume label functions, set _USE_LAVEL to 1 */
 
@@ -13,7 +13,10 @@
 
 
 #include <p30f6014.h>
+#include <string.h>
 #include "diskio.h"
+#include "../common.h"
+#include "../crc.h"
 
 
 /// Status LED
@@ -25,12 +28,70 @@
 #define CS_LOW()  (_LATG9 = 0)	/* MMC CS = L */
 #define CS_HIGH() (_LATG9 = 1)	/* MMC CS = H */
 #define WP	0 //(PORTB & (1<<10))	/* Write protected (yes:true, no:false, default:false) */
+/// \note Rev.B has no card detect switch (RB11 drives the LCD), so INS is
+/// always true. Removal is detected polling the card with MMC_CHK_CARD.
 #define INS	1 //!(PORTB & (1<<11))	/* Card inserted   (yes:true, no:false, default:true) */
+/// \note Rev.B has no socket power switch either, the card is powered with
+/// the board. A board with one defines these and sets MMC_SOCKET_SWITCH.
+#define SOCKET_ON()			/* Turn on socket power */
+#define SOCKET_OFF()		/* Turn off socket power */
+
+/// SOCKET_OFF() removes the card power (1), or it does nothing and the card
+/// keeps its state while powered down (0)
+#ifndef MMC_SOCKET_SWITCH
+#define MMC_SOCKET_SWITCH	0
+#endif
+/// Time without commands after which MMC_POWER_IDLE powers the card down,
+/// in ms (0: never)
+#ifndef MMC_IDLE_MS
+#define MMC_IDLE_MS			2000
+#endif
 
 /* Set slow clock (100k-400k) */
-#define	FCLK_SLOW()			(SPI2CON = 0x013D)
-/* Set fast clock (depends on the CSD) */
-#define	FCLK_FAST()			(SPI2CON = 0x013F)
+#define	FCLK_SLOW()			spi_clock(0x013D)
+/* Set fast clock (negotiated with the card, see fclk_select()) */
+#define	FCLK_FAST()			spi_clock(FclkStep < FCLK_STEPS ? FclkCon[FclkStep] : 0x013D)
+
+/// Highest SPI clock the board traces support, in kHz (0: no limit other
+/// than the card and the MCU ones)
+#ifndef MMC_SPI_MAX_KHZ
+#define MMC_SPI_MAX_KHZ		0
+#endif
+/// Times the card is read back at each clock before accepting it
+#define MMC_PROBE_PASSES	4
+
+/// CRC checks on commands and data blocks (CMD59) are supported (1) or not
+/// (0). Enabled on initialization, they can be turned off with MMC_CRC.
+/// Off by default, as the data block CRCs are computed in software (see
+/// MMC_USE_BENCH to measure the overhead on a given card).
+#ifndef MMC_USE_CRC
+#define MMC_USE_CRC			0
+#endif
+/// Times a failed sector transfer is retried, at the next slower clock
+#define MMC_RETRIES			2
+
+/// Data blocks are moved by the SPI2 interrupt (1) or by busy polling (0)
+#ifndef MMC_SPI_INT
+#define MMC_SPI_INT			0
+#endif
+/// Lowest SPI clock divider at which MMC_SPI_INT uses the interrupt. At
+/// faster clocks a byte takes fewer cycles than serving its interrupt, so
+/// blocks are polled.
+#define MMC_SPI_INT_DIV		8
+/// SPI2 interrupt priority, below the audio PWM and 1 ms timer ones (4), so
+/// playback is not delayed by a sector transfer
+#define MMC_SPI_INT_PRIO	3
+
+/// Streaming reads enabled with the MMC_STREAM ioctl are supported (1) or
+/// not (0)
+#ifndef MMC_USE_STREAM
+#define MMC_USE_STREAM		1
+#endif
+
+/// Discards a stale received byte and clears the overrun flag. While SPIROV
+/// is set, the module ignores incoming data and SPIRBF never rises again,
+/// making any polling loop hang.
+#define SPI_FLUSH()			{(void)SPI2BUF; SPI2STATbits.SPIROV = 0;}
 
 
 
@@ -48,6 +109,7 @@
 #define CMD9   (9)			/* SEND_CSD */
 #define CMD10  (10)			/* SEND_CID */
 #define CMD12  (12)			/* STOP_TRANSMISSION */
+#define CMD13  (13)			/* SEND_STATUS */
 #define ACMD13 (13|0x80)	/* SD_STATUS (SDC) */
 #define CMD16  (16)			/* SET_BLOCKLEN */
 #define CMD17  (17)			/* READ_SINGLE_BLOCK */
@@ -59,6 +121,7 @@
 #define CMD41  (41)			/* SEND_OP_COND (ACMD) */
 #define CMD55  (55)			/* APP_CMD */
 #define CMD58  (58)			/* READ_OCR */
+#define CMD59  (59)			/* CRC_ON_OFF */
 
 
 static volatile
@@ -70,6 +133,64 @@ UINT Timer1, Timer2;		/* 1000Hz decrement timer */
 static
 UINT CardType;
 
+static
+BYTE Parked;				/* Powered down, woken up on the next access */
+static volatile
+UINT IdleTimer;				/* 1000Hz decrement timer, reloaded on each command */
+
+/* Fast clocks tried after initialization, fastest first: SPI2CON values
+   (CKE = 1, MSTEN = 1, SPRE/PPRE for Fcy/1, /2, /4 and /8) and dividers */
+#define FCLK_STEPS	4
+static const
+UINT FclkCon[FCLK_STEPS] = {0x013F, 0x013B, 0x013E, 0x013A};
+static const
+BYTE FclkDiv[FCLK_STEPS] = {1, 2, 4, 8};
+
+static
+BYTE FclkStep = FCLK_STEPS;	/* Fast clock in use, FCLK_STEPS for the slow one */
+static
+WORD FclkKhz[2];			/* SPI clock in use and card maximum, in kHz */
+
+#if MMC_USE_CRC
+static
+BYTE CrcOn;					/* CRC checks enabled (CMD59) */
+static
+WORD CrcErrors;				/* CRC mismatches found */
+#endif
+
+#if MMC_USE_BENCH
+static volatile
+UINT Ticks;					/* 1000Hz increment timer */
+#endif
+
+#if MMC_USE_STREAM
+static
+BYTE StreamOn;		/* Streaming reads enabled (MMC_STREAM ioctl) */
+static
+BYTE Streaming;		/* A CMD18 is open and the card is kept selected */
+static
+DWORD StreamNext;	/* LBA of the next block the open CMD18 will send */
+#endif
+
+#if MMC_CACHE_SECTS
+#define CF_VALID	0x01	/* Entry holds the sector data */
+#define CF_DIRTY	0x02	/* Entry data not written to the card yet */
+#define CF_PIN		0x04	/* Entry reserved for a pinned sector */
+
+static
+BYTE CacheBuf[MMC_CACHE_SECTS][512];	/* Cached sectors data */
+static
+DWORD CacheSect[MMC_CACHE_SECTS];		/* Sector (LBA) held by each entry */
+static
+BYTE CacheFlag[MMC_CACHE_SECTS];		/* CF_* entry flags */
+static
+BYTE CacheAge[MMC_CACHE_SECTS];			/* 0 for the most recently used */
+static
+BYTE CacheLent;							/* Memory lent, cache disabled */
+static
+DWORD CacheStat[2];						/* Hits and misses */
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Power Control  (Platform dependent)                                   */
 /*-----------------------------------------------------------------------*/
@@ -79,33 +200,73 @@ UINT CardType;
 static
 void power_on (void)
 {
-	;					/* Turn on socket power, delay >1ms (Nothing to do) */
+#if MMC_SOCKET_SWITCH
+	CS_HIGH();
+	SOCKET_ON();		/* Turn on socket power, delay >1ms */
+	for (Timer1 = 2; Timer1; ) ;
+#endif
+	Parked = 0;
 
 	// Configure and enable SPI2:
 	// CKE = 1, MSTEN = 1, SPRE = 111 (1:1), PPRE = 11 (1:1)
 	// Note: 
 	//SPI2CON  = 0x013F;
 	SPI2CON = 0x013D;	// 16:1
-	SPI2STAT = 0x8000; // SPIEN = 1, SPIROV = 0;
+	SPI2STAT = 0x8000; // SPIEN = 1, SPISIDL = 0 (run in Idle), SPIROV = 0;
+	SPI_FLUSH();
+	_SPI2IE = 0;
+	_SPI2IP = MMC_SPI_INT_PRIO;
 }
 
 static
-void power_off (void)
+void socket_off (void)
 {
+	_SPI2IE = 0;
 	SPI2STAT = 0;		// Disable SPI2
+#if MMC_SOCKET_SWITCH
+	CS_LOW();			// Do not feed the card through CS, SCK and DO
+	_LATG6 = 0;
+	_LATG8 = 0;
+	SOCKET_OFF();		/* Turn off socket power */
+#endif
+}
 
-	;					/* Turn off socket power (Nothing to do) */
+static
+void power_off (void)
+{
+	socket_off();
+#if MMC_USE_STREAM
+	Streaming = 0;		// The card forgets the open CMD18 on re-initialization
+#endif
+#if MMC_CACHE_SECTS
+	// The card may be replaced, or edited on a PC and put back. Writing the
+	// dirty entries over it would corrupt its FAT, so they are dropped too.
+	memset(CacheFlag, 0, sizeof(CacheFlag));
+#endif
 
 	Stat |= STA_NOINIT;	/* Force uninitialized */
 }
 
+/// Changes the SPI2 clock. SPI2CON must not be written while the module is
+/// enabled, doing it corrupts the transfer in progress and can leave SPIROV
+/// set, hanging the next xchg_spi().
+static
+void spi_clock (UINT con)
+{
+	SPI2STAT = 0;
+	SPI2CON = con;
+	SPI2STAT = 0x8000;
+	SPI_FLUSH();
+}
+
 
 /*-----------------------------------------------------------------------*/
 /* Transmit/Receive data to/from MMC via SPI  (Platform dependent)       */
 /*-----------------------------------------------------------------------*/
 
-/// \todo This function hangs when writing. It looks like there's overrun
-/// because SPIROV bit is set!!!
+/// \note Writes used to hang here with SPIROV set: the clock was changed
+/// with the module enabled, and an overrun stops SPIRBF from rising. Now
+/// spi_clock() disables the module first, and select() clears any overrun.
 static
 BYTE xchg_spi (BYTE dat)
 {
@@ -143,6 +304,71 @@ BYTE xchg_spi (BYTE dat)
 	} while(--c);								\
 }
 
+#if MMC_SPI_INT
+/* Block transfer state, owned by the SPI2 interrupt while XferCnt != 0 */
+static
+BYTE * volatile XferRx;			/* Receive pointer (0 when transmitting) */
+static
+const BYTE * volatile XferTx;	/* Transmit pointer (0 when receiving) */
+static volatile
+UINT XferCnt;					/* Bytes left, including the one in flight */
+
+/// SPI2 interrupt: stores the byte just received and sends the next one.
+/// The interrupt disables itself when the block is complete.
+void __attribute__((interrupt, auto_psv)) _SPI2Interrupt (void)
+{
+	BYTE d;
+
+	_SPI2IF = 0;
+	d = (BYTE)SPI2BUF;		/* Reading the buffer clears SPIRBF */
+	if (XferRx) *XferRx++ = d;
+	if (--XferCnt) SPI2BUF = XferTx ? *XferTx++ : 0xFF;
+	else _SPI2IE = 0;
+}
+
+/// Moves a data block with the SPI2 interrupt, Idling the CPU until it is
+/// complete. Falls back to polling if the caller runs at an interrupt
+/// priority that would mask the SPI2 one, or if the clock is too fast for
+/// the interrupt to keep up (see MMC_SPI_INT_DIV).
+static
+int xfer_spi_multi (	/* 1:OK, 0:Timeout */
+	BYTE *rx,			/* Receive buffer, or 0 to transmit */
+	const BYTE *tx,		/* Transmit buffer, or 0 to receive */
+	UINT cnt			/* Byte count (must be multiple of 2) */
+)
+{
+	if (_IPL >= MMC_SPI_INT_PRIO ||
+		(FclkStep < FCLK_STEPS && FclkDiv[FclkStep] < MMC_SPI_INT_DIV)) {
+		if (rx) RCVR_SPI_MULTI(rx, cnt)
+		else XMIT_SPI_MULTI(tx, cnt)
+		return 1;
+	}
+
+	SPI_FLUSH();
+	XferRx = rx;
+	XferTx = tx;
+	XferCnt = cnt;
+	_SPI2IF = 0;
+	_SPI2IE = 1;
+	SPI2BUF = tx ? *XferTx++ : 0xFF;	/* The interrupt sends the rest */
+
+	/* Test and Idle under disi, so an interrupt ending the block between
+	   both cannot leave the CPU Idling. Enabled interrupts still wake it
+	   up, and are served when _EI() ends the disi. */
+	Timer1 = 100;
+	for (;;) {
+		_DI();
+		if (!XferCnt || !Timer1) break;
+		Idle();						/* The 1 ms timer also wakes up */
+		_EI();
+	}
+	_EI();
+	_SPI2IE = 0;
+
+	return XferCnt ? 0 : 1;
+}
+#endif
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -186,7 +412,9 @@ static
 int select (void)	/* 1:Successful, 0:Timeout */
 {
 	STAT_LED_ON();
+	IdleTimer = MMC_IDLE_MS;
 	CS_LOW();
+	SPI_FLUSH();
 	xchg_spi(0xFF);		/* Dummy clock (force DO enabled) */
 
 	if (wait_ready()) return 1;	/* OK */
@@ -196,6 +424,34 @@ int select (void)	/* 1:Successful, 0:Timeout */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* CRC calculation                                                       */
+/*-----------------------------------------------------------------------*/
+/* Data packets are protected with the CRC16 in crc.c, computed with its */
+/* 256 entry table. Commands and registers use a CRC7, short enough to   */
+/* be computed bit by bit.                                               */
+
+/* CRC7 of a command or register, shifted left with the end bit set */
+static
+BYTE crc7 (
+	const BYTE *p,	/* Data */
+	UINT n			/* Byte count */
+)
+{
+	BYTE crc = 0, d, i;
+
+	while (n--) {
+		d = *p++;
+		for (i = 8; i; i--, d <<= 1) {
+			crc <<= 1;
+			if ((d ^ crc) & 0x80) crc ^= 0x09;	/* x^7 + x^3 + 1 */
+		}
+	}
+	return (crc << 1) | 1;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Receive a data packet from MMC                                        */
 /*-----------------------------------------------------------------------*/
@@ -207,6 +463,9 @@ int rcvr_datablock (	/* 1:OK, 0:Failed */
 )
 {
 	BYTE token;
+#if MMC_USE_CRC
+	WORD crc;
+#endif
 
 
 	/*if (!spin--)*/ STAT_LED_TOGGLE();
@@ -218,13 +477,62 @@ int rcvr_datablock (	/* 1:OK, 0:Failed */
 
 	if(token != 0xFE) return 0;		/* If not valid data token, retutn with error */
 
+#if MMC_SPI_INT
+	if (!xfer_spi_multi(buff, 0, btr)) return 0;	/* Receive the data block into buffer */
+#else
 	RCVR_SPI_MULTI(buff, btr);		/* Receive the data block into buffer */
+#endif
+#if MMC_USE_CRC
+	if (CrcOn) {					/* Check CRC */
+		crc = (WORD)xchg_spi(0xFF) << 8;
+		crc |= xchg_spi(0xFF);
+		if (crc != Crc16(CRC16_INIT, buff, btr)) {
+			CrcErrors++;
+			return 0;
+		}
+		return 1;
+	}
+#endif
 	xchg_spi(0xFF);					/* Discard CRC */
 	xchg_spi(0xFF);
 
 	return 1;						/* Return with success */
 }
 
+/* Receive a data packet byte by byte, storing only its first bytes and
+   always checking its CRC16 (e.g. for partial register reads) */
+static
+int rcvr_checked (	/* 1:OK, 0:Failed */
+	BYTE *buff,		/* Data buffer, or 0 to discard the data */
+	UINT bts,		/* Bytes to store */
+	UINT btr,		/* Packet length */
+	WORD *crc		/* CRC16 of the data */
+)
+{
+	BYTE d;
+	WORD rc;
+
+	Timer1 = 100;
+	do {							/* Wait for data packet in timeout of 100ms */
+		d = xchg_spi(0xFF);
+	} while ((d == 0xFF) && Timer1);
+	if (d != 0xFE) return 0;
+
+	*crc = CRC16_INIT;
+	do {
+		d = xchg_spi(0xFF);
+		if (buff && bts) {
+			*buff++ = d;
+			bts--;
+		}
+		*crc = Crc16(*crc, &d, 1);
+	} while (--btr);
+	rc = (WORD)xchg_spi(0xFF) << 8;
+	rc |= xchg_spi(0xFF);
+
+	return (rc == *crc) ? 1 : 0;
+}
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -239,18 +547,30 @@ int xmit_datablock (	/* 1:OK, 0:Failed */
 )
 {
 	BYTE resp;
+	WORD crc = 0xFFFF;		/* Dummy CRC */
 
 
 	STAT_LED_TOGGLE();
 
 	if (!wait_ready()) return 0;
 
+#if MMC_USE_CRC
+	if (CrcOn && token != 0xFD) crc = Crc16(CRC16_INIT, buff, 512);
+#endif
 	xchg_spi(token);		/* Xmit a token */
 	if (token != 0xFD) {	/* Not StopTran token */
+#if MMC_SPI_INT
+		if (!xfer_spi_multi(0, buff, 512)) return 0;	/* Xmit the data block to the MMC */
+#else
 		XMIT_SPI_MULTI(buff, 512);	/* Xmit the data block to the MMC */
-		xchg_spi(0xFF);				/* CRC (Dummy) */
-		xchg_spi(0xFF);
+#endif
+		xchg_spi((BYTE)(crc >> 8));	/* CRC */
+		xchg_spi((BYTE)crc);
 		resp = xchg_spi(0xFF);		/* Receive a data response */
+#if MMC_USE_CRC
+		if ((resp & 0x1F) == 0x0B)	/* Rejected for a CRC error */
+			CrcErrors++;
+#endif
 		if ((resp & 0x1F) != 0x05)	/* If not accepted, return with error */
 			return 0;
 	}
@@ -271,7 +591,7 @@ BYTE send_cmd (
 	DWORD arg		/* Argument */
 )
 {
-	BYTE n, res;
+	BYTE n, res, pkt[5];
 
 
 //	STAT_LED_TOGGLE();
@@ -287,14 +607,19 @@ BYTE send_cmd (
 	if (!select()) return 0xFF;
 
 	/* Send command packet */
-	xchg_spi(0x40 | cmd);			/* Start + Command index */
-	xchg_spi((BYTE)(arg >> 24));	/* Argument[31..24] */
-	xchg_spi((BYTE)(arg >> 16));	/* Argument[23..16] */
-	xchg_spi((BYTE)(arg >> 8));		/* Argument[15..8] */
-	xchg_spi((BYTE)arg);			/* Argument[7..0] */
+	pkt[0] = 0x40 | cmd;			/* Start + Command index */
+	pkt[1] = (BYTE)(arg >> 24);		/* Argument[31..24] */
+	pkt[2] = (BYTE)(arg >> 16);		/* Argument[23..16] */
+	pkt[3] = (BYTE)(arg >> 8);		/* Argument[15..8] */
+	pkt[4] = (BYTE)arg;				/* Argument[7..0] */
+	for (n = 0; n < 5; n++) xchg_spi(pkt[n]);
+#if MMC_USE_CRC
+	n = crc7(pkt, 5);				/* Valid CRC + Stop */
+#else
 	n = 0x01;						/* Dummy CRC + Stop */
 	if (cmd == CMD0) n = 0x95;		/* Valid CRC for CMD0(0) + Stop */
 	if (cmd == CMD8) n = 0x87;		/* Valid CRC for CMD8(0x1AA) + Stop */
+#endif
 	xchg_spi(n);
 
 	/* Receive command response */
@@ -309,6 +634,203 @@ BYTE send_cmd (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Close an open streaming read                                          */
+/*-----------------------------------------------------------------------*/
+
+#if MMC_USE_STREAM
+static
+void stream_stop (void)
+{
+	if (Streaming) {
+		Streaming = 0;
+		send_cmd(CMD12, 0);		/* STOP_TRANSMISSION */
+		deselect();
+	}
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* SPI clock negotiation                                                 */
+/*-----------------------------------------------------------------------*/
+/* After initialization, the fastest clock allowed by the card (CSD      */
+/* TRAN_SPEED), the board (MMC_SPI_MAX_KHZ) and the MCU is chosen, as    */
+/* long as the CID and sector 0 read back at that clock with valid CRCs  */
+/* and match the copies read at the slow clock. Otherwise the next       */
+/* slower clock is tried. Transfer errors step the clock down too.       */
+
+/* SPI clock of a step, in kHz */
+static
+WORD fclk_khz (
+	BYTE step		/* Fast clock step, FCLK_STEPS for the slow clock */
+)
+{
+	return (Fcy / 1000) / (step < FCLK_STEPS ? FclkDiv[step] : 16);
+}
+
+/* Decode the CSD TRAN_SPEED field */
+static
+WORD tran_speed (	/* Maximum clock in kHz */
+	BYTE ts			/* TRAN_SPEED (CSD byte 3) */
+)
+{
+	static const BYTE mult[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+	DWORD khz = mult[(ts >> 3) & 15] * 10UL;	/* Units of 100 kbit/s */
+	BYTE u;
+
+	for (u = ts & 7; u; u--) khz *= 10;
+	return khz > 0xFFFF ? 0xFFFF : (WORD)khz;
+}
+
+/* Read back the CID and sector 0 at the current clock */
+static
+int fclk_test (		/* 1:OK, 0:Failed */
+	const BYTE *cid,	/* CID read at the slow clock */
+	WORD crc0			/* CRC16 of sector 0 read at the slow clock */
+)
+{
+	BYTE buf[16], n;
+	WORD crc;
+
+	for (n = MMC_PROBE_PASSES; n; n--) {
+		if (send_cmd(CMD10, 0) != 0 || !rcvr_checked(buf, 16, 16, &crc)
+			|| memcmp(buf, cid, 16)) break;
+		if (send_cmd(CMD17, 0) != 0 || !rcvr_checked(0, 0, 512, &crc)
+			|| crc != crc0) break;
+	}
+	deselect();
+
+	return n ? 0 : 1;
+}
+
+/* Choose the SPI clock. Called at the slow clock after initialization */
+static
+void fclk_select (void)
+{
+	BYTE cid[16], n;
+	WORD max, crc0, crc;
+
+
+	/* Read the CSD, the CID and sector 0 at the slow clock. If any of them
+	   fails, the card is left at the slow clock */
+	max = 0;
+	if (send_cmd(CMD9, 0) == 0 && rcvr_checked(cid, 16, 16, &crc)	/* READ_CSD */
+		&& crc7(cid, 15) == cid[15])
+		max = tran_speed(cid[3]);
+	if (send_cmd(CMD10, 0) != 0 || !rcvr_checked(cid, 16, 16, &crc)	/* READ_CID */
+		|| crc7(cid, 15) != cid[15]) max = 0;
+	if (send_cmd(CMD17, 0) != 0 || !rcvr_checked(0, 0, 512, &crc0)) max = 0;
+	deselect();
+	FclkKhz[1] = max;
+	if (MMC_SPI_MAX_KHZ && max > MMC_SPI_MAX_KHZ) max = MMC_SPI_MAX_KHZ;
+
+	/* Try the allowed clocks, fastest first */
+	for (n = 0; n < FCLK_STEPS; n++) {
+		if (fclk_khz(n) > max) continue;
+		FclkStep = n;
+		FCLK_FAST();
+		if (fclk_test(cid, crc0)) break;
+	}
+	FclkStep = n;
+	FCLK_FAST();
+	FclkKhz[0] = fclk_khz(n);
+}
+
+/* Step the clock down after a transfer error, until the next initialization */
+static
+void fclk_down (void)
+{
+	if (FclkStep < FCLK_STEPS) {
+		FclkStep++;
+		FCLK_FAST();
+		FclkKhz[0] = fclk_khz(FclkStep);
+	}
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Turn CRC checks on/off                                                */
+/*-----------------------------------------------------------------------*/
+
+#if MMC_USE_CRC
+static
+int crc_mode (		/* 1:OK, 0:Failed (mode unchanged) */
+	BYTE on			/* 1: Check CRCs, 0: Ignore them */
+)
+{
+	BYTE res;
+
+	res = send_cmd(CMD59, on ? 1 : 0);	/* CRC_ON_OFF */
+	deselect();
+	if (res != 0) return 0;
+	CrcOn = on ? 1 : 0;
+	return 1;
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Wake up a powered down card                                           */
+/*-----------------------------------------------------------------------*/
+/* The card type, clock and CRC mode are kept while the card is powered  */
+/* down (see park()), so the type detection and the clock negotiation    */
+/* of disk_initialize() are skipped. A card that kept its power is just  */
+/* checked with CMD13. Otherwise it has to leave the idle state again,   */
+/* with the commands of its type. FatFs sees no change in the status.    */
+
+static
+int wake (void)		/* 1:OK, 0:Failed (re-initialization forced) */
+{
+	BYTE ok;
+#if MMC_SOCKET_SWITCH
+	BYTE n, ty = CardType;
+#endif
+
+
+	if (!Parked) return 1;
+	power_on();
+
+#if MMC_SOCKET_SWITCH
+	FCLK_SLOW();
+	for (n = 10; n; n--) xchg_spi(0xFF);	/* 80 dummy clocks */
+	ok = 0;
+	if (send_cmd(CMD0, 0) == 1) {			/* Enter Idle state */
+		Timer1 = 1000;
+		if (ty & CT_SD2) {					/* CMD8 enables the HCS bit of ACMD41 */
+			if (send_cmd(CMD8, 0x1AA) == 1) {
+				for (n = 0; n < 4; n++) xchg_spi(0xFF);
+				while (Timer1 && send_cmd(ACMD41, 0x40000000));
+				if (Timer1) ok = 1;
+			}
+		} else {
+			while (Timer1 && send_cmd((ty & CT_SD1) ? ACMD41 : CMD1, 0));
+			if (Timer1 && send_cmd(CMD16, 512) == 0) ok = 1;
+		}
+	}
+	deselect();
+#if MMC_USE_CRC
+	if (ok && CrcOn) {		/* CMD0 turned the CRC checks off */
+		CrcOn = 0;
+		crc_mode(1);
+	}
+#endif
+	FCLK_FAST();
+#else
+	FCLK_FAST();
+	ok = (send_cmd(CMD13, 0) == 0 && xchg_spi(0xFF) == 0) ? 1 : 0;	/* SEND_STATUS */
+	deselect();
+#endif
+
+	if (!ok) power_off();	/* Card removed or replaced */
+	return ok;
+}
+
+
+
 /*--------------------------------------------------------------------------
 
    Public Functions
@@ -335,6 +857,9 @@ DSTATUS disk_initialize (
 	for (n = 10; n; n--) xchg_spi(0xFF);	/* 80 dummy clocks */
 
 	ty = 0;
+#if MMC_USE_CRC
+	CrcOn = 0;							/* CMD0 turns the card CRC checks off */
+#endif
 	if (send_cmd(CMD0, 0) == 1) {			/* Enter Idle state */
 		Timer1 = 1000;						/* Initialization timeout of 1000 msec */
 		if (send_cmd(CMD8, 0x1AA) == 1) {	/* SDv2? */
@@ -362,7 +887,10 @@ DSTATUS disk_initialize (
 
 	if (ty) {			/* Initialization succeded */
 		Stat &= ~STA_NOINIT;	/* Clear STA_NOINIT */
-		FCLK_FAST();
+#if MMC_USE_CRC
+		crc_mode(1);			/* Check CRCs from now on, if supported */
+#endif
+		fclk_select();			/* Negotiate the fast clock */
 	} else {			/* Initialization failed */
 		power_off();
 	}
@@ -387,18 +915,48 @@ DSTATUS disk_status (
 
 
 /*-----------------------------------------------------------------------*/
-/* Read Sector(s)                                                        */
+/* Read Sector(s) from the card                                          */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read (
-	BYTE pdrv,		/* Physical drive nmuber (0) */
+static
+DRESULT card_read_once (
 	BYTE *buff,		/* Pointer to the data buffer to store read data */
 	DWORD sector,	/* Start sector number (LBA) */
 	BYTE count		/* Sector count (1..255) */
 )
 {
-	if (pdrv || !count) return RES_PARERR;
-	if (Stat & STA_NOINIT) return RES_NOTRDY;
+#if MMC_USE_STREAM
+	DWORD lba = sector;
+#endif
+
+#if MMC_USE_STREAM
+	/* Streaming read: the CMD18 is left open after the requested blocks, so
+	   the next contiguous read just receives the following data packets.
+	   A read elsewhere (e.g. after a cluster boundary) or any other disk
+	   access closes it with CMD12 */
+	if (Streaming && lba != StreamNext) stream_stop();
+	if (StreamOn) {
+		if (!Streaming) {
+			if (!(CardType & CT_BLOCK)) sector *= 512;
+			if (send_cmd(CMD18, sector) != 0) {	/* READ_MULTIPLE_BLOCK */
+				deselect();
+				return RES_ERROR;
+			}
+			Streaming = 1;
+		}
+		StreamNext = lba + count;
+		do {
+			if (!rcvr_datablock(buff, 512)) break;
+			buff += 512;
+		} while (--count);
+		if (count) {				/* Close the stream on errors */
+			stream_stop();
+			fclk_down();
+		}
+
+		return count ? RES_ERROR : RES_OK;	/* Card stays selected */
+	}
+#endif
 
 	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
 
@@ -417,6 +975,7 @@ DRESULT disk_read (
 		}
 	}
 	deselect();
+	if (count) fclk_down();
 
 	return count ? RES_ERROR : RES_OK;
 }
@@ -424,20 +983,20 @@ DRESULT disk_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Write Sector(s)                                                       */
+/* Write Sector(s) to the card                                           */
 /*-----------------------------------------------------------------------*/
 
 #if _USE_WRITE
-DRESULT disk_write (
-	BYTE pdrv,				/* Physical drive nmuber (0) */
+static
+DRESULT card_write_once (
 	const BYTE *buff,		/* Pointer to the data to be written */
 	DWORD sector,			/* Start sector number (LBA) */
 	BYTE count				/* Sector count (1..255) */
 )
 {
-	if (pdrv || !count) return RES_PARERR;
-	if (Stat & STA_NOINIT) return RES_NOTRDY;
-	if (Stat & STA_PROTECT) return RES_WRPRT;
+#if MMC_USE_STREAM
+	stream_stop();
+#endif
 
 	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
 
@@ -458,6 +1017,7 @@ DRESULT disk_write (
 		}
 	}
 	deselect();
+	if (count) fclk_down();
 
 	return count ? RES_ERROR : RES_OK;
 }
@@ -465,6 +1025,344 @@ DRESULT disk_write (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Read/Write Sector(s) with retries                                     */
+/*-----------------------------------------------------------------------*/
+/* A failed transfer (e.g. a CRC mismatch) has already stepped the clock */
+/* down, so retries run slower.                                          */
+
+static
+DRESULT card_read (
+	BYTE *buff,		/* Pointer to the data buffer to store read data */
+	DWORD sector,	/* Start sector number (LBA) */
+	BYTE count		/* Sector count (1..255) */
+)
+{
+	BYTE n = MMC_RETRIES;
+	DRESULT res;
+
+	if (!wake()) return RES_NOTRDY;
+	while ((res = card_read_once(buff, sector, count)) != RES_OK && n--) ;
+	return res;
+}
+
+#if _USE_WRITE
+static
+DRESULT card_write (
+	const BYTE *buff,		/* Pointer to the data to be written */
+	DWORD sector,			/* Start sector number (LBA) */
+	BYTE count				/* Sector count (1..255) */
+)
+{
+	BYTE n = MMC_RETRIES;
+	DRESULT res;
+
+	if (!wake()) return RES_NOTRDY;
+	while ((res = card_write_once(buff, sector, count)) != RES_OK && n--) ;
+	return res;
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+/* Single sector reads and writes (FAT, directory and partial file data  */
+/* through the FatFs window) go through a small write-back LRU cache.    */
+/* Dirty sectors are written on CTRL_SYNC, that FatFs issues on each     */
+/* f_sync() and f_close(), or when evicted. Pinned sectors are never     */
+/* evicted. The cache memory is lent to the audio player while it plays  */
+/* (MMC_CACHE_LEND), so it takes no RAM of its own.                      */
+
+#if MMC_CACHE_SECTS
+/* Look for the entry holding (or reserved for) a sector */
+static
+int cache_find (		/* Entry index, -1 if not found */
+	DWORD sector
+)
+{
+	int i;
+
+	for (i = 0; i < MMC_CACHE_SECTS; i++)
+		if ((CacheFlag[i] & (CF_VALID | CF_PIN)) && CacheSect[i] == sector)
+			return i;
+	return -1;
+}
+
+/* Make an entry the most recently used one */
+static
+void cache_touch (
+	int i
+)
+{
+	int j;
+
+	for (j = 0; j < MMC_CACHE_SECTS; j++)
+		if (CacheAge[j] < CacheAge[i]) CacheAge[j]++;
+	CacheAge[i] = 0;
+}
+
+/* Write an entry to the card if dirty */
+static
+DRESULT cache_flush (
+	int i
+)
+{
+	if (CacheFlag[i] & CF_DIRTY) {
+		if (card_write(CacheBuf[i], CacheSect[i], 1) != RES_OK) return RES_ERROR;
+		CacheFlag[i] &= ~CF_DIRTY;
+	}
+	return RES_OK;
+}
+
+/* Write all the dirty entries to the card */
+static
+DRESULT cache_sync (void)
+{
+	int i;
+
+	for (i = 0; i < MMC_CACHE_SECTS; i++)
+		if (cache_flush(i) != RES_OK) return RES_ERROR;
+	return RES_OK;
+}
+
+/* Get the least recently used entry not pinned, written back and empty */
+static
+int cache_victim (void)	/* Entry index, -1 if all of them are pinned or error */
+{
+	int i, v = -1;
+
+	for (i = 0; i < MMC_CACHE_SECTS; i++)
+		if (!(CacheFlag[i] & CF_PIN) && (v < 0 || CacheAge[i] > CacheAge[v]))
+			v = i;
+	if (v >= 0) {
+		if (cache_flush(v) != RES_OK) return -1;
+		CacheFlag[v] = 0;
+	}
+	return v;
+}
+
+/* Drop all the data, e.g. when the card is removed. Pins are kept */
+static
+void cache_inval (void)
+{
+	int i;
+
+	for (i = 0; i < MMC_CACHE_SECTS; i++)
+		CacheFlag[i] &= CF_PIN;
+}
+
+/* Pin a sector, or unpin all of them if sector is 0 */
+static
+DRESULT cache_pin (
+	DWORD sector
+)
+{
+	int i, n;
+
+	if (!sector) {
+		for (i = 0; i < MMC_CACHE_SECTS; i++) CacheFlag[i] &= ~CF_PIN;
+		return RES_OK;
+	}
+	i = cache_find(sector);
+	if (i < 0 || !(CacheFlag[i] & CF_PIN)) {
+		/* At least one entry is kept for the other sectors */
+		for (n = i = 0; i < MMC_CACHE_SECTS; i++)
+			if (CacheFlag[i] & CF_PIN) n++;
+		if (n >= MMC_CACHE_SECTS - 1) return RES_ERROR;
+		i = cache_find(sector);
+		if (i < 0) {
+			i = cache_victim();
+			if (i < 0) return RES_ERROR;
+			CacheSect[i] = sector;		/* Loaded on first access */
+		}
+		CacheFlag[i] |= CF_PIN;
+	}
+	return RES_OK;
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Power the card down                                                   */
+/*-----------------------------------------------------------------------*/
+/* Dirty cached sectors are written and the card is left ready, then the */
+/* SPI module and the socket power are turned off. The card is woken up  */
+/* by the next access that needs it (see wake()).                        */
+
+static
+DRESULT park (void)
+{
+#if MMC_USE_STREAM
+	stream_stop();
+#endif
+#if MMC_CACHE_SECTS
+	if (cache_sync() != RES_OK) return RES_ERROR;	/* Wakes the card up if needed */
+#endif
+	if (Parked) return RES_OK;
+	if (!select()) return RES_ERROR;	/* Wait for the end of a write */
+	deselect();
+
+	socket_off();
+	Parked = 1;
+
+	return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read (
+	BYTE pdrv,		/* Physical drive nmuber (0) */
+	BYTE *buff,		/* Pointer to the data buffer to store read data */
+	DWORD sector,	/* Start sector number (LBA) */
+	BYTE count		/* Sector count (1..255) */
+)
+{
+#if MMC_CACHE_SECTS
+	int i;
+	DRESULT res;
+#endif
+
+	if (pdrv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+
+#if MMC_CACHE_SECTS
+	if (CacheLent) return card_read(buff, sector, count);
+
+	if (count == 1) {
+		i = cache_find(sector);
+		if (i >= 0 && (CacheFlag[i] & CF_VALID)) {
+			CacheStat[0]++;				/* Hit */
+		} else {
+			CacheStat[1]++;				/* Miss, load the sector in an entry */
+			if (i < 0) i = cache_victim();
+			if (i < 0) return card_read(buff, sector, 1);
+			if (card_read(CacheBuf[i], sector, 1) != RES_OK) return RES_ERROR;
+			CacheSect[i] = sector;
+			CacheFlag[i] |= CF_VALID;
+		}
+		cache_touch(i);
+		memcpy(buff, CacheBuf[i], 512);
+		return RES_OK;
+	}
+
+	/* Multiple sectors are read from the card, newer cached data is kept */
+	res = card_read(buff, sector, count);
+	if (res == RES_OK) {
+		for (i = 0; i < MMC_CACHE_SECTS; i++)
+			if ((CacheFlag[i] & CF_DIRTY) && CacheSect[i] - sector < count)
+				memcpy(buff + (UINT)(CacheSect[i] - sector) * 512, CacheBuf[i], 512);
+	}
+	return res;
+#else
+	return card_read(buff, sector, count);
+#endif
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+#if _USE_WRITE
+DRESULT disk_write (
+	BYTE pdrv,				/* Physical drive nmuber (0) */
+	const BYTE *buff,		/* Pointer to the data to be written */
+	DWORD sector,			/* Start sector number (LBA) */
+	BYTE count				/* Sector count (1..255) */
+)
+{
+#if MMC_CACHE_SECTS
+	int i;
+#endif
+
+	if (pdrv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+	if (Stat & STA_PROTECT) return RES_WRPRT;
+
+#if MMC_CACHE_SECTS
+	if (!CacheLent) {
+		if (count == 1) {			/* Cached sectors are written back later */
+			i = cache_find(sector);
+			if (i >= 0) {
+				memcpy(CacheBuf[i], buff, 512);
+				CacheFlag[i] |= CF_VALID | CF_DIRTY;
+				cache_touch(i);
+				return RES_OK;
+			}
+		} else {					/* Cached copies are updated */
+			for (i = 0; i < MMC_CACHE_SECTS; i++) {
+				if ((CacheFlag[i] & CF_VALID) && CacheSect[i] - sector < count) {
+					memcpy(CacheBuf[i], buff + (UINT)(CacheSect[i] - sector) * 512, 512);
+					CacheFlag[i] &= ~CF_DIRTY;
+				}
+			}
+		}
+	}
+#endif
+
+	return card_write(buff, sector, count);
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Transfer benchmark                                                    */
+/*-----------------------------------------------------------------------*/
+/* Times reading MMC_BENCH_SECTS sectors one by one, from sector 0, at   */
+/* each clock with CRC checks off and on, so the CRC overhead is known   */
+/* before raising the clock. The cache memory is used as buffer.         */
+
+#if MMC_USE_BENCH
+#if !MMC_USE_CRC || !MMC_CACHE_SECTS
+#error "MMC_USE_BENCH needs MMC_USE_CRC and MMC_CACHE_SECTS"
+#endif
+#if MMC_BENCH_CLOCKS != FCLK_STEPS + 1
+#error "MMC_BENCH_CLOCKS must be the number of fast clocks plus the slow one"
+#endif
+static
+DRESULT bench (
+	WORD res[][3]	/* For each clock, fastest first: kHz and ms with CRC off and on */
+)
+{
+	BYTE step = FclkStep, on = CrcOn, s, c;
+	UINT n, t;
+
+	if (CacheLent || cache_sync() != RES_OK) return RES_ERROR;
+	cache_inval();
+
+	for (s = 0; s < MMC_BENCH_CLOCKS; s++) {
+		res[s][0] = fclk_khz(s);
+		for (c = 0; c < 2; c++) {
+			FclkStep = s;		/* Set again, as errors step it down */
+			FCLK_FAST();
+			res[s][1 + c] = 0xFFFF;
+			if (!crc_mode(c)) continue;
+			t = Ticks;
+			for (n = 0; n < MMC_BENCH_SECTS; n++)
+				if (card_read_once(CacheBuf[0], n, 1) != RES_OK) break;
+			if (n == MMC_BENCH_SECTS) res[s][1 + c] = Ticks - t;
+		}
+	}
+
+	FclkStep = step;
+	FCLK_FAST();
+	crc_mode(on);
+
+	return RES_OK;
+}
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Miscellaneous Functions                                               */
 /*-----------------------------------------------------------------------*/
@@ -478,15 +1376,47 @@ DRESULT disk_ioctl (
 {
 	DRESULT res;
 	BYTE n, csd[16], *ptr = buff;
+	WORD crc;
 	DWORD csz;
 
 
 	if (pdrv) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 
+	if (cmd == CTRL_POWER) {	/* Does not wake the card up */
+		switch (*ptr) {
+		case 0:		/* Sub control code: power off */
+			return park();
+		case 1:		/* Sub control code: power on */
+			return wake() ? RES_OK : RES_NOTRDY;
+		case 2:		/* Sub control code: get power status (2nd byte) */
+			ptr[1] = Parked ? 0 : 1;
+			return RES_OK;
+		}
+		return RES_PARERR;
+	}
+	if (cmd == MMC_POWER_IDLE)	/* Power off after MMC_IDLE_MS without commands */
+		return (!MMC_IDLE_MS || IdleTimer) ? RES_OK : park();
+	if (cmd == MMC_CHK_CARD && Parked) {	/* Check a powered down card */
+		/* Waking it up already checks it answers (CMD13, or the commands
+		   leaving the idle state with a socket switch). It is powered down
+		   again right away, so the periodic check does not keep it awake
+		   for MMC_IDLE_MS. */
+		if (!wake()) return RES_NOTRDY;	/* Forced to re-initialize */
+		return park();
+	}
+
+	if (!wake()) return RES_NOTRDY;
+#if MMC_USE_STREAM
+	stream_stop();		/* Commands cannot be sent while a stream is open */
+#endif
+
 	res = RES_ERROR;
 	switch (cmd) {
 		case CTRL_SYNC :	/* Flush write-back cache, Wait for end of internal process */
+#if MMC_CACHE_SECTS
+			if (cache_sync() != RES_OK) break;
+#endif
 			if (select()) {
 				deselect();
 				res = RES_OK;
@@ -516,8 +1446,7 @@ DRESULT disk_ioctl (
 			if (CardType & CT_SD2) {	/* SDv2? */
 				if (send_cmd(ACMD13, 0) == 0) {		/* Read SD status */
 					xchg_spi(0xFF);
-					if (rcvr_datablock(csd, 16)) {				/* Read partial block */
-						for (n = 64 - 16; n; n--) xchg_spi(0xFF);	/* Purge trailing data */
+					if (rcvr_checked(csd, 16, 64, &crc)) {		/* Read partial block */
 						*(DWORD*)buff = 16UL << (csd[10] >> 4);
 						res = RES_OK;
 					}
@@ -567,6 +1496,73 @@ DRESULT disk_ioctl (
 			}
 			break;
 
+		case MMC_CHK_CARD :	/* Check the card answers SEND_STATUS (R2 resp) */
+			if (send_cmd(CMD13, 0) == 0 && xchg_spi(0xFF) == 0) {
+				res = RES_OK;
+			} else {		/* Card removed or in error, force re-initialization */
+				deselect();
+				power_off();
+				return RES_NOTRDY;
+			}
+			break;
+
+#if MMC_CACHE_SECTS
+		case MMC_CACHE_PIN :	/* Pin a sector in the cache, 0 unpins all (DWORD) */
+			res = cache_pin(*(DWORD*)buff);
+			break;
+
+		case MMC_CACHE_STAT :	/* Get cache hits and misses (2 DWORDs) */
+			((DWORD*)buff)[0] = CacheStat[0];
+			((DWORD*)buff)[1] = CacheStat[1];
+			res = RES_OK;
+			break;
+
+		case MMC_CACHE_LEND :	/* Flush the cache and lend its memory (BYTE*) */
+			if (cache_sync() == RES_OK) {
+				cache_inval();
+				CacheLent = 1;
+				*(BYTE**)buff = CacheBuf[0];
+				res = RES_OK;
+			}
+			break;
+
+		case MMC_CACHE_RETURN :	/* Get the lent memory back and enable the cache */
+			CacheLent = 0;
+			res = RES_OK;
+			break;
+#endif
+
+		case MMC_GET_CLOCK :	/* Get SPI clock and card maximum in kHz (2 WORDs) */
+			((WORD*)buff)[0] = FclkKhz[0];
+			((WORD*)buff)[1] = FclkKhz[1];
+			res = RES_OK;
+			break;
+
+#if MMC_USE_CRC
+		case MMC_CRC :		/* Enable/disable CRC checks (1 byte) */
+			if (crc_mode(*ptr)) res = RES_OK;
+			break;
+
+		case MMC_GET_CRC :	/* Get CRC checks state and errors found (2 WORDs) */
+			((WORD*)buff)[0] = CrcOn;
+			((WORD*)buff)[1] = CrcErrors;
+			res = RES_OK;
+			break;
+#endif
+
+#if MMC_USE_BENCH
+		case MMC_BENCH :	/* Time reads at each clock, CRC off and on (WORD[][3]) */
+			res = bench(buff);
+			break;
+#endif
+
+#if MMC_USE_STREAM
+		case MMC_STREAM :	/* Enable/disable streaming reads (1 byte) */
+			StreamOn = *ptr;
+			res = RES_OK;
+			break;
+#endif
+
 		default:
 			res = RES_PARERR;
 	}
@@ -593,6 +1589,11 @@ void disk_timerproc (void)
 	if (n) Timer1 = --n;
 	n = Timer2;
 	if (n) Timer2 = --n;
+	n = IdleTimer;
+	if (n) IdleTimer = --n;
+#if MMC_USE_BENCH
+	Ticks++;
+#endif
 
 
 	/* Update socket status */
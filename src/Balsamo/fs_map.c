@@ -0,0 +1,112 @@
+/************************************************************************//**
+ * \file  fs_map.c
+ * \brief Fast seek cluster maps for read only files.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "fs_map.h"
+
+/// Map arena. Maps are allocated one after the other.
+static DWORD arena[FM_ARENA_LEN];
+/// DWORDs used in the arena
+static BYTE used;
+/// First cluster of each mapped file
+static DWORD mapClust[FM_MAX_FILES];
+/// Position of each map in the arena
+static BYTE mapPos[FM_MAX_FILES];
+/// Number of mapped files
+static BYTE nMaps;
+
+/************************************************************************//**
+ * \brief Releases all the maps. Must be called each time a volume is
+ * mounted.
+ ****************************************************************************/
+void FmInit(void)
+{
+	used = 0;
+	nMaps = 0;
+}
+
+/************************************************************************//**
+ * \brief Attaches the map of an open file, building it if the file has no
+ * map yet. Attach it right after opening the file, and never to a file
+ * that is going to be written.
+ *
+ * \param[in] fp Open file.
+ *
+ * \return 0 if the map has been attached, nonzero if the file has no
+ * clusters, there is no room for its map or the FAT could not be read.
+ * The file can be read normally in any case.
+ ****************************************************************************/
+char FmAttach(FIL *fp)
+{
+	BYTE i;
+
+	if (!fp->sclust) return 1;
+
+	/// Reuse the map if the file was already mapped
+	for (i = 0; i < nMaps; i++)
+	{
+		if (mapClust[i] == fp->sclust)
+		{
+			fp->cltbl = arena + mapPos[i];
+			return 0;
+		}
+	}
+	if (nMaps >= FM_MAX_FILES) return 2;
+
+	/// Build the map in the free part of the arena. The first item holds
+	/// the room available, and then the room used.
+	arena[used] = FM_ARENA_LEN - used;
+	fp->cltbl = arena + used;
+	if (f_lseek(fp, CREATE_LINKMAP))
+	{
+		/// Too fragmented or FAT error, go on without a map
+		fp->cltbl = 0;
+		return 3;
+	}
+	mapClust[nMaps] = fp->sclust;
+	mapPos[nMaps++] = used;
+	used += (BYTE)arena[used];
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Builds the map of a file in advance, so later opens do not walk
+ * the FAT chain.
+ *
+ * \param[in] file Name of the file.
+ *
+ * \return 0 if the map has been built, nonzero if the file does not exist
+ * or could not be mapped.
+ ****************************************************************************/
+char FmMap(const char file[])
+{
+	FIL f;
+	char retVal;
+
+	if (f_open(&f, file, FA_READ | FA_OPEN_EXISTING)) return 1;
+	retVal = FmAttach(&f);
+	f_close(&f);
+
+	return retVal;
+}
@@ -0,0 +1,84 @@
+/************************************************************************//**
+ * \file  fs_map.h
+ * \brief Fast seek cluster maps for read only files.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FS_MAP_H_
+#define _FS_MAP_H_
+
+#include "fatfs/ff.h"
+
+/** \defgroup fs_map_api fs_map
+ *
+ * Fast seek cluster maps for read only files. Without a map, FatFs follows
+ * the FAT chain through the volume window each time a read or a seek
+ * crosses a cluster, evicting the directory and log sectors held there.
+ * With a map (a cluster link map table, see f_lseek()), the cluster of any
+ * file offset is computed in RAM, so seeking inside an index or playing a
+ * message costs no FAT reads.
+ *
+ * Maps are kept in a small RAM arena, and are identified by the first
+ * cluster of the file, so a map built once is reused each time the same
+ * file is opened again. Maps must only be attached to files that are not
+ * written, and the arena must be reset with FmInit() each time a card is
+ * mounted. Files too fragmented to fit in the free arena are just read
+ * without a map.
+ * \{ */
+
+/// Length of the map arena, in DWORDs. A map takes 2 DWORDs plus 2 DWORDs
+/// per fragment, so a contiguous file takes 4 DWORDs.
+#define FM_ARENA_LEN	32
+/// Maximum number of files with a map
+#define FM_MAX_FILES	6
+
+/************************************************************************//**
+ * \brief Releases all the maps. Must be called each time a volume is
+ * mounted.
+ ****************************************************************************/
+void FmInit(void);
+
+/************************************************************************//**
+ * \brief Attaches the map of an open file, building it if the file has no
+ * map yet. Attach it right after opening the file, and never to a file
+ * that is going to be written.
+ *
+ * \param[in] fp Open file.
+ *
+ * \return 0 if the map has been attached, nonzero if the file has no
+ * clusters, there is no room for its map or the FAT could not be read.
+ * The file can be read normally in any case.
+ ****************************************************************************/
+char FmAttach(FIL *fp);
+
+/************************************************************************//**
+ * \brief Builds the map of a file in advance, so later opens do not walk
+ * the FAT chain.
+ *
+ * \param[in] file Name of the file.
+ *
+ * \return 0 if the map has been built, nonzero if the file does not exist
+ * or could not be mapped.
+ ****************************************************************************/
+char FmMap(const char file[]);
+
+/** \} */
+
+#endif /*_FS_MAP_H_*/
@@ -48,6 +48,13 @@
 #include "fatfs/diskio.h"
 #include "rtc.h"
 #include "tel_filt.h"
+#include "rep_call.h"
+#include "num_idx.h"
+#include "num_flash.h"
+#include "call_hist.h"
+#include "ev_log.h"
+#include "fs_map.h"
+#include "call_act.h"
 #include "utils.h"
 #include "rawplay/rawplay.h"
 
@@ -88,8 +95,12 @@ void TimEvtWait(unsigned int countMs);
 char ParseMessages(void);
 void FatFsHwInit(void);
 void SysFsm(void);
-void Log(char str[]);
-void LogNumStr(char num[], char str[]);
+void SysCfgSync(void);
+void SysCardCheck(void);
+void SysCardMount(void);
+void SysCardPowerDown(char idle);
+void SysCfgReport(char lcd);
+void SysCardReport(void);
 
 /// Line 1 of the welcome message
 static const char line1[] = "BALSAMO HW Rev.B";
@@ -97,18 +108,19 @@ static const char line1[] = "BALSAMO HW Rev.B";
 static const char line2[] = "BALSAMO FW v1.0 ";
 /// Buffer used to temporary store the received telephone number line
 static char telNum[17];
+/// Action to take if the call is rejected (see call_act.h)
+static BYTE callAct;
 
 /// When going to LPM, if sleep is TRUE, system will Sleep.
 /// If false, system will Idle instead.
 static char sleep = TRUE;
 /// FatFs status
-static BYTE fatFsStat;
+static BYTE fatFsStat = STA_NOINIT;
 /// FatFs volume
 static FATFS vol;
-/// Log file
-static FIL fLog;
-/// If TRUE, events will be logged to BALSAMO.LOG file
-static char evLog;
+/// If TRUE, configuration was loaded from EEPROM and must be reconciled
+/// with the copy in the SD card
+static char cfgSync = FALSE;
 /// System status
 SysStat  sysStat  = SYS_SLEEP;
 /// Last occured system event
@@ -130,15 +142,39 @@ int main(void)
 		{
 			///- If no event to process, Sleep/Idle again
 			case SYS_NONE:
-				// Nothing to do, just Sleep or Idle depending on status
-				if (sleep) {Sleep();}
-				else Idle();
+				// Nothing to do, just Sleep or Idle depending on status.
+				// Pending log lines and call history records are written
+				// between calls, and synced before sleeping. The SD card is
+				// powered down while sleeping, or after a while without
+				// accesses.
+				if (sleep)
+				{
+					ChTask();
+					LogSync();
+					SysCardPowerDown(FALSE);
+					Sleep();
+				}
+				else
+				{
+					if (SYS_SLEEP == sysStat)
+					{
+						ChTask();
+						LogTask();
+						SysCardPowerDown(TRUE);
+					}
+					Idle();
+				}
 				break;
 
 			///- If a SLEEP event is received, go to Sleep mode
 			case SYS_SLEEP_TIM:
 				// Power backlight OFF and go to Sleep mode
 				BacklightOff();
+				// Flush the log and the call history, the card may lose
+				// power while sleeping
+				ChTask();
+				LogSync();
+				SysCardPowerDown(FALSE);
 				// Wait until TMR1 != 0 (see 12.12.1 in the datasheet)
 				while (!TMR1);
 				sleep = TRUE;
@@ -166,6 +202,8 @@ void SysFsm(void)
 	static BYTE reason = 0;
 	/// Lenght of the received packet
 	int recvLen;
+	/// Log message and name of the file played to rejected calls
+	char str[24 + CA_FILE_LEN];
 #ifdef _DEBUG
 	/// Used for some debug loops
 	int i;
@@ -208,7 +246,16 @@ void SysFsm(void)
 					TimEvtRun(SLEEP_EVT_TIM, SLEEP_TOUT * 1000);
 					break;
 
+				case SYS_CFG_SYNC:
+					// Reconcile configuration with the SD card copy
+					SysCfgSync();
+					break;
+
 				case SYS_RTC_MINUTE:
+					// Switch the filtering policy if the schedule says so
+					TfSchedUpdate();
+					// Detect SD card removal and insertion
+					SysCardCheck();
 					// Call UI FSM to refresh date and time count
 					UifEventParse(sysEvent, NULL, 0);
 				default:
@@ -262,6 +309,8 @@ void SysFsm(void)
 								sysStat = SYS_RING_END_WAIT;
 								AdcStop();
 								Log("CID ERROR!");
+								LogCall(NULL, LOG_EV_CID_ERROR, LOG_NO_REASON,
+										CA_DEFAULT);
 								// Inform UIF module
 								UifEventParse(SYS_CALL_NOT_SENT, NULL, 0);
 								break;
@@ -275,6 +324,10 @@ void SysFsm(void)
 									// Accept number
 									case TF_NUM_OK:
 										LogNumStr(telNum, "ALLOWED");
+										ChAdd(telNum, CH_CALL_ALLOWED, reason,
+											callAct);
+										LogCall(telNum, LOG_EV_ALLOWED, reason,
+											callAct);
 										UifEventParse(SYS_CALL_ALLOWED,
 											telNum, 16);
 										sysStat = SYS_RING_END_WAIT;
@@ -285,6 +338,8 @@ void SysFsm(void)
 									case TF_NUM_REJECT:
 									// Reject call because of private/unknown
 									case TF_HID_REJECT:
+									// Reject call because of repeated calls
+									case TF_NUM_REPEAT:
 										// Pick up
 										LinePickUp();
 										SetD204(LED_ON);
@@ -292,7 +347,19 @@ void SysFsm(void)
 										/// \todo Play message from SD card
 										AdcStop();
 										TimEvtRun(SYS_EVT_TIM, 3 * 1000);
-										LogNumStr(telNum, "BLOCKED");
+										strcpy(str, TF_NUM_REPEAT == reason?
+												"BLOCKED, REPEAT CALLER":
+												"BLOCKED");
+										if (*CaName(callAct))
+										{
+											strcat(str, ", ");
+											strcat(str, CaName(callAct));
+										}
+										LogNumStr(telNum, str);
+										ChAdd(telNum, CH_CALL_BLOCKED, reason,
+											callAct);
+										LogCall(telNum, LOG_EV_BLOCKED, reason,
+											callAct);
 										/// \todo Send message to user_if
 										UifEventParse(SYS_CALL_RESTRICTED,
 											telNum, 16);
@@ -304,6 +371,10 @@ void SysFsm(void)
 									case TF_HID_DISABLED:
 										LogNumStr(telNum,
 											"ALLOWED, FILTER DISABLED!");
+										ChAdd(telNum, CH_CALL_ALLOWED, reason,
+											callAct);
+										LogCall(telNum, LOG_EV_ALLOWED, reason,
+											callAct);
 										UifEventParse(SYS_CALL_ALLOWED,
 											telNum, 16);
 										sysStat = SYS_RING_END_WAIT;
@@ -325,6 +396,7 @@ void SysFsm(void)
 					sysStat = SYS_RING_END_WAIT;
 					AdcStop();
 					Log("NOT SENT!");
+					LogCall(NULL, LOG_EV_NOT_SENT, LOG_NO_REASON, CA_DEFAULT);
 					// Inform UIF module
 					UifEventParse(SYS_CALL_NOT_SENT, NULL, 0);
 					break;
@@ -355,8 +427,14 @@ void SysFsm(void)
 		case SYS_LINE_HANG_WAIT:
 			if (sysEvent == SYS_TIM_EVT)
 			{
-				// Play message and end call
-				RawPlayFile(reason == 1?FILE_MSG_FILTERED:FILE_MSG_FORBIDDEN);
+				// Play the message for the action (if any) and end call.
+				// Calls rejected with the default action get the list one.
+				if (CA_SILENT != callAct)
+				{
+					if (!CaFile(callAct, str)) RawPlayFile(str);
+					else RawPlayFile(TF_HID_REJECT == reason?
+							FILE_MSG_FORBIDDEN:FILE_MSG_FILTERED);
+				}
 				LineHang();
 				CallProcEnd();
 			}
@@ -384,10 +462,13 @@ char ParseMessages(void)
 	unsigned char lastErr = 0;
 	/// Used to obtain function return values
 	char retVal = TF_NUM_OK;
+	/// Packed canonical telephone number
+	BYTE key[TN_PACK_LEN];
 
-	/// Clear telephone number
+	/// Clear telephone number and action
 	for (i = 0; i < 16; i++) telNum[i] = ' ';
 	telNum[16] = '\0';
+	callAct = CA_DEFAULT;
 
 	/// Analyse received message code
 	while ((msgCode = CidPlMsgParse(&msgLen, &msg)))
@@ -402,6 +483,8 @@ char ParseMessages(void)
 					RtcSetTime(A2Dec(msg[0], msg[1]),
 						A2Dec(msg[2], msg[3]), A2Dec(msg[4], msg[5]),
 						A2Dec(msg[6], msg[7]), 0);
+					/// Time may have changed, update the filtering policy
+					TfSchedUpdate();
 				}
 				else lastErr = msgCode;
 				break;
@@ -414,7 +497,10 @@ char ParseMessages(void)
 					for (i = 0; (i < msgLen) && (i < 16); i++)
 						telNum[i] = msg[i];
 					telNum[i] = '\0';
-					retVal = TfNumCheck(telNum);
+					/// Normalize once, so each stored number is matched
+					/// with a single compare
+					retVal = TfNumCheck(TnPackNorm(telNum, key)?NULL:key,
+							&callAct);
 				} else lastErr = msgCode;
 				break;
 
@@ -422,7 +508,7 @@ char ParseMessages(void)
 				/// Obtain reason for telephone number absence
 				if (msgLen == CID_CLI_ABS_REASON_LEN)
 				{
-					retVal = TfFilterHidden();
+					retVal = TfFilterHidden(&callAct);
 					switch(*msg)
 					{
 						case CID_ABS_UNAVAILABLE:
@@ -454,7 +540,7 @@ char ParseMessages(void)
 /// System initialization
 void SysInit(void)
 {
-	FRESULT retVal;
+	char snap;
 
 	/// Timer initialization
 	TimEvtInit();
@@ -502,33 +588,51 @@ void SysInit(void)
 	ExtUart1Enable();
 #endif
 
+	/// Load configuration snapshot and repeat caller table from EEPROM, so
+	/// calls are filtered even if the SD card cannot be read
+	RcInit();
+	/// Check the flash copy of the number index. Its CRC covers the whole
+	/// list, so it is only checked once per boot.
+	NflInit();
+	snap = TfSnapLoad();
+	ChInit();
+
 	/// Initialise FatFs
 	FatFsHwInit();
-	fatFsStat = disk_initialize(0);
-	if (!fatFsStat) fatFsStat = f_mount(0, &vol);
+	SysCardMount();
 	if (fatFsStat)
 	{
 		XLCD_CLEAR();
 		XLCD_PUTS("SD CARD DAMAGED");
 		XLCD_LINE2();
 		XLCD_PUTS("OR NOT INSERTED!");
-		PANIC();
+		/// Without a snapshot there is no configuration to work with, so
+		/// all calls are allowed until a card is inserted
+		if (TF_SNAP_INVALID == snap) TfInit(TF_MODE_BLACKLIST);
+		TimEvtWait(2000);
 	}
-	/// Parse configuration file in SD Card
-	if (TfParseConfig())
+	/// If the whole configuration was in the snapshot, parse the
+	/// configuration file later, when the system is idle
+	else if (TF_SNAP_FULL == snap) cfgSync = TRUE;
+	/// Parse configuration file in SD Card. If it fails, keep working with
+	/// the snapshot configuration
+	else if (TfCfgReload())
 	{
 		XLCD_CLEAR();
 		XLCD_PUTS("BALSAMO.CFG FILE");
 		XLCD_LINE2();
 		XLCD_PUTS("NOT VALID/FOUND!");
-		PANIC();
+		TimEvtWait(2000);
 	}
 
 	/// Open log file and place cursor at its end.
 	/// \warning If log file opening fails, the system will not warn user.
-	retVal = f_open(&fLog, "BALSAMO.LOG", FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
-	if (!retVal) retVal = f_lseek(&fLog, f_size(&fLog));
-	evLog = !retVal;
+	LogOpen();
+	ChOpen();
+	/// Now the log is open, report the SD card clock and the configuration
+	/// lines rejected (if any)
+	SysCardReport();
+	SysCfgReport(TRUE);
 
 	/// User interface initialization
 	UifInit();
@@ -547,6 +651,203 @@ void SysInit(void)
 
 	/// PWM player module initialization
 	RawPlayInit();
+
+	if (cfgSync) SysQueuePut(SYS_CFG_SYNC);
+}
+
+/************************************************************************//**
+ * \brief Parses the configuration file in the SD card, that is the source
+ * of truth, and updates the EEPROM snapshot if needed. If the file cannot
+ * be parsed, the snapshot configuration is kept.
+ ****************************************************************************/
+void SysCfgSync(void)
+{
+	cfgSync = FALSE;
+	TfCfgReload();
+	SysCfgReport(FALSE);
+}
+
+/************************************************************************//**
+ * \brief Initializes the SD card and mounts its volume. The result is kept
+ * in fatFsStat. The default messages are mapped for fast seeking, so
+ * playing them does not walk the FAT.
+ ****************************************************************************/
+void SysCardMount(void)
+{
+	fatFsStat = disk_initialize(0);
+	if (!fatFsStat) fatFsStat = f_mount(0, &vol);
+	if (fatFsStat) return;
+
+	FmInit();
+	FmMap(FILE_MSG_FILTERED);
+	FmMap(FILE_MSG_FORBIDDEN);
+	FmMap(CA_FILE_BUSY);
+	FmMap(CA_FILE_NOEXIST);
+}
+
+/************************************************************************//**
+ * \brief Checks whether the SD card has been removed or inserted. Must be
+ * called only in SYS_SLEEP state, so the configuration is never reloaded
+ * during a call.
+ *
+ * A card powered down while idle is woken up just for the check and powered
+ * down again, so the check does not keep it awake (see MMC_CHK_CARD).
+ *
+ * When the card is removed, the files kept open are released and the
+ * volume is unmounted. Calls are still filtered with the configuration in
+ * RAM. When a card is inserted, it is mounted, the log is reopened and the
+ * configuration is reloaded from it (see TfCfgReload()).
+ ****************************************************************************/
+void SysCardCheck(void)
+{
+	if (!fatFsStat)
+	{
+		/// Card still answering, nothing to do
+		if (!disk_ioctl(0, MMC_CHK_CARD, NULL)) return;
+		/// Card removed. The open files cannot be flushed anymore, so
+		/// they are just dropped
+		LogClose();
+		NidxClose();
+		ChClose();
+		f_mount(0, NULL);
+		fatFsStat = STA_NOINIT;
+		return;
+	}
+
+	/// No card mounted, try to mount one
+	SysCardMount();
+	if (fatFsStat) return;
+	LogOpen();
+	ChOpen();
+	Log("SD CARD INSERTED, RELOADING BALSAMO.CFG");
+	SysCardReport();
+	SysCfgSync();
+}
+
+/************************************************************************//**
+ * \brief Powers the SD card down until the next access, that wakes it up
+ * transparently (see CTRL_POWER in mmc.c). Dirty cached sectors are written
+ * first. Does nothing if no card is mounted.
+ *
+ * \param[in] idle If TRUE, the card is only powered down once it has not
+ *            been accessed for MMC_IDLE_MS. If FALSE, right away (e.g.
+ *            before sleeping, as the disk timer stops).
+ ****************************************************************************/
+void SysCardPowerDown(char idle)
+{
+	BYTE pwr[2] = {0};
+
+	if (fatFsStat) return;
+	disk_ioctl(0, idle?MMC_POWER_IDLE:CTRL_POWER, pwr);
+}
+
+/************************************************************************//**
+ * \brief Converts a number to a null terminated decimal string.
+ *
+ * \param[in]  val Number to convert.
+ * \param[out] str Buffer receiving the string, at least 6 characters long.
+ *
+ * \return Pointer to the end of the string.
+ ****************************************************************************/
+static char *SysU2Str(WORD val, char str[])
+{
+	char tmp[5];
+	BYTE i = 0;
+
+	do {
+		tmp[i++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	while (i) *str++ = tmp[--i];
+	*str = '\0';
+	return str;
+}
+
+/************************************************************************//**
+ * \brief Logs the SPI clock negotiated with the SD card, the maximum one
+ * the card supports and the CRC mode with its error count, e.g. to spot
+ * cards or sockets that force the driver to step down. With MMC_USE_BENCH
+ * the transfer benchmark is also run and logged, one line per SPI clock.
+ * Does nothing if no card is mounted.
+ ****************************************************************************/
+void SysCardReport(void)
+{
+	WORD khz[2];
+	WORD crc[2];
+	/// e.g. "SD CARD: SPI CLOCK 5529 KHZ, CARD MAX 25000 KHZ, CRC ON, 0 ERRORS"
+	char msg[80] = "SD CARD: SPI CLOCK ";
+#if MMC_USE_BENCH
+	WORD res[MMC_BENCH_CLOCKS][3];
+	BYTE i;
+#endif
+
+	if (fatFsStat || disk_ioctl(0, MMC_GET_CLOCK, khz)) return;
+	strcpy(SysU2Str(khz[0], msg + strlen(msg)), " KHZ, CARD MAX ");
+	strcpy(SysU2Str(khz[1], msg + strlen(msg)), " KHZ");
+	if (disk_ioctl(0, MMC_GET_CRC, crc) == RES_OK)
+	{
+		if (crc[0])
+		{
+			strcat(msg, ", CRC ON, ");
+			strcpy(SysU2Str(crc[1], msg + strlen(msg)), " ERRORS");
+		}
+		else strcat(msg, ", CRC OFF");
+	}
+	Log(msg);
+
+#if MMC_USE_BENCH
+	/// e.g. "SD BENCH 5529 KHZ: 32 SECTORS 120 MS, CRC 180 MS"
+	if (disk_ioctl(0, MMC_BENCH, res)) return;
+	for (i = 0; i < MMC_BENCH_CLOCKS; i++)
+	{
+		strcpy(msg, "SD BENCH ");
+		strcpy(SysU2Str(res[i][0], msg + strlen(msg)), " KHZ: ");
+		strcpy(SysU2Str(MMC_BENCH_SECTS, msg + strlen(msg)), " SECTORS ");
+		strcpy(SysU2Str(res[i][1], msg + strlen(msg)), " MS, CRC ");
+		strcpy(SysU2Str(res[i][2], msg + strlen(msg)), " MS");
+		Log(msg);
+	}
+#endif
+}
+
+/************************************************************************//**
+ * \brief Reports the lines of BALSAMO.CFG rejected by the last parse (see
+ * TfCfgRejects()) in the log file, and optionally in the LCD.
+ *
+ * \param[in] lcd If TRUE, the number of rejected lines and the first one
+ *            are also shown in the LCD for 2 seconds.
+ ****************************************************************************/
+void SysCfgReport(char lcd)
+{
+	WORD lines[TF_REJ_MAX];
+	WORD n, i;
+	char str[17];
+	/// e.g. "BALSAMO.CFG: 5 LINES REJECTED: 3 7 12 40 ..."
+	char msg[64] = "BALSAMO.CFG: ";
+	char *p;
+
+	if (!(n = TfCfgRejects(lines))) return;
+
+	p = SysU2Str(n, msg + strlen(msg));
+	strcpy(p, " LINES REJECTED:");
+	for (i = 0; (i < n) && (i < TF_REJ_MAX); i++)
+	{
+		p += strlen(p);
+		*p++ = ' ';
+		SysU2Str(lines[i], p);
+	}
+	if (n > TF_REJ_MAX) strcat(p, " ...");
+	Log(msg);
+
+	if (!lcd) return;
+	XLCD_CLEAR();
+	XLCD_PUTS("CFG LINES BAD:");
+	XLCD_LINE2();
+	/// e.g. "3 FROM LINE 17"
+	strcpy(SysU2Str(n, str), " FROM LINE ");
+	SysU2Str(lines[0], str + strlen(str));
+	XLCD_PUTS(str);
+	TimEvtWait(2000);
 }
 
 /// End call process. Stops ADC, resets FSK demodulator and CID decoder, and
@@ -562,9 +863,14 @@ void CallProcEnd(void)
 	SetD15(LED_OFF);
 	SetD16(LED_OFF);
 	TimEvtWait(5000);
+	/// Keep the repeat caller table across reboots
+	RcSave();
 	UifEventParse(SYS_CALL_END, NULL, 0);
 	sysStat = SYS_SLEEP;
 	TimEvtRun(SLEEP_EVT_TIM, SLEEP_TOUT * 1000);
+	/// Configuration sync is only done while in SYS_SLEEP state. Retry it
+	/// if the event arrived during the call.
+	if (cfgSync) SysQueuePut(SYS_CFG_SYNC);
 }
 
 /// Waits until TIMER4 reaches a specified count value
@@ -588,41 +894,3 @@ void FatFsHwInit(void)
 	/// Enable internal pullup for SDI2 (CN9)
 	CNPU1 |= BIT9;
 }
-
-/************************************************************************//**
- * \brief Logs a string to log file, preceded by the date and time.
- *
- * \param[in] str String to log along with num.
- ****************************************************************************/
-void Log(char str[])
-{
-	WORD y;
-	BYTE mo, d, h, mi, s;
-
-	_DI();
-	RtcGetDate(&y, &mo, &d);
-	RtcGetTime(&h, &mi, &s);
-
-	f_printf(&fLog, "%02d/%02d/%d, %02d:%02d --> %s\n", d, mo, y, h, mi, str);
-	f_sync(&fLog);
-}
-
-/************************************************************************//**
- * \brief Logs a number and an action, preceded by date and time.
- *
- * \param[in] num String containing the number to log.
- * \param[in] str String to log along with num.
- ****************************************************************************/
-void LogNumStr(char num[], char str[])
-{
-	WORD y;
-	BYTE mo, d, h, mi, s;
-
-	_DI();
-	RtcGetDate(&y, &mo, &d);
-	RtcGetTime(&h, &mi, &s);
-
-	f_printf(&fLog, "%02d/%02d/%d, %02d:%02d --> %s %s\n", d, mo, y, h, mi,
-			 num, str);
-	f_sync(&fLog);	
-}
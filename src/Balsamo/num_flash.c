@@ -0,0 +1,289 @@
+/************************************************************************//**
+ * \file  num_flash.c
+ * \brief Telephone number list stored in program flash. Holds a copy of the
+ * on-card number index, so big lists can be checked without RAM cost and
+ * without accessing the microSD card.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "num_flash.h"
+#include "num_idx.h"
+#include "crc.h"
+#include "fatfs/ff.h"
+#include <libpic30.h>
+#include <string.h>
+
+#if (NFL_ROW_WORDS != _FLASH_ROW) || (_FLASH_ROW != _FLASH_PAGE)
+#error "Flash row length does not match the target device"
+#endif
+
+/// Data rows. Placed in their own flash pages, so erasing them does not
+/// affect code.
+static int __attribute__((space(prog), aligned(_FLASH_PAGE * 2)))
+	nflData[NFL_DATA_ROWS * NFL_ROW_WORDS];
+/// Header row
+static int __attribute__((space(prog), aligned(_FLASH_PAGE * 2)))
+	nflMeta[NFL_ROW_WORDS];
+
+/// Program address of the data rows
+static _prog_addressT dataAddr;
+/// Program address of the header row
+static _prog_addressT metaAddr;
+/// TRUE if the list is valid
+static BYTE nflValid = FALSE;
+/// Number of numbers in the data rows
+static DWORD nRec;
+
+/// Program address of a row, from the first row address and row number
+#define NflRowAddr(first, row)	((first) + (_prog_addressT)(row) * \
+		NFL_ROW_WORDS * 2)
+
+/************************************************************************//**
+ * \brief Reads a packed number from the data rows.
+ *
+ * \param[in]  idx Position of the number in the list.
+ * \param[out] key Buffer receiving the packed number.
+ ****************************************************************************/
+static void NflKeyRead(DWORD idx, BYTE key[])
+{
+	_memcpy_p2d16(key, dataAddr + idx * NFL_KEY_WORDS * 2, TN_PACK_LEN);
+}
+
+/************************************************************************//**
+ * \brief Erases and writes a flash row, unless it already holds the data.
+ * Rows of the list that did not change are not reprogrammed, saving the
+ * programming time and the flash endurance.
+ *
+ * \param[in] addr Program address of the row.
+ * \param[in] buf  Row data (NFL_ROW_WORDS words).
+ ****************************************************************************/
+static void NflRowWrite(_prog_addressT addr, int buf[])
+{
+	int row[NFL_ROW_WORDS];
+
+	_memcpy_p2d16(row, addr, NFL_ROW_WORDS * 2);
+	if (!memcmp(row, buf, sizeof(row))) return;
+	_erase_flash(addr);
+	_write_flash16(addr, buf);
+}
+
+/************************************************************************//**
+ * \brief Computes the CRC of the header row.
+ *
+ * \param[in] buf Row data (NFL_ROW_WORDS words).
+ *
+ * \return CRC16 of all the words in the row but the last one.
+ ****************************************************************************/
+static WORD NflRowCrc(const int buf[])
+{
+	return Crc16(CRC16_INIT, (const BYTE*)buf, NFL_ROW_CRC * 2);
+}
+
+/************************************************************************//**
+ * \brief Computes the CRC of the numbers in the data rows.
+ *
+ * \param[in] n Number of numbers.
+ *
+ * \return CRC16 of the numbers.
+ ****************************************************************************/
+static WORD NflDataCrc(DWORD n)
+{
+	BYTE key[TN_PACK_LEN];
+	WORD crc = CRC16_INIT;
+	DWORD i;
+
+	for (i = 0; i < n; i++)
+	{
+		NflKeyRead(i, key);
+		crc = Crc16(crc, key, TN_PACK_LEN);
+	}
+
+	return crc;
+}
+
+/************************************************************************//**
+ * \brief Writes the header row. Must be called after the data rows have
+ * been written.
+ *
+ * \param[in] n    Number of numbers in the data rows.
+ * \param[in] size Source index file size.
+ * \param[in] date Source index file FAT date.
+ * \param[in] time Source index file FAT time.
+ ****************************************************************************/
+static void NflHdrWrite(DWORD n, DWORD size, WORD date, WORD time)
+{
+	int buf[NFL_ROW_WORDS];
+
+	memset(buf, 0xFF, sizeof(buf));
+	buf[NFL_HDR_MAGIC] = NFL_MAGIC;
+	buf[NFL_HDR_VERSION] = NFL_VERSION;
+	buf[NFL_HDR_NREC] = n;
+	buf[NFL_HDR_NREC + 1] = n>>16;
+	buf[NFL_HDR_SIZE] = size;
+	buf[NFL_HDR_SIZE + 1] = size>>16;
+	buf[NFL_HDR_DATE] = date;
+	buf[NFL_HDR_TIME] = time;
+	buf[NFL_HDR_DATACRC] = NflDataCrc(n);
+	buf[NFL_ROW_CRC] = NflRowCrc(buf);
+	NflRowWrite(metaAddr, buf);
+	nRec = n;
+}
+
+/************************************************************************//**
+ * \brief Module initialization. Checks the list CRC, and formats an empty
+ * list if the stored one is not valid. Must be called once, before using
+ * any other function. Checking the CRC reads the whole list.
+ *
+ * \return 0 if the stored list is valid, nonzero if it had to be formatted.
+ ****************************************************************************/
+char NflInit(void)
+{
+	int buf[NFL_ROW_WORDS];
+
+	_init_prog_address(dataAddr, nflData);
+	_init_prog_address(metaAddr, nflMeta);
+
+	/// Check header and data CRCs
+	_memcpy_p2d16(buf, metaAddr, NFL_ROW_WORDS * 2);
+	nRec = (WORD)buf[NFL_HDR_NREC] | ((DWORD)buf[NFL_HDR_NREC + 1]<<16);
+	nflValid = (buf[NFL_HDR_MAGIC] == NFL_MAGIC) &&
+		(buf[NFL_HDR_VERSION] == NFL_VERSION) &&
+		((WORD)buf[NFL_ROW_CRC] == NflRowCrc(buf)) &&
+		(nRec <= NFL_MAX_NUMS) &&
+		((WORD)buf[NFL_HDR_DATACRC] == NflDataCrc(nRec));
+	if (!nflValid)
+	{
+		/// Format an empty list, with no source index
+		NflHdrWrite(0, 0, 0, 0);
+		nflValid = TRUE;
+		return 1;
+	}
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Makes sure the flash list holds a copy of an index file. The list
+ * is only reprogrammed if the file size or modification date differ from
+ * the ones recorded when it was last programmed. The index must be open
+ * (see NidxOpen()).
+ *
+ * \param[in] file Name of the open index file.
+ *
+ * \return 0 if the flash list matches the index, nonzero otherwise.
+ ****************************************************************************/
+char NflSync(const char file[])
+{
+	int buf[NFL_ROW_WORDS];
+	FILINFO fi;
+	DWORD n, i;
+	WORD j;
+
+	if (!nflValid) return 1;
+	fi.lfname = NULL;
+	fi.lfsize = 0;
+	if (f_stat(file, &fi)) return 1;
+
+	/// Check the stamp of the index the list was programmed from
+	_memcpy_p2d16(buf, metaAddr, NFL_ROW_WORDS * 2);
+	if (((WORD)buf[NFL_HDR_SIZE] == (WORD)fi.fsize) &&
+		((WORD)buf[NFL_HDR_SIZE + 1] == (WORD)(fi.fsize>>16)) &&
+		((WORD)buf[NFL_HDR_DATE] == fi.fdate) &&
+		((WORD)buf[NFL_HDR_TIME] == fi.ftime)) return 0;
+
+	n = NidxCount();
+	if (n > NFL_MAX_NUMS)
+	{
+		/// Numbers from a previous index must not be used along with this one
+		NflClear();
+		return 2;
+	}
+
+	/// Program the data rows, reading the index sequentially
+	for (i = 0; i < n; i += NFL_KEYS_PER_ROW)
+	{
+		memset(buf, 0xFF, sizeof(buf));
+		for (j = 0; (j < NFL_KEYS_PER_ROW) && ((i + j) < n); j++)
+		{
+			if (NidxGet(i + j, (BYTE*)(buf + j * NFL_KEY_WORDS)))
+			{
+				/// Leave a valid empty list
+				NflHdrWrite(0, 0, 0, 0);
+				return 3;
+			}
+		}
+		NflRowWrite(NflRowAddr(dataAddr, i / NFL_KEYS_PER_ROW), buf);
+	}
+	NflHdrWrite(n, fi.fsize, fi.fdate, fi.ftime);
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Empties the flash list, so the numbers of a previous index are not
+ * found anymore. Nothing is programmed if the list is already empty.
+ ****************************************************************************/
+void NflClear(void)
+{
+	int buf[NFL_ROW_WORDS];
+
+	if (!nflValid) return;
+	_memcpy_p2d16(buf, metaAddr, NFL_ROW_WORDS * 2);
+	if (nRec || buf[NFL_HDR_SIZE] || buf[NFL_HDR_SIZE + 1] ||
+			buf[NFL_HDR_DATE] || buf[NFL_HDR_TIME]) NflHdrWrite(0, 0, 0, 0);
+}
+
+/************************************************************************//**
+ * \brief Looks up a packed number in the flash list.
+ *
+ * \param[in] key Packed number to look for.
+ *
+ * \return TRUE if the number is in the list, FALSE otherwise.
+ ****************************************************************************/
+char NflFind(const BYTE key[])
+{
+	BYTE probe[TN_PACK_LEN];
+	DWORD lo = 0, hi, mid;
+	int cmp;
+
+	if (!nflValid) return FALSE;
+
+	hi = nRec;
+	while (lo < hi)
+	{
+		mid = (lo + hi)>>1;
+		NflKeyRead(mid, probe);
+		if (!(cmp = TnCmp(key, probe))) return TRUE;
+		if (cmp < 0) hi = mid;
+		else lo = mid + 1;
+	}
+
+	return FALSE;
+}
+
+/************************************************************************//**
+ * \brief Returns the number of numbers in the flash list.
+ *
+ * \return Number of numbers in the list, or 0 if the list is not valid.
+ ****************************************************************************/
+DWORD NflCount(void)
+{
+	return nflValid?nRec:0;
+}
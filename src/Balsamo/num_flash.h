@@ -0,0 +1,131 @@
+/************************************************************************//**
+ * \file  num_flash.h
+ * \brief Telephone number list stored in program flash. Holds a copy of the
+ * on-card number index, so big lists can be checked without RAM cost and
+ * without accessing the microSD card.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _NUM_FLASH_H_
+#define _NUM_FLASH_H_
+
+#include "types.h"
+#include "tel_num.h"
+
+/** \defgroup num_flash_api num_flash
+ *
+ * Telephone number list stored in program flash, written using run-time
+ * self-programming (RTSP) and read using table reads. Flash is erased and
+ * written in rows of NFL_ROW_WORDS instructions, and only the lower 16 bits
+ * of each instruction are used. The list is made of:
+ * - Data rows: sorted packed numbers, NFL_KEYS_PER_ROW per row.
+ * - Header row: list length, stamp of the source index file, and CRC16 of
+ *   the numbers. The CRC is checked by NflInit() once per boot.
+ *
+ * The list is a plain copy of the on-card index: it is only programmed from
+ * the index when the index file changes (NflSync()), and is used afterwards
+ * even if the card cannot be read. Only the rows whose contents changed are
+ * erased and written: a number replaced in place only rewrites its row,
+ * while a number added or removed shifts the rows after it. The data rows
+ * are written first and the header last, so if power fails while
+ * programming, the list fails its CRC. NflInit() then formats it empty, and
+ * it is programmed again the next time NflSync() runs with the card in
+ * place. Until then, the numbers in the index are not found.
+ *
+ * \warning Erasing and writing flash stalls the CPU for about 2 ms per row.
+ * Do not reprogram the list while a call is in progress.
+ * \{ */
+
+/// Instructions (16-bit data words) in a flash row
+#define NFL_ROW_WORDS		32
+/// Words taken by each packed number
+#define NFL_KEY_WORDS		(TN_PACK_LEN / 2)
+/// Numbers in each data row
+#define NFL_KEYS_PER_ROW	(NFL_ROW_WORDS / NFL_KEY_WORDS)
+/// Number of data rows. Each row takes 96 bytes of program flash.
+#define NFL_DATA_ROWS		512
+/// Maximum number of numbers in the list
+#define NFL_MAX_NUMS		((DWORD)NFL_DATA_ROWS * NFL_KEYS_PER_ROW)
+
+/// Header row magic number
+#define NFL_MAGIC			0x4C46	// "FL"
+/// Header row format version
+#define NFL_VERSION			2
+
+/** \addtogroup nfl_hdr Header row word offsets. The last word of the header
+ * row is the CRC16 of the previous words.
+ * \{ */
+#define NFL_HDR_MAGIC		0	///< Magic number
+#define NFL_HDR_VERSION		1	///< Format version
+#define NFL_HDR_NREC		2	///< Number of numbers (2 words)
+#define NFL_HDR_SIZE		4	///< Source index file size (2 words)
+#define NFL_HDR_DATE		6	///< Source index file FAT date
+#define NFL_HDR_TIME		7	///< Source index file FAT time
+#define NFL_HDR_DATACRC		8	///< CRC16 of the numbers in data rows
+#define NFL_ROW_CRC			(NFL_ROW_WORDS - 1)	///< Row CRC16
+/** \} */
+
+/************************************************************************//**
+ * \brief Module initialization. Checks the list CRC, and formats an empty
+ * list if the stored one is not valid. Must be called once, before using
+ * any other function. Checking the CRC reads the whole list.
+ *
+ * \return 0 if the stored list is valid, nonzero if it had to be formatted.
+ ****************************************************************************/
+char NflInit(void);
+
+/************************************************************************//**
+ * \brief Makes sure the flash list holds a copy of an index file. The list
+ * is only reprogrammed if the file size or modification date differ from
+ * the ones recorded when it was last programmed. The index must be open
+ * (see NidxOpen()).
+ *
+ * \param[in] file Name of the open index file.
+ *
+ * \return 0 if the flash list matches the index, nonzero otherwise.
+ ****************************************************************************/
+char NflSync(const char file[]);
+
+/************************************************************************//**
+ * \brief Empties the flash list, so the numbers of a previous index are not
+ * found anymore. Nothing is programmed if the list is already empty.
+ ****************************************************************************/
+void NflClear(void);
+
+/************************************************************************//**
+ * \brief Looks up a packed number in the flash list.
+ *
+ * \param[in] key Packed number to look for.
+ *
+ * \return TRUE if the number is in the list, FALSE otherwise.
+ ****************************************************************************/
+char NflFind(const BYTE key[]);
+
+/************************************************************************//**
+ * \brief Returns the number of numbers in the flash list.
+ *
+ * \return Number of numbers in the list, or 0 if the list is not valid.
+ ****************************************************************************/
+DWORD NflCount(void);
+
+/** \} */
+
+#endif /*_NUM_FLASH_H_*/
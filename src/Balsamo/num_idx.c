@@ -0,0 +1,293 @@
+/************************************************************************//**
+ * \file  num_idx.c
+ * \brief On-card telephone number index. Allows looking up numbers in a
+ * sorted, fixed record binary file stored in the microSD card, too big to
+ * fit in RAM.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "num_idx.h"
+#include "bloom.h"
+#include "call_act.h"
+#include "fs_map.h"
+#include "fatfs/ff.h"
+#include <string.h>
+
+/// Index file. With _FS_TINY, reads go through the volume window, so
+/// probing several keys inside the same sector costs a single card read.
+static FIL fIdx;
+/// TRUE if the index file is open
+static BYTE idxOpen = FALSE;
+/// Record length
+static WORD recLen;
+/// Records in each data sector
+static WORD recPerSect;
+/// Number of records
+static DWORD nRec;
+/// Number of data sectors
+static DWORD nData;
+/// Number of fence sectors
+static WORD nFence;
+/// First key of each fence sector
+static BYTE fence[NIDX_MAX_FENCE][TN_PACK_LEN];
+#if NIDX_BLOOM_LEN
+/// Bloom filter bit array
+static BYTE bloom[NIDX_BLOOM_LEN];
+/// Number of Bloom filter hash functions. 0 if the filter is not in use.
+static BYTE bloomK;
+#endif
+
+/************************************************************************//**
+ * \brief Reads data from the index file.
+ *
+ * \param[in]  ofs Offset in the file to read from.
+ * \param[out] buf Buffer receiving read data.
+ * \param[in]  len Number of bytes to read.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char NidxRead(DWORD ofs, BYTE buf[], UINT len)
+{
+	UINT br;
+
+	if (f_lseek(&fIdx, ofs) || f_read(&fIdx, buf, len, &br) || (br != len))
+		return 1;
+	return 0;
+}
+
+#if NIDX_BLOOM_LEN
+/************************************************************************//**
+ * \brief Loads the Bloom filter from NIDX_BLOOM_FILE. The filter must have
+ * been built for an index with the same number of records.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char NidxBloomLoad(void)
+{
+	FIL fBlm;
+	BYTE hdr[NIDX_BLM_HDR_LEN];
+	UINT br;
+	char err;
+
+	if (f_open(&fBlm, NIDX_BLOOM_FILE, FA_READ | FA_OPEN_EXISTING)) return 1;
+	err = f_read(&fBlm, hdr, NIDX_BLM_HDR_LEN, &br) ||
+		(br != NIDX_BLM_HDR_LEN) ||
+		memcmp(hdr + NIDX_BLM_MAGIC, NIDX_BLOOM_MAGIC, 4) ||
+		(LD_WORD(hdr + NIDX_BLM_VERSION) != NIDX_BLOOM_VERSION) ||
+		(LD_WORD(hdr + NIDX_BLM_LEN) != NIDX_BLOOM_LEN) ||
+		(LD_WORD(hdr + NIDX_BLM_NHASH) > BLOOM_MAX_HASHES) ||
+		(LD_DWORD(hdr + NIDX_BLM_NREC) != nRec);
+	/// Bit array is sector aligned, so it is read straight from the card
+	if (!err) err = f_lseek(&fBlm, NIDX_SECT_LEN) ||
+		f_read(&fBlm, bloom, NIDX_BLOOM_LEN, &br) || (br != NIDX_BLOOM_LEN);
+	f_close(&fBlm);
+	if (err) return 2;
+
+	bloomK = LD_WORD(hdr + NIDX_BLM_NHASH);
+	return 0;
+}
+#endif
+
+/************************************************************************//**
+ * \brief Opens an index file, loads its top level fence table and its
+ * Bloom filter. The file is kept open until NidxClose() is called.
+ *
+ * \param[in] file Name of the index file.
+ *
+ * \return 0 if OK, nonzero if the file is missing or not valid.
+ ****************************************************************************/
+char NidxOpen(const char file[])
+{
+	BYTE hdr[NIDX_HDR_LEN];
+	WORD i;
+
+	NidxClose();
+	if (f_open(&fIdx, file, FA_READ | FA_OPEN_EXISTING)) return 1;
+	/// Binary search seeks all over the file, map its clusters
+	FmAttach(&fIdx);
+
+	/// Read and check header
+	if (NidxRead(0, hdr, NIDX_HDR_LEN) ||
+		memcmp(hdr + NIDX_HDR_MAGIC, NIDX_MAGIC, 4) ||
+		(LD_WORD(hdr + NIDX_HDR_VERSION) != NIDX_VERSION))
+	{
+		f_close(&fIdx);
+		return 2;
+	}
+	recLen = LD_WORD(hdr + NIDX_HDR_RECLEN);
+	nRec   = LD_DWORD(hdr + NIDX_HDR_NREC);
+	nData  = LD_DWORD(hdr + NIDX_HDR_NDATA);
+	nFence = LD_WORD(hdr + NIDX_HDR_NFENCE);
+	if ((recLen < TN_PACK_LEN) || (recLen > NIDX_SECT_LEN))
+	{
+		f_close(&fIdx);
+		return 3;
+	}
+	recPerSect = NIDX_SECT_LEN / recLen;
+	/// Check sizes are coherent and the fence table fits in RAM
+	if ((nFence > NIDX_MAX_FENCE) ||
+		(nData != (nRec + recPerSect - 1) / recPerSect) ||
+		(nFence != (nData + NIDX_FENCE_PER_SECT - 1) / NIDX_FENCE_PER_SECT) ||
+		(f_size(&fIdx) < (1 + nFence + nData) * NIDX_SECT_LEN))
+	{
+		f_close(&fIdx);
+		return 3;
+	}
+
+	/// Load the first key of each fence sector
+	for (i = 0; i < nFence; i++)
+	{
+		if (NidxRead((DWORD)(1 + i) * NIDX_SECT_LEN, fence[i], TN_PACK_LEN))
+		{
+			f_close(&fIdx);
+			return 4;
+		}
+	}
+
+#if NIDX_BLOOM_LEN
+	/// Load the Bloom filter. Building it would read the whole index, so
+	/// without a matching filter file it is just not used.
+	bloomK = 0;
+	NidxBloomLoad();
+#endif
+
+	idxOpen = TRUE;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Looks up a packed number in the index.
+ *
+ * \param[in]  key Packed number to look for.
+ * \param[out] act Action of the number (see call_act.h), taken from the
+ *             byte following the key in the record. CA_DEFAULT if records
+ *             only hold the key.
+ *
+ * \return TRUE if the number is in the index, FALSE otherwise (or if no
+ * index is open).
+ ****************************************************************************/
+char NidxFind(const BYTE key[], BYTE *act)
+{
+	BYTE probe[TN_PACK_LEN + 1];
+	int lo, hi, mid, cmp;
+	DWORD sect, ofs, left;
+
+	*act = CA_DEFAULT;
+	if (!idxOpen || !nRec || (TnCmp(key, fence[0]) < 0)) return FALSE;
+#if NIDX_BLOOM_LEN
+	/// Numbers rejected by the Bloom filter are not in the index
+	if (bloomK && !BloomCheck(bloom, NIDX_BLOOM_LEN, bloomK, key))
+		return FALSE;
+#endif
+
+	/// Find the last fence sector starting with a key <= the searched one
+	lo = 0;
+	hi = nFence - 1;
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1)>>1;
+		if (TnCmp(key, fence[mid]) < 0) hi = mid - 1;
+		else lo = mid;
+	}
+
+	/// Same search inside the fence sector, to obtain the data sector
+	sect = (DWORD)lo * NIDX_FENCE_PER_SECT;
+	ofs = (DWORD)(1 + lo) * NIDX_SECT_LEN;
+	left = nData - sect;
+	lo = 0;
+	hi = (left < NIDX_FENCE_PER_SECT?left:NIDX_FENCE_PER_SECT) - 1;
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1)>>1;
+		if (NidxRead(ofs + (WORD)mid * TN_PACK_LEN, probe, TN_PACK_LEN))
+			return FALSE;
+		if (TnCmp(key, probe) < 0) hi = mid - 1;
+		else lo = mid;
+	}
+	sect += lo;
+
+	/// Binary search inside the data sector. The action is read along with
+	/// the key, so a match costs no extra read.
+	ofs = (1 + nFence + sect) * NIDX_SECT_LEN;
+	left = nRec - sect * recPerSect;
+	lo = 0;
+	hi = (left < recPerSect?left:recPerSect) - 1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi)>>1;
+		if (NidxRead(ofs + (WORD)mid * recLen, probe, recLen > TN_PACK_LEN?
+					TN_PACK_LEN + 1:TN_PACK_LEN)) return FALSE;
+		if (!(cmp = TnCmp(key, probe)))
+		{
+			if (recLen > TN_PACK_LEN) *act = probe[TN_PACK_LEN];
+			return TRUE;
+		}
+		if (cmp < 0) hi = mid - 1;
+		else lo = mid + 1;
+	}
+
+	return FALSE;
+}
+
+/************************************************************************//**
+ * \brief Tells if the records of the open index hold number actions.
+ *
+ * \return TRUE if records hold actions, FALSE otherwise (or if no index is
+ * open).
+ ****************************************************************************/
+char NidxHasActions(void)
+{
+	return idxOpen && (recLen > TN_PACK_LEN);
+}
+
+/************************************************************************//**
+ * \brief Returns the number of records in the open index.
+ *
+ * \return Number of records, or 0 if no index is open.
+ ****************************************************************************/
+DWORD NidxCount(void)
+{
+	return idxOpen?nRec:0;
+}
+
+/************************************************************************//**
+ * \brief Reads a record key from the open index, by its position. Allows
+ * reading the whole index sequentially.
+ *
+ * \param[in]  rec Record number, from 0 to NidxCount() - 1.
+ * \param[out] key Buffer receiving the packed number of the record.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char NidxGet(DWORD rec, BYTE key[])
+{
+	if (!idxOpen || (rec >= nRec)) return 1;
+	return NidxRead((1 + nFence + rec / recPerSect) * NIDX_SECT_LEN +
+			(WORD)(rec % recPerSect) * recLen, key, TN_PACK_LEN);
+}
+
+/************************************************************************//**
+ * \brief Closes the index file.
+ ****************************************************************************/
+void NidxClose(void)
+{
+	if (idxOpen) f_close(&fIdx);
+	idxOpen = FALSE;
+}
@@ -0,0 +1,165 @@
+/************************************************************************//**
+ * \file  num_idx.h
+ * \brief On-card telephone number index. Allows looking up numbers in a
+ * sorted, fixed record binary file stored in the microSD card, too big to
+ * fit in RAM.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NUM_IDX_H_
+#define _NUM_IDX_H_
+
+#include "types.h"
+#include "tel_num.h"
+
+/** \defgroup num_idx_api num_idx
+ *
+ * On-card telephone number index. The index file is made of 512 byte
+ * sectors:
+ * - Sector 0: header (see NIDX_HDR_* offsets). Multi-byte fields are
+ *   little endian.
+ * - Fence sectors: the first key of each data sector, NIDX_FENCE_PER_SECT
+ *   keys per sector.
+ * - Data sectors: fixed length records, sorted by their packed number key.
+ *   Records do not cross sector boundaries, unused space is filled with
+ *   0xFF. Records longer than TN_PACK_LEN hold the action of the number
+ *   (see call_act.h) in the byte following the key.
+ *
+ * The first key of each fence sector is kept in RAM, so a lookup costs one
+ * fence sector read plus one data sector read. Index files are built with
+ * the balidx host tool.
+ *
+ * Builds with NIDX_BLOOM_LEN set put a RAM Bloom filter in front of the
+ * index, so most numbers not in the index are rejected without accessing
+ * the card. The filter is loaded from NIDX_BLOOM_FILE (also built by
+ * balidx). If that file is missing or does not match the index, the filter
+ * is not used.
+ * \{ */
+
+/// Default index file name
+#define NIDX_FILE			"BLOCK.IDX"
+/// Sector length of the index file
+#define NIDX_SECT_LEN		512
+/// Index file magic number
+#define NIDX_MAGIC			"BIDX"
+/// Index file format version supported
+#define NIDX_VERSION		1
+/// Number of keys in each fence sector
+#define NIDX_FENCE_PER_SECT	(NIDX_SECT_LEN / TN_PACK_LEN)
+/// Maximum number of fence sectors. Each one takes TN_PACK_LEN bytes of RAM
+/// and indexes NIDX_FENCE_PER_SECT data sectors.
+#define NIDX_MAX_FENCE		32
+
+/// Default Bloom filter file name
+#define NIDX_BLOOM_FILE		"BLOCK.BLM"
+/// Bloom filter file magic number
+#define NIDX_BLOOM_MAGIC	"BBLM"
+/// Bloom filter file format version supported
+#define NIDX_BLOOM_VERSION	1
+/// Bloom filter length in bytes of the filter files balidx writes. Must be
+/// a power of 2.
+#define NIDX_BLOOM_FILE_LEN	1024
+/// Bloom filter length in bytes, NIDX_BLOOM_FILE_LEN to use the filter or 0
+/// (default) to leave its RAM free. It only pays off for indexes too big to
+/// be copied to program flash (NFL_MAX_NUMS) that still leave enough bits
+/// per number, from 4097 to about 11000 numbers with 1024 bytes.
+#ifndef NIDX_BLOOM_LEN
+#define NIDX_BLOOM_LEN		0
+#endif
+
+/** \addtogroup nidx_hdr Index header field offsets
+ * \{ */
+#define NIDX_HDR_MAGIC		0	///< Magic number (4 bytes)
+#define NIDX_HDR_VERSION	4	///< Format version (WORD)
+#define NIDX_HDR_RECLEN		6	///< Record length (WORD), >= TN_PACK_LEN
+#define NIDX_HDR_NREC		8	///< Number of records (DWORD)
+#define NIDX_HDR_NDATA		12	///< Number of data sectors (DWORD)
+#define NIDX_HDR_NFENCE		16	///< Number of fence sectors (WORD)
+#define NIDX_HDR_LEN		18	///< Header length
+/** \} */
+
+/** \addtogroup nidx_bloom_hdr Bloom filter file header field offsets. The
+ * filter bit array starts at offset NIDX_SECT_LEN.
+ * \{ */
+#define NIDX_BLM_MAGIC		0	///< Magic number (4 bytes)
+#define NIDX_BLM_VERSION	4	///< Format version (WORD)
+#define NIDX_BLM_LEN		6	///< Filter length in bytes (WORD)
+#define NIDX_BLM_NHASH		8	///< Number of hash functions (WORD)
+#define NIDX_BLM_NREC		10	///< Records in the matching index (DWORD)
+#define NIDX_BLM_HDR_LEN	14	///< Header length
+/** \} */
+
+/************************************************************************//**
+ * \brief Opens an index file, loads its top level fence table and its
+ * Bloom filter. The file is kept open until NidxClose() is called.
+ *
+ * \param[in] file Name of the index file.
+ *
+ * \return 0 if OK, nonzero if the file is missing or not valid.
+ ****************************************************************************/
+char NidxOpen(const char file[]);
+
+/************************************************************************//**
+ * \brief Looks up a packed number in the index.
+ *
+ * \param[in]  key Packed number to look for.
+ * \param[out] act Action of the number (see call_act.h), taken from the
+ *             byte following the key in the record. CA_DEFAULT if records
+ *             only hold the key.
+ *
+ * \return TRUE if the number is in the index, FALSE otherwise (or if no
+ * index is open).
+ ****************************************************************************/
+char NidxFind(const BYTE key[], BYTE *act);
+
+/************************************************************************//**
+ * \brief Tells if the records of the open index hold number actions.
+ *
+ * \return TRUE if records hold actions, FALSE otherwise (or if no index is
+ * open).
+ ****************************************************************************/
+char NidxHasActions(void);
+
+/************************************************************************//**
+ * \brief Returns the number of records in the open index.
+ *
+ * \return Number of records, or 0 if no index is open.
+ ****************************************************************************/
+DWORD NidxCount(void);
+
+/************************************************************************//**
+ * \brief Reads a record key from the open index, by its position. Allows
+ * reading the whole index sequentially.
+ *
+ * \param[in]  rec Record number, from 0 to NidxCount() - 1.
+ * \param[out] key Buffer receiving the packed number of the record.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char NidxGet(DWORD rec, BYTE key[]);
+
+/************************************************************************//**
+ * \brief Closes the index file.
+ ****************************************************************************/
+void NidxClose(void);
+
+/** \} */
+
+#endif /*_NUM_IDX_H_*/
@@ -25,14 +25,22 @@
 #include "rawplay.h"
 #include "pwmplay.h"
 #include "../fatfs/ff.h"
+#include "../fatfs/diskio.h"
+#include "../fs_map.h"
 
 /// Number of samples of the data read buffer. 512 bytes is OK for SD cards
 #define RAWP_BUF_NS		512
 
 /// FatFs file
 static FIL f;
+#if MMC_CACHE_SECTS * 512 >= 2 * RAWP_BUF_NS
+/// Read buffer. Doble buffering is used to avoid losing samples. The memory
+/// is lent by the SD card sector cache while playing.
+static BYTE (*buf)[RAWP_BUF_NS];
+#else
 /// Read buffer. Doble buffering is used to avoid losing samples
 static BYTE buf[2][RAWP_BUF_NS];
+#endif
 /// Its b0 bit records the frame in use of the read buffer
 static BYTE frm;
 /// Number of readed bytes in the last read operation
@@ -42,6 +50,25 @@ static BYTE readNext;
 /// Signals if we are playing a file
 static BYTE play;
 
+/************************************************************************//**
+ * \brief Sets up the SD card driver for playback, or back to normal. While
+ * playing, the card keeps sending contiguous sectors with a single read
+ * command, and the sector cache memory is borrowed for the read buffer.
+ *
+ * \param[in] on TRUE to set up for playback, FALSE to go back to normal.
+ *
+ * \return 0 if OK, nonzero if the read buffer could not be borrowed.
+ ****************************************************************************/
+static char RawStream(BYTE on)
+{
+#if MMC_CACHE_SECTS * 512 >= 2 * RAWP_BUF_NS
+	if (on && disk_ioctl(0, MMC_CACHE_LEND, &buf)) return 1;
+	if (!on) disk_ioctl(0, MMC_CACHE_RETURN, 0);
+#endif
+	disk_ioctl(0, MMC_STREAM, &on);
+	return 0;
+}
+
 /************************************************************************//**
  * \brief This callback is called when more audio data is needed. It returns
  * a pointer to new data, and prepares the module to read a new chunck.
@@ -115,19 +142,33 @@ void RawPlayInit(void)
  *
  * \return 0 if the file has been successfully played, nonzero otherwise.
  * \warning This function blocks using the Idle() function until playback
- * ends or is cancelled using RawPlayStop().
+ * ends or is cancelled using RawPlayStop(). Sector reads busy poll the SPI,
+ * unless mmc.c is built with MMC_SPI_INT and the SPI clock is Fcy/8 or
+ * slower: then they also Idle the CPU while the SPI2 interrupt moves the
+ * data.
  ****************************************************************************/
 BYTE RawPlayFile(char file[])
 {
 	/// Open audio file
 	if (f_open(&f, file, FA_READ)) return 1;
+	/// Use the cluster map, the FAT window is not touched while playing
+	FmAttach(&f);
 
 	/// Reset frame pointer
 	frm = 0;
 
+	/// Stream the file sectors, the command is only sent again when the
+	/// file jumps to a non contiguous cluster
+	if (RawStream(TRUE))
+	{
+		f_close(&f);
+		return 1;
+	}
+
 	/// Pre allocate the first chunck of data
 	if (f_read(&f, buf[frm], RAWP_BUF_NS, &readed))
 	{
+		RawStream(FALSE);
 		f_close(&f);
 		return 2;
 	}
@@ -154,6 +195,7 @@ BYTE RawPlayFile(char file[])
 				AmpDisable();
 #endif
 				PwmPlayStop();
+				RawStream(FALSE);
 				f_close(&f);
 				play = FALSE;
 				return 3;
@@ -166,7 +208,8 @@ BYTE RawPlayFile(char file[])
 	AmpDisable();
 #endif
 	PwmPlayStop();
-	/// Everything OK, close file and exit
+	/// Everything OK, stop streaming, close file and exit
+	RawStream(FALSE);
 	f_close(&f);
 	return 0;
 }
@@ -179,5 +222,6 @@ void RawPlayStop(void)
 	PwmPlayStop();
 	readNext = FALSE;
 	play = FALSE;
+	RawStream(FALSE);
 	f_close(&f);
 }
@@ -43,7 +43,10 @@ void RawPlayInit(void);
  *
  * \return 0 if the file has been successfully played, nonzero otherwise.
  * \warning This function blocks using the Idle() function until playback
- * ends or is cancelled using RawPlayStop().
+ * ends or is cancelled using RawPlayStop(). Sector reads busy poll the SPI,
+ * unless mmc.c is built with MMC_SPI_INT and the SPI clock is Fcy/8 or
+ * slower: then they also Idle the CPU while the SPI2 interrupt moves the
+ * data.
  ****************************************************************************/
 BYTE RawPlayFile(char file[]);
 
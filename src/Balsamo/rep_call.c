@@ -0,0 +1,314 @@
+/************************************************************************//**
+ * \file  rep_call.c
+ * \brief Repeat caller detection.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \note This module does not depend on the hardware, and is also built by
+ * the host tools.
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rep_call.h"
+#include "eeprom.h"
+#include "rtc.h"
+#include "crc.h"
+#include "fatfs/ff.h"
+#include <string.h>
+
+/** \addtogroup rc_ee Table stored in data EEPROM, at EE_RC_OFS. The header
+ * is followed by the RC_SLOTS entries.
+ * \{ */
+#define RC_EE_MAGIC		0	///< Magic number (WORD)
+#define RC_EE_VERSION	2	///< Format version (WORD)
+#define RC_EE_CALLS		4	///< Calls needed to block a number (WORD)
+#define RC_EE_WINDOW	6	///< Window length in minutes (WORD)
+#define RC_EE_BLOCK		8	///< Minutes a number is blocked (WORD)
+#define RC_EE_CRC		10	///< CRC16 of previous bytes and entries (WORD)
+#define RC_EE_HDR_LEN	12	///< Header length
+/** \} */
+
+/// Table entry
+typedef struct
+{
+	BYTE key[TN_PACK_LEN];	///< Packed canonical number, 0xFF if unused
+	DWORD call[RC_HIST];	///< Times of the last calls, newest first
+	DWORD blockEnd;			///< Time blocking ends, 0 if not blocked
+	WORD nCalls;			///< Number of valid entries in call
+} RcEntry;
+
+/// Caller table
+static RcEntry rc[RC_SLOTS];
+/// Calls needed to block a number, 0 if detection is disabled
+static BYTE rcCalls;
+/// Window length in minutes
+static WORD rcWindow;
+/// Minutes a number is blocked
+static WORD rcBlock;
+/// TRUE if the table or the settings changed since they were saved
+static char rcDirty;
+
+/// Configuration line directive
+static const char rcTag[] = "REPEAT_BLOCK=";
+
+/************************************************************************//**
+ * \brief Computes the CRC of the header fields and the table.
+ *
+ * \param[in] hdr Header.
+ *
+ * \return CRC16 of the header fields before RC_EE_CRC and the table.
+ ****************************************************************************/
+static WORD RcCrc(const BYTE hdr[])
+{
+	return Crc16(Crc16(CRC16_INIT, hdr, RC_EE_CRC), (const BYTE*)rc,
+			sizeof(rc));
+}
+
+/************************************************************************//**
+ * \brief Module initialization. Loads the table and the settings from data
+ * EEPROM. If they are not valid, detection is disabled and the table is
+ * cleared.
+ ****************************************************************************/
+void RcInit(void)
+{
+	BYTE hdr[RC_EE_HDR_LEN];
+
+	rcDirty = FALSE;
+	EeRead(EE_RC_OFS, hdr, RC_EE_HDR_LEN);
+	EeRead(EE_RC_OFS + RC_EE_HDR_LEN, rc, sizeof(rc));
+	if ((LD_WORD(hdr + RC_EE_MAGIC) == RC_MAGIC) &&
+		(LD_WORD(hdr + RC_EE_VERSION) == RC_VERSION) &&
+		(LD_WORD(hdr + RC_EE_CRC) == RcCrc(hdr)) &&
+		!RcSetup(LD_WORD(hdr + RC_EE_CALLS), LD_WORD(hdr + RC_EE_WINDOW),
+			LD_WORD(hdr + RC_EE_BLOCK)))
+	{
+		rcDirty = FALSE;
+		return;
+	}
+
+	memset(rc, 0xFF, sizeof(rc));
+	rcCalls = 0;
+	rcWindow = rcBlock = 0;
+}
+
+/************************************************************************//**
+ * \brief Sets the detection parameters. Calls already in the table are
+ * kept.
+ *
+ * \param[in] calls  Calls needed to block a number (0 disables detection).
+ * \param[in] window Window length in minutes.
+ * \param[in] block  Minutes the number is blocked.
+ *
+ * \return 0 if OK, nonzero if the parameters are out of range (settings
+ * are not changed).
+ ****************************************************************************/
+char RcSetup(WORD calls, WORD window, WORD block)
+{
+	if (!calls) window = block = 0;
+	else if ((calls < 2) || (calls > RC_HIST) || !window ||
+			(window > RC_MAX_WINDOW) || !block) return 1;
+
+	if ((calls != rcCalls) || (window != rcWindow) || (block != rcBlock))
+	{
+		rcCalls = calls;
+		rcWindow = window;
+		rcBlock = block;
+		rcDirty = TRUE;
+	}
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Parses a decimal number from a configuration line.
+ *
+ * \param[in]  p   Pointer to the number.
+ * \param[out] val Parsed value.
+ *
+ * \return Pointer to the character following the number, or NULL if there
+ * are no digits or the value does not fit in a WORD.
+ ****************************************************************************/
+static const char *RcNum(const char *p, WORD *val)
+{
+	DWORD v = 0;
+	const char *start = p;
+
+	while ((*p >= '0') && (*p <= '9'))
+	{
+		v = v * 10 + *p++ - '0';
+		if (v > 0xFFFF) return NULL;
+	}
+	*val = v;
+	return (p == start)?NULL:p;
+}
+
+/************************************************************************//**
+ * \brief Parses a REPEAT_BLOCK configuration line. The line ends with the
+ * first '\0', '\r' or '\n' character found.
+ *
+ * \param[in] line Configuration line.
+ *
+ * \return 0 if the settings were changed, 1 if the line is not a
+ * REPEAT_BLOCK line, 2 if it is not valid.
+ ****************************************************************************/
+char RcCfgParse(const char line[])
+{
+	const char *p = line + sizeof(rcTag) - 1;
+	WORD val[3];
+	BYTE i;
+
+	if (strncmp(line, rcTag, sizeof(rcTag) - 1)) return 1;
+	for (i = 0; i < 3; i++)
+	{
+		/// Fields are separated by blanks
+		if (i && (' ' != *p) && ('\t' != *p)) return 2;
+		while ((' ' == *p) || ('\t' == *p)) p++;
+		if (!(p = RcNum(p, val + i))) return 2;
+	}
+	while ((' ' == *p) || ('\t' == *p)) p++;
+	if ((*p && ('\r' != *p) && ('\n' != *p)) || (val[0] > RC_HIST)) return 2;
+
+	return RcSetup(val[0], val[1], val[2])?2:0;
+}
+
+/************************************************************************//**
+ * \brief Formats a decimal number.
+ *
+ * \param[out] p   Buffer receiving the number (not terminated).
+ * \param[in]  val Value to format.
+ *
+ * \return Pointer to the character following the number.
+ ****************************************************************************/
+static char *RcNumFormat(char *p, WORD val)
+{
+	char tmp[5];
+	BYTE i = 0;
+
+	do {
+		tmp[i++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	while (i) *p++ = tmp[--i];
+	return p;
+}
+
+/************************************************************************//**
+ * \brief Formats the current settings as a configuration line.
+ *
+ * \param[out] line Buffer of RC_LINE_LEN characters receiving the null
+ *             terminated line, without line ending. Empty if detection is
+ *             disabled.
+ ****************************************************************************/
+void RcCfgFormat(char line[])
+{
+	char *p;
+
+	line[0] = '\0';
+	if (!rcCalls) return;
+	strcpy(line, rcTag);
+	p = RcNumFormat(line + strlen(line), rcCalls);
+	*p++ = ' ';
+	p = RcNumFormat(p, rcWindow);
+	*p++ = ' ';
+	p = RcNumFormat(p, rcBlock);
+	*p = '\0';
+}
+
+/************************************************************************//**
+ * \brief Records a call, and tells if the number is blocked. The call
+ * that reaches the configured rate is already blocked.
+ *
+ * \param[in] key Packed canonical number of the caller.
+ *
+ * \return TRUE if the number is blocked, FALSE otherwise.
+ ****************************************************************************/
+char RcCall(const BYTE key[])
+{
+	RcEntry *e, *lru;
+	DWORD now, blockEnd;
+	BYTE i;
+	char blocked;
+
+	if (!rcCalls) return FALSE;
+	now = RtcYearMinutes();
+
+	/// Look for the caller, keeping track of the least recently used entry
+	for (i = 0, e = lru = rc; i < RC_SLOTS; i++, e++)
+	{
+		if (!TnCmp(e->key, key)) break;
+		if ((0xFF == e->key[0]) ||
+			((0xFF != lru->key[0]) && (e->call[0] < lru->call[0]))) lru = e;
+	}
+	if (i == RC_SLOTS)
+	{
+		e = lru;
+		memcpy(e->key, key, TN_PACK_LEN);
+		e->nCalls = 0;
+		e->blockEnd = 0;
+		rcDirty = TRUE;
+	}
+	blockEnd = e->blockEnd;
+	/// Discard times in the future
+	if (e->nCalls && (e->call[0] > now))
+	{
+		e->nCalls = 0;
+		e->blockEnd = 0;
+	}
+
+	/// Record the call
+	for (i = RC_HIST - 1; i; i--) e->call[i] = e->call[i - 1];
+	e->call[0] = now;
+	if (e->nCalls < RC_HIST) e->nCalls++;
+
+	/// Check if blocking has expired, or if the number must be blocked
+	blocked = e->blockEnd && (now < e->blockEnd);
+	if (!blocked)
+	{
+		e->blockEnd = 0;
+		if ((e->nCalls >= rcCalls) &&
+			((now - e->call[rcCalls - 1]) < rcWindow))
+		{
+			e->blockEnd = now + rcBlock;
+			blocked = TRUE;
+		}
+	}
+	/// Only save the new call times if the block state changed
+	if (e->blockEnd != blockEnd) rcDirty = TRUE;
+
+	return blocked;
+}
+
+/************************************************************************//**
+ * \brief Saves the table and the settings to data EEPROM, if they changed.
+ *
+ * \warning Each written EEPROM row stalls the CPU for a few milliseconds,
+ * so avoid calling this while attending a call.
+ ****************************************************************************/
+void RcSave(void)
+{
+	BYTE hdr[RC_EE_HDR_LEN];
+
+	if (!rcDirty) return;
+	ST_WORD(hdr + RC_EE_MAGIC, RC_MAGIC);
+	ST_WORD(hdr + RC_EE_VERSION, RC_VERSION);
+	ST_WORD(hdr + RC_EE_CALLS, rcCalls);
+	ST_WORD(hdr + RC_EE_WINDOW, rcWindow);
+	ST_WORD(hdr + RC_EE_BLOCK, rcBlock);
+	ST_WORD(hdr + RC_EE_CRC, RcCrc(hdr));
+	EeWrite(EE_RC_OFS + RC_EE_HDR_LEN, rc, sizeof(rc));
+	EeWrite(EE_RC_OFS, hdr, RC_EE_HDR_LEN);
+	rcDirty = FALSE;
+}
@@ -0,0 +1,132 @@
+/************************************************************************//**
+ * \file  rep_call.h
+ * \brief Repeat caller detection.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _REP_CALL_H_
+#define _REP_CALL_H_
+
+#include "types.h"
+#include "tel_num.h"
+
+/** \defgroup rep_call_api rep_call
+ *
+ * Repeat caller detection. Keeps the times of the last calls from the most
+ * recent callers in a small table, keyed on the packed canonical number
+ * (see tel_num.h). When a number calls a configured number of times within a sliding
+ * window, it is automatically blocked for a while. The least recently used
+ * entry is replaced when a new number calls and the table is full. The
+ * table and the settings are kept in data EEPROM, so they survive reboots.
+ * To spare EEPROM writes, the table is only marked for saving when a
+ * caller is added or replaced, or a number is blocked or unblocked. The
+ * other call times are saved along with the next change, so a few of them
+ * may be lost on a reset.
+ *
+ * Times are minutes since the start of the year, as given by the RTC.
+ * Times in the future (when the clock is set back, or a new year starts)
+ * are discarded.
+ *
+ * Detection is enabled with a configuration line like:
+ *
+ *     REPEAT_BLOCK=4 60 1440
+ *
+ * holding the number of calls (2 to RC_HIST, 0 disables detection), the
+ * window length in minutes (1 to RC_MAX_WINDOW) and the time the number is
+ * blocked, in minutes (1 to 65535).
+ * \{ */
+
+/// Number of callers tracked
+#define RC_SLOTS		8
+/// Number of call times kept for each caller. Maximum number of calls
+/// that can be set to trigger blocking.
+#define RC_HIST			6
+/// Maximum window length in minutes (one day)
+#define RC_MAX_WINDOW	1440
+/// Maximum length of the configuration line, including the terminating '\0'
+#define RC_LINE_LEN		32
+
+/// Table magic number ("RC")
+#define RC_MAGIC		0x4352
+/// Table format version
+#define RC_VERSION		1
+
+/************************************************************************//**
+ * \brief Module initialization. Loads the table and the settings from data
+ * EEPROM. If they are not valid, detection is disabled and the table is
+ * cleared.
+ ****************************************************************************/
+void RcInit(void);
+
+/************************************************************************//**
+ * \brief Sets the detection parameters. Calls already in the table are
+ * kept.
+ *
+ * \param[in] calls  Calls needed to block a number (0 disables detection).
+ * \param[in] window Window length in minutes.
+ * \param[in] block  Minutes the number is blocked.
+ *
+ * \return 0 if OK, nonzero if the parameters are out of range (settings
+ * are not changed).
+ ****************************************************************************/
+char RcSetup(WORD calls, WORD window, WORD block);
+
+/************************************************************************//**
+ * \brief Parses a REPEAT_BLOCK configuration line. The line ends with the
+ * first '\0', '\r' or '\n' character found.
+ *
+ * \param[in] line Configuration line.
+ *
+ * \return 0 if the settings were changed, 1 if the line is not a
+ * REPEAT_BLOCK line, 2 if it is not valid.
+ ****************************************************************************/
+char RcCfgParse(const char line[]);
+
+/************************************************************************//**
+ * \brief Formats the current settings as a configuration line.
+ *
+ * \param[out] line Buffer of RC_LINE_LEN characters receiving the null
+ *             terminated line, without line ending. Empty if detection is
+ *             disabled.
+ ****************************************************************************/
+void RcCfgFormat(char line[]);
+
+/************************************************************************//**
+ * \brief Records a call, and tells if the number is blocked. The call
+ * that reaches the configured rate is already blocked.
+ *
+ * \param[in] key Packed canonical number of the caller.
+ *
+ * \return TRUE if the number is blocked, FALSE otherwise.
+ ****************************************************************************/
+char RcCall(const BYTE key[]);
+
+/************************************************************************//**
+ * \brief Saves the table and the settings to data EEPROM, if they changed.
+ *
+ * \warning Each written EEPROM row stalls the CPU for a few milliseconds,
+ * so avoid calling this while attending a call.
+ ****************************************************************************/
+void RcSave(void);
+
+/** \} */
+
+#endif /*_REP_CALL_H_*/
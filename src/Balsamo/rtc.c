@@ -159,6 +159,70 @@ void RtcGetDate(WORD *year, BYTE *month, BYTE *day)
 	_EI();
 }
 
+/************************************************************************//**
+ * \brief Gets date and time at once, so they are consistent if the clock
+ * ticks while reading them.
+ *
+ * \param[out] year  Year.
+ * \param[out] month Month.
+ * \param[out] day   Day.
+ * \param[out] hour  Hour.
+ * \param[out] min   Minute.
+ * \param[out] sec   Second.
+ ****************************************************************************/
+void RtcGetDateTime(WORD *year, BYTE *month, BYTE *day, BYTE *hour, BYTE *min,
+		BYTE *sec)
+{
+	_DI();
+
+	*year = 1980 + rtcYear;
+	*month = rtcMon;
+	*day = rtcMday;
+	*hour = rtcHour;
+	*min = rtcMin;
+	*sec = rtcSec;
+
+	_EI();
+}
+
+/************************************************************************//**
+ * \brief Computes the day of the week of a date, e.g. one read along with
+ * the time by RtcGetDateTime().
+ *
+ * \param[in] year  Year.
+ * \param[in] month Month (1 ~ 12).
+ * \param[in] day   Day (1 ~ 31).
+ *
+ * \return Day of the week, from 0 (Monday) to 6 (Sunday).
+ ****************************************************************************/
+BYTE RtcWeekDay(WORD year, BYTE month, BYTE day)
+{
+	static const BYTE monOfs[12] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+
+	/// Sakamoto's method, that gives 0 for Sunday
+	if (month < 3) year--;
+	return (year + year / 4 - year / 100 + year / 400 + monOfs[month - 1] +
+			day + 6) % 7;
+}
+
+/************************************************************************//**
+ * \brief Gets the minutes elapsed since the start of the year.
+ *
+ * \return Minutes since January 1st, 00:00.
+ ****************************************************************************/
+DWORD RtcYearMinutes(void)
+{
+	static const WORD yearDay[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243,
+		273, 304, 334};
+	WORD year, day;
+	BYTE mon, mday, hour, min, sec;
+
+	RtcGetDateTime(&year, &mon, &mday, &hour, &min, &sec);
+	day = yearDay[mon - 1] + mday - 1;
+	if ((mon > 2) && !(year & 3)) day++;
+	return (DWORD)day * 1440 + (WORD)hour * 60 + min;
+}
+
 /************************************************************************//**
  * \brief Get timestamp formatted for fatfs
  *
@@ -75,6 +75,39 @@ void RtcGetTime(BYTE *hour, BYTE *min, BYTE *sec);
  ****************************************************************************/
 void RtcGetDate(WORD *year, BYTE *month, BYTE *day);
 
+/************************************************************************//**
+ * \brief Gets date and time at once, so they are consistent if the clock
+ * ticks while reading them.
+ *
+ * \param[out] year  Year.
+ * \param[out] month Month.
+ * \param[out] day   Day.
+ * \param[out] hour  Hour.
+ * \param[out] min   Minute.
+ * \param[out] sec   Second.
+ ****************************************************************************/
+void RtcGetDateTime(WORD *year, BYTE *month, BYTE *day, BYTE *hour, BYTE *min,
+		BYTE *sec);
+
+/************************************************************************//**
+ * \brief Computes the day of the week of a date, e.g. one read along with
+ * the time by RtcGetDateTime().
+ *
+ * \param[in] year  Year.
+ * \param[in] month Month (1 ~ 12).
+ * \param[in] day   Day (1 ~ 31).
+ *
+ * \return Day of the week, from 0 (Monday) to 6 (Sunday).
+ ****************************************************************************/
+BYTE RtcWeekDay(WORD year, BYTE month, BYTE day);
+
+/************************************************************************//**
+ * \brief Gets the minutes elapsed since the start of the year.
+ *
+ * \return Minutes since January 1st, 00:00.
+ ****************************************************************************/
+DWORD RtcYearMinutes(void);
+
 /************************************************************************//**
  * \brief Get timestamp formatted for fatfs
  *
@@ -0,0 +1,229 @@
+/************************************************************************//**
+ * \file  sched.c
+ * \brief Filtering policy schedule.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \note This module does not depend on the hardware, and is also built by
+ * the host tools.
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sched.h"
+#include "tel_filt.h"
+#include <string.h>
+
+/// Schedule line directive
+static const char schedTag[] = "SCHEDULE=";
+/// Filter mode names, indexed by TF_MODE_* value
+static const char * const schedModes[] = {
+	"BLACKLIST", "WHITELIST", "ALLOW_ALL"
+};
+/// Hidden numbers policy names, indexed by policy value
+static const char * const schedHidden[] = {
+	"ALLOW_UNKNOWN", "BLACKLIST_UNKNOWN"
+};
+/// Days of the week, as written in schedule lines
+static const char schedDays[] = "MTWTFSS";
+
+/************************************************************************//**
+ * \brief Tells if a character ends a schedule line field.
+ *
+ * \param[in] c Character to check.
+ *
+ * \return TRUE if c is a blank or ends the line, FALSE otherwise.
+ ****************************************************************************/
+static char SchedFieldEnd(char c)
+{
+	return !c || (' ' == c) || ('\t' == c) || ('\r' == c) || ('\n' == c);
+}
+
+/************************************************************************//**
+ * \brief Skips blanks between fields.
+ *
+ * \param[in] p Pointer to the line being parsed.
+ *
+ * \return Pointer to the next non blank character.
+ ****************************************************************************/
+static const char *SchedSkip(const char *p)
+{
+	while ((' ' == *p) || ('\t' == *p)) p++;
+	return p;
+}
+
+/************************************************************************//**
+ * \brief Parses a "HH:MM" time field.
+ *
+ * \param[in]  p   Pointer to the field.
+ * \param[out] min Minutes after midnight.
+ *
+ * \return Pointer to the character following the field, or NULL if the
+ * field is not valid.
+ ****************************************************************************/
+static const char *SchedTime(const char *p, WORD *min)
+{
+	BYTE i;
+
+	for (i = 0; i < 5; i++)
+		if ((2 == i)?(':' != p[i]):((p[i] < '0') || (p[i] > '9'))) return NULL;
+	*min = ((p[0] - '0') * 10 + p[1] - '0') * 60 + (p[3] - '0') * 10 +
+		p[4] - '0';
+	if ((p[0] > '2') || ((p[0] == '2') && (p[1] > '3')) || (p[3] > '5'))
+		return NULL;
+	return p + 5;
+}
+
+/************************************************************************//**
+ * \brief Parses a field holding one of several words, or '-'.
+ *
+ * \param[in]  p     Pointer to the field.
+ * \param[in]  words Accepted words.
+ * \param[in]  n     Number of accepted words.
+ * \param[out] val   Index of the word found, or SCHED_KEEP for '-'.
+ *
+ * \return Pointer to the character following the field, or NULL if the
+ * field is not valid.
+ ****************************************************************************/
+static const char *SchedWord(const char *p, const char * const words[],
+		BYTE n, BYTE *val)
+{
+	BYTE i, len;
+
+	if (('-' == p[0]) && SchedFieldEnd(p[1]))
+	{
+		*val = SCHED_KEEP;
+		return p + 1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		len = strlen(words[i]);
+		if (!strncmp(p, words[i], len) && SchedFieldEnd(p[len]))
+		{
+			*val = i;
+			return p + len;
+		}
+	}
+	return NULL;
+}
+
+/************************************************************************//**
+ * \brief Parses a schedule line (see sched.h). The line ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  line Configuration line.
+ * \param[out] rec  Buffer of SCHED_REC_LEN bytes receiving the record.
+ *
+ * \return 0 if OK, 1 if the line is not a schedule line, 2 if it is not
+ * valid.
+ ****************************************************************************/
+char SchedParse(const char line[], BYTE rec[])
+{
+	const char *p = line + sizeof(schedTag) - 1;
+	WORD start, end;
+	BYTE i, mode, hidden;
+
+	if (strncmp(line, schedTag, sizeof(schedTag) - 1)) return 1;
+
+	/// Active days
+	for (i = 0, rec[SCHED_REC_DAYS] = 0; i < 7; i++, p++)
+	{
+		if (SchedFieldEnd(*p)) return 2;
+		if ('-' != *p) rec[SCHED_REC_DAYS] |= 1<<i;
+	}
+	/// Time range
+	if (!SchedFieldEnd(*p) || !(p = SchedTime(SchedSkip(p), &start)) ||
+		('-' != *p) || !(p = SchedTime(p + 1, &end))) return 2;
+	/// Filter mode and hidden numbers policy
+	if (!SchedFieldEnd(*p) ||
+		!(p = SchedWord(SchedSkip(p), schedModes, 3, &mode)) ||
+		!SchedFieldEnd(*p) ||
+		!(p = SchedWord(SchedSkip(p), schedHidden, 2, &hidden))) return 2;
+	p = SchedSkip(p);
+	if (*p && ('\r' != *p) && ('\n' != *p)) return 2;
+
+	rec[SCHED_REC_START] = start;
+	rec[SCHED_REC_START + 1] = start>>8;
+	rec[SCHED_REC_END] = end;
+	rec[SCHED_REC_END + 1] = end>>8;
+	rec[SCHED_REC_POLICY] = (hidden<<4) | mode;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Formats a time as "HH:MM".
+ *
+ * \param[out] p   Buffer receiving the time (5 characters, not terminated).
+ * \param[in]  min Minutes after midnight.
+ ****************************************************************************/
+static void SchedTimeFormat(char *p, WORD min)
+{
+	p[0] = '0' + min / 600;
+	p[1] = '0' + (min / 60) % 10;
+	p[2] = ':';
+	p[3] = '0' + (min % 60) / 10;
+	p[4] = '0' + min % 10;
+}
+
+/************************************************************************//**
+ * \brief Formats a packed schedule record as a configuration line.
+ *
+ * \param[in]  rec  Packed schedule record.
+ * \param[out] line Buffer of SCHED_LINE_LEN characters receiving the null
+ *             terminated line, without line ending.
+ ****************************************************************************/
+void SchedFormat(const BYTE rec[], char line[])
+{
+	char *p;
+	BYTE i;
+
+	strcpy(line, schedTag);
+	p = line + strlen(line);
+	for (i = 0; i < 7; i++)
+		*p++ = (rec[SCHED_REC_DAYS] & (1<<i))?schedDays[i]:'-';
+	*p++ = ' ';
+	SchedTimeFormat(p, rec[SCHED_REC_START] | (rec[SCHED_REC_START + 1]<<8));
+	p[5] = '-';
+	SchedTimeFormat(p + 6, rec[SCHED_REC_END] | (rec[SCHED_REC_END + 1]<<8));
+	p[11] = ' ';
+	p[12] = '\0';
+	strcat(line, (SCHED_KEEP == SchedMode(rec))?"-":
+			schedModes[SchedMode(rec)]);
+	strcat(line, " ");
+	strcat(line, (SCHED_KEEP == SchedHidden(rec))?"-":
+			schedHidden[SchedHidden(rec)]);
+}
+
+/************************************************************************//**
+ * \brief Tells if a schedule record is active at a given time.
+ *
+ * \param[in] rec  Packed schedule record.
+ * \param[in] wday Day of the week, from 0 (Monday) to 6 (Sunday).
+ * \param[in] min  Minutes after midnight.
+ *
+ * \return TRUE if the record is active, FALSE otherwise.
+ ****************************************************************************/
+char SchedMatch(const BYTE rec[], BYTE wday, WORD min)
+{
+	WORD start = rec[SCHED_REC_START] | (rec[SCHED_REC_START + 1]<<8);
+	WORD end = rec[SCHED_REC_END] | (rec[SCHED_REC_END + 1]<<8);
+
+	if (!(rec[SCHED_REC_DAYS] & (1<<wday))) return FALSE;
+	if (start == end) return TRUE;
+	if (start < end) return (min >= start) && (min < end);
+	/// Range wraps around midnight
+	return (min >= start) || (min < end);
+}
@@ -0,0 +1,106 @@
+/************************************************************************//**
+ * \file  sched.h
+ * \brief Filtering policy schedule.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "types.h"
+
+/** \defgroup sched_api sched
+ *
+ * Filtering policy schedule. Each schedule record sets the filter mode
+ * and/or the hidden numbers policy during a time range, on some days of the
+ * week. Records are written in the configuration file as lines like:
+ *
+ *     SCHEDULE=MTWTF-- 21:00-09:00 WHITELIST -
+ *
+ * The first field has one character per day, from Monday to Sunday. A '-'
+ * means the record is not active that day. Then the time range comes: the
+ * record is active from the start time, up to (not including) the end
+ * time. If the end time is before the start time, the range wraps around
+ * midnight, and if both are the same, the record is active the whole day.
+ * The last fields are the filter mode (BLACKLIST, WHITELIST or ALLOW_ALL)
+ * and the hidden numbers policy (BLACKLIST_UNKNOWN or ALLOW_UNKNOWN). Any
+ * of them can be '-', to keep the value set by previous records or by the
+ * first two lines of the configuration file.
+ *
+ * Records are stored packed in SCHED_REC_LEN bytes (multi-byte fields are
+ * little endian), so they can be copied to the configuration image and the
+ * EEPROM snapshot.
+ * \{ */
+
+/// Maximum number of schedule records
+#define SCHED_MAX			8
+/// Length of a packed schedule record
+#define SCHED_REC_LEN		6
+/// Maximum length of a schedule line, including the terminating '\0'
+#define SCHED_LINE_LEN		64
+
+#define SCHED_REC_DAYS		0	///< Active days, bit 0 is Monday (BYTE)
+#define SCHED_REC_START		1	///< Start, minutes after midnight (WORD)
+#define SCHED_REC_END		3	///< End, minutes after midnight (WORD)
+#define SCHED_REC_POLICY	5	///< Mode (low nibble), hidden (high nibble)
+
+/// Policy nibble value keeping the current setting
+#define SCHED_KEEP			0x0F
+/// Gets the filter mode of a packed record (TF_MODE_* or SCHED_KEEP)
+#define SchedMode(rec)		((rec)[SCHED_REC_POLICY] & 0x0F)
+/// Gets the hidden policy of a packed record (TRUE to block hidden numbers,
+/// FALSE to allow them, or SCHED_KEEP)
+#define SchedHidden(rec)	((rec)[SCHED_REC_POLICY]>>4)
+
+/************************************************************************//**
+ * \brief Parses a schedule line (see above). The line ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  line Configuration line.
+ * \param[out] rec  Buffer of SCHED_REC_LEN bytes receiving the record.
+ *
+ * \return 0 if OK, 1 if the line is not a schedule line, 2 if it is not
+ * valid.
+ ****************************************************************************/
+char SchedParse(const char line[], BYTE rec[]);
+
+/************************************************************************//**
+ * \brief Formats a packed schedule record as a configuration line.
+ *
+ * \param[in]  rec  Packed schedule record.
+ * \param[out] line Buffer of SCHED_LINE_LEN characters receiving the null
+ *             terminated line, without line ending.
+ ****************************************************************************/
+void SchedFormat(const BYTE rec[], char line[]);
+
+/************************************************************************//**
+ * \brief Tells if a schedule record is active at a given time.
+ *
+ * \param[in] rec  Packed schedule record.
+ * \param[in] wday Day of the week, from 0 (Monday) to 6 (Sunday).
+ * \param[in] min  Minutes after midnight.
+ *
+ * \return TRUE if the record is active, FALSE otherwise.
+ ****************************************************************************/
+char SchedMatch(const BYTE rec[], BYTE wday, WORD min);
+
+/** \} */
+
+#endif /*_SCHED_H_*/
@@ -62,7 +62,8 @@ typedef enum
 	SYS_KEY_ESC,            ///< ESC keyboard event
 	SYS_KEY_FN,             ///< FN keboard event (unused)
 	SYS_SLEEP_TIM,			///< Sleep timer event
-	SYS_RTC_MINUTE			///< RTC has incremented a minute
+	SYS_RTC_MINUTE,			///< RTC has incremented a minute
+	SYS_CFG_SYNC			///< Reconcile configuration with the SD card
 } SysEvent;
 
 /// System status
@@ -24,26 +24,66 @@
  */
 
 #include "tel_filt.h"
-#include "fatfs/ff.h"
+#include "num_idx.h"
+#include "num_flash.h"
+#include "crc.h"
+#include "eeprom.h"
+#include "rtc.h"
+#include "rep_call.h"
+#include "fatfs/ff.h"
 #include <string.h>
-
-/// Length of the phone book
-#define TF_BUFLEN	1024
 
-/// Telephone numbers black/white-listed
-static char nums[TF_BUFLEN];
+/// Text file reader state (see TfRdLine())
+typedef struct
+{
+	FIL *f;			///< File being read
+	BYTE *buf;		///< Chunk buffer, TF_RD_CHUNK bytes long
+	WORD pos;		///< Position of the next character in buf
+	WORD len;		///< Number of characters in buf
+	WORD line;		///< Number of the last line read
+	char eol;		///< TRUE if the last line read had a line ending
+	char trunc;		///< TRUE if the last line read was truncated
+} TfReader;
+
+/// Telephone numbers black/white-listed, normalized and packed
+static BYTE book[TF_BOOK_NUMS][TN_PACK_LEN];
+/// Action of each number in the phone book (see call_act.h)
+static BYTE bookAct[TF_BOOK_NUMS];
+/// Action of each list, indexed by CA_LIST_* value
+static BYTE listAct[CA_LIST_NUM];
+/// Number returned by the TfNumGet* functions, in canonical text form
+static char bookNum[TN_MAX_DIGITS + 2];
 /// Blacklist/whitelist mode
-static char mode;
-/// End of the phone book
-static unsigned char end;
+static char mode;
+/// Numbers in the phone book
+static WORD end;
 /// Current position to read in the phone book
-static unsigned char readPos;
+static WORD readPos;
 /// Temporary stores phone book position
-static unsigned char pos;
+static WORD pos;
 /// FALSE if hidden callers should be allowed
 static char filtHidden;
-/// TRUE if call filter is disabled
-static char filtDisabled;
+/// Schedule records (see sched.h)
+static BYTE sched[SCHED_MAX][SCHED_REC_LEN];
+/// Number of schedule records
+static WORD nSched;
+/// Filter mode currently active, as set by the schedule
+static char actMode;
+/// Hidden numbers policy currently active, as set by the schedule
+static char actHidden;
+/// TRUE if call filter is disabled. Kept when the configuration is reloaded.
+static char filtDisabled = FALSE;
+/// Journal records not saved yet
+static char jnl[TF_JNL_PEND_LEN];
+/// Length of the journal records not saved yet
+static WORD jnlLen;
+/// TRUE if changes did not fit in jnl, so the whole configuration file
+/// must be rewritten
+static char jnlFull;
+/// Lines of the text configuration file rejected by the last parse
+static WORD nRej;
+/// Numbers of the first rejected lines
+static WORD rejLine[TF_REJ_MAX];
 
 /************************************************************************//**
  * \brief Module initialization. Must be called before using any other
@@ -55,67 +95,192 @@ static char filtDisabled;
 void TfInit(char filterMode)
 {
 	mode = filterMode;
-	nums[0] = '\0';
+	actMode = filterMode;
+	nSched = 0;
+	memset(listAct, CA_DEFAULT, CA_LIST_NUM);
 	end = 0;
 	readPos = 0;
-	filtDisabled = FALSE;
+	jnl[0] = '\0';
+	jnlLen = 0;
+	jnlFull = FALSE;
 }
 
-/************************************************************************//**
- * \brief Adds a number to the phone book
- *
- * \param[in] number Telephone number to add to the phone book.
- *
- * \return 0 if OK, nonzero otherwise.
- ****************************************************************************/
-char TfNumAdd(char number[])
+/************************************************************************//**
+ * \brief Converts a packed number to canonical text form: the canonical
+ * digits preceded by '+'. This form is normalized again to the same packed
+ * number, whatever the normalization settings are.
+ *
+ * \param[in] key Packed number.
+ *
+ * \return The number in canonical text form. It is overwritten by the next
+ * call.
+ ****************************************************************************/
+static char *TfNumText(const BYTE key[])
+{
+	bookNum[0] = '+';
+	TnUnpack(key, bookNum + 1);
+	return bookNum;
+}
+
+/************************************************************************//**
+ * \brief Adds a record to the journal records not saved yet.
+ *
+ * \param[in] op  Either '+' for added numbers or '-' for deleted ones.
+ * \param[in] key Changed packed telephone number.
+ ****************************************************************************/
+static void TfJnlRecord(char op, const BYTE key[])
 {
-	char numLen = strlen(number);
+	char *number = TfNumText(key);
+	WORD len = strlen(number);
 
-	/// Remove the '\n' ending character
-	if ('\n' == number[numLen - 1]) number[numLen - 1] = '\0';
-	else numLen++;
-	/// Check the number fits the buffer
-	if ((end + numLen) > TF_BUFLEN) return 1;
-	/// Copy the number and update end position
-	strcpy(&nums[end], number);
-	end += numLen;
+	/// Operation, number, '\n' and '\0' must fit
+	if ((jnlLen + len + 3) > TF_JNL_PEND_LEN)
+	{
+		jnlFull = TRUE;
+		return;
+	}
+	jnl[jnlLen++] = op;
+	strcpy(jnl + jnlLen, number);
+	jnlLen += len;
+	jnl[jnlLen++] = '\n';
+	jnl[jnlLen] = '\0';
+}
+
+/************************************************************************//**
+ * \brief Searches a number in the RAM phone book. As numbers are stored
+ * normalized, each entry is checked with a single compare.
+ *
+ * \param[in] key Packed canonical telephone number to search.
+ *
+ * \return Position of the number in the phone book, or end if not found.
+ ****************************************************************************/
+static WORD TfNumFind(const BYTE key[])
+{
+	WORD i;
+
+	for (i = 0; (i < end) && TnCmp(book[i], key); i++);
+	return i;
+}
+
+/************************************************************************//**
+ * \brief Removes a number from the RAM phone book.
+ *
+ * \param[in] i Position of the number to remove.
+ ****************************************************************************/
+static void TfNumCut(WORD i)
+{
+	end--;
+	memmove(book[i], book[i + 1], (end - i) * TN_PACK_LEN);
+	memmove(bookAct + i, bookAct + i + 1, end - i);
+}
+
+/************************************************************************//**
+ * \brief Adds a number to the RAM phone book, without recording the change
+ * in the journal.
+ *
+ * \param[in] key Packed canonical telephone number to add.
+ * \param[in] act Action of the number.
+ *
+ * \return 0 if OK, nonzero if the phone book is full.
+ ****************************************************************************/
+static char TfNumInsert(const BYTE key[], BYTE act)
+{
+	/// Check the number fits the phone book
+	if (end >= TF_BOOK_NUMS) return 1;
+	bookAct[end] = act;
+	memcpy(book[end++], key, TN_PACK_LEN);
 
 	return 0;
 }
 
 /************************************************************************//**
- * \brief Checks if a telephone number is blacklisted.
- *
- * \param[in] number Telephone number to check.
+ * \brief Adds a number to the phone book, with the default action. The
+ * change is saved by the next TfCfgSave() call.
  *
+ * \param[in] number Telephone number to add to the phone book. It is
+ *            normalized before storing it (see tel_num.h).
+ *
+ * \return 0 if OK, nonzero if the number is not valid or the phone book
+ * is full.
+ ****************************************************************************/
+char TfNumAdd(char number[])
+{
+	BYTE key[TN_PACK_LEN];
+	char retVal;
+
+	if (TnPackNorm(number, key)) return 1;
+	if (!(retVal = TfNumInsert(key, CA_DEFAULT))) TfJnlRecord('+', key);
+	return retVal;
+}
+
+/************************************************************************//**
+ * \brief Checks if a telephone number is blacklisted. The number is first
+ * searched in the RAM phone book, then in the on-card index (if any, and
+ * not copied to the flash list), and then in the flash list. Numbers with
+ * an action follow it, other numbers follow the filter mode (see
+ * call_act.h). Numbers allowed and not whitelisted are passed to the
+ * repeat caller detector.
+ *
+ * \param[in]  key Packed canonical telephone number to check (see
+ *             TnPackNorm()), or NULL if the number could not be normalized.
+ * \param[out] act Action to take if the call is rejected: the action of
+ *             the number, or the action of the list rejecting it.
+ *
  * \return TF_NUM_OK if the number is allowed, TF_NUM_REJECT if the number
- * is blacklisted (or not in the whitelist), TF_NUM_FILTER_DISABLED if the
- * number should be rejected, but call filter is disabled.
- ****************************************************************************/
-char TfNumCheck(char number[])
+ * is blacklisted (or not in the whitelist), TF_NUM_REPEAT if the number
+ * is calling too often, TF_NUM_FILTER_DISABLED if the number should be
+ * rejected, but call filter is disabled.
+ ****************************************************************************/
+char TfNumCheck(const BYTE key[], BYTE *act)
 {
-	int i = 0;
+	char found = FALSE;
+	WORD i;
 
-	// Search number
-	while ((i < end) && strcmp(&nums[i], number))
-		i += strlen(&nums[i]) + 1;
+	// Search number in the RAM phone book, then in the on-card index (if
+	// any) and the flash list. Actions apply in every filter mode, so the
+	// number is searched even if all are allowed.
+	*act = CA_DEFAULT;
+	if (key)
+	{
+		if ((i = TfNumFind(key)) < end)
+		{
+			found = TRUE;
+			*act = bookAct[i];
+		}
+		else found = NidxFind(key, act) || NflFind(key);
+	}
 
-	if (i < end)
+	if (found)
 	{
-		// Number found
-		if (TF_MODE_BLACKLIST == mode)
-			return filtDisabled?TF_FILTER_DISABLED:TF_NUM_REJECT;
-		else return TF_NUM_OK;
+		// Number found. Its action decides, or the mode if it has none.
+		if (CA_RING == *act) return TF_NUM_OK;
+		if (CA_DEFAULT == *act)
+		{
+			if (TF_MODE_BLACKLIST != actMode) return TF_NUM_OK;
+			*act = listAct[CA_LIST_REJECT];
+		}
+		return filtDisabled?TF_FILTER_DISABLED:TF_NUM_REJECT;
 	}
 
 	// Number not found
-	if (TF_MODE_BLACKLIST == mode) return TF_NUM_OK;
-	else return filtDisabled?TF_FILTER_DISABLED:TF_NUM_REJECT;
+	if (TF_MODE_WHITELIST == actMode)
+	{
+		*act = listAct[CA_LIST_REJECT];
+		return filtDisabled?TF_FILTER_DISABLED:TF_NUM_REJECT;
+	}
+	// Allowed, unless it is calling too often
+	if (key && RcCall(key))
+	{
+		*act = listAct[CA_LIST_REPEAT];
+		return filtDisabled?TF_FILTER_DISABLED:TF_NUM_REPEAT;
+	}
+	return TF_NUM_OK;
 }
 
 /************************************************************************//**
- * \brief Gets the first number stored in the telephone book.
+ * \brief Gets the first number stored in the telephone book. Numbers are
+ * returned in canonical form, preceded by '+', and are overwritten by the
+ * next TfNumGet* call.
  *
  * \return The first number stored in the telephone book, or NULL if there
  * is no one.
@@ -139,9 +304,8 @@ char *TfNumGetNext(void)
 	if (readPos >= end) return NULL;
 
 	/// Advance one number
-	pos = readPos;
-	readPos += strlen(nums + readPos) + 1;
-	return nums + pos;
+	pos = readPos++;
+	return TfNumText(book[pos]);
 }
 
 /************************************************************************//**
@@ -155,81 +319,561 @@ char* TfNumGetPrev(void)
 	/// Check we are not at the beginning
 	if (0 == pos) return NULL;
 
-	readPos = pos;
-	pos -= 2;	// Skip ending '\0' from previous number
-	while (nums[pos - 1] && (pos > 0)) pos--;
-	return nums + pos;
+	readPos = pos--;
+	return TfNumText(book[pos]);
 }
 
 /************************************************************************//**
  * \brief Deletes the current telephone number from the telephone book.
+ * The change is saved by the next TfCfgSave() call.
  ****************************************************************************/
 void TfNumDelete(void)
 {
-	int i;
-
-	for (i = pos; readPos < end; i++, readPos++) nums[i] = nums[readPos];
-	end = i;
+	TfJnlRecord('-', book[pos]);
+	TfNumCut(pos);
+	readPos = pos;
 }
 
+/************************************************************************//**
+ * \brief Loads the compiled configuration image. The image is read
+ * sequentially in TN_PACK_LEN byte chunks, so each sector is read from the
+ * card only once. The body CRC is checked while numbers are added, and the
+ * phone book is cleared if it does not match. Images with more numbers
+ * than the phone book holds are not used, so the text parser reports the
+ * numbers left out. The normalization prefixes
+ * are only set once the whole image is valid. The rule table follows the
+ * numbers, so the actions are set once the numbers are in the phone book.
+ *
+ * \return 0 if OK, nonzero if the image is missing, stale, not valid or
+ * too big.
+ ****************************************************************************/
+static char TfLoadImage(void)
+{
+	FIL fImg;
+	FILINFO fi;
+	BYTE hdr[TF_IMG_HDR_LEN];
+	BYTE chunk[TN_PACK_LEN];
+	DWORD ofs, numOfs, numEnd, ruleOfs, ruleEnd, rule, size;
+	WORD crc, ruleLen;
+	UINT br;
+	BYTE i;
+
+	if (f_open(&fImg, TF_IMG_FILE, FA_READ | FA_OPEN_EXISTING)) return 1;
+	/// Read and check header
+	if (f_read(&fImg, hdr, TF_IMG_HDR_LEN, &br) || (br != TF_IMG_HDR_LEN) ||
+		memcmp(hdr + TF_IMG_HDR_MAGIC, TF_IMG_MAGIC, 4) ||
+		(LD_WORD(hdr + TF_IMG_HDR_VERSION) != TF_IMG_VERSION) ||
+		(LD_WORD(hdr + TF_IMG_HDR_HDRCRC) !=
+		 Crc16(CRC16_INIT, hdr, TF_IMG_HDR_HDRCRC)) ||
+		(hdr[TF_IMG_HDR_MODE] > TF_MODE_WHITELIST) ||
+		(f_size(&fImg) % TF_IMG_SECT_LEN) ||
+		(LD_WORD(hdr + TF_IMG_HDR_NSCHED) > SCHED_MAX))
+	{
+		f_close(&fImg);
+		return 2;
+	}
+	/// Image is stale if the text file has been edited after compiling it.
+	/// Some systems round the time to the next 2 seconds, others truncate
+	/// it, so it may be one step after the recorded one.
+	fi.lfname = NULL;
+	fi.lfsize = 0;
+	if (!f_stat(TF_CFG_FILE, &fi) &&
+		((fi.fsize != LD_DWORD(hdr + TF_IMG_HDR_SRCSIZE)) ||
+		 (fi.fdate != LD_WORD(hdr + TF_IMG_HDR_SRCDATE)) ||
+		 ((WORD)(fi.ftime - LD_WORD(hdr + TF_IMG_HDR_SRCTIME)) > 1)))
+	{
+		f_close(&fImg);
+		return 3;
+	}
+	size = f_size(&fImg);
+	numOfs = (DWORD)LD_WORD(hdr + TF_IMG_HDR_NUMSECT) * TF_IMG_SECT_LEN;
+	numEnd = numOfs + (DWORD)LD_WORD(hdr + TF_IMG_HDR_NNUMS) * TN_PACK_LEN;
+	ruleLen = LD_WORD(hdr + TF_IMG_HDR_RULELEN);
+	ruleOfs = (DWORD)LD_WORD(hdr + TF_IMG_HDR_RULESECT) * TF_IMG_SECT_LEN;
+	ruleEnd = ruleOfs + (DWORD)LD_WORD(hdr + TF_IMG_HDR_NRULES) * ruleLen;
+	if ((numOfs < TF_IMG_SECT_LEN) || (numEnd > size) ||
+		(ruleEnd > size) || ((ruleEnd > ruleOfs) && (ruleOfs < numEnd)) ||
+		(LD_WORD(hdr + TF_IMG_HDR_NNUMS) > TF_BOOK_NUMS))
+	{
+		f_close(&fImg);
+		return 2;
+	}
+
+	TfInit(hdr[TF_IMG_HDR_MODE]);
+	filtHidden = hdr[TF_IMG_HDR_HIDDEN]?TRUE:FALSE;
+	nSched = LD_WORD(hdr + TF_IMG_HDR_NSCHED);
+	memcpy(sched, hdr + TF_IMG_HDR_SCHED, nSched * SCHED_REC_LEN);
+	memcpy(listAct, hdr + TF_IMG_HDR_ACTS, CA_LIST_NUM);
+	/// Read the body, computing its CRC and adding numbers to the phone book
+	crc = CRC16_INIT;
+	ofs = TF_IMG_SECT_LEN;
+	if (!f_lseek(&fImg, ofs)) for (; ofs < size; ofs += TN_PACK_LEN)
+	{
+		if (f_read(&fImg, chunk, TN_PACK_LEN, &br) || (br != TN_PACK_LEN))
+			break;
+		crc = Crc16(crc, chunk, TN_PACK_LEN);
+		/// Numbers are already normalized, and known to fit in RAM
+		if ((ofs >= numOfs) && (ofs < numEnd)) TfNumInsert(chunk, CA_DEFAULT);
+		/// Rule record n holds the action of image number n, that is in
+		/// book[n]
+		if ((ofs + TN_PACK_LEN <= ruleOfs) || (ofs >= ruleEnd)) continue;
+		for (i = 0; i < TN_PACK_LEN; i++)
+		{
+			if ((ofs + i < ruleOfs) || (ofs + i >= ruleEnd)) continue;
+			rule = ofs + i - ruleOfs;
+			if (!(rule % ruleLen) && (rule / ruleLen < end))
+				bookAct[(WORD)(rule / ruleLen)] = chunk[i];
+		}
+	}
+	f_close(&fImg);
+	if ((ofs < size) || (crc != LD_WORD(hdr + TF_IMG_HDR_BODYCRC)) ||
+		TnNormSet(hdr + TF_IMG_HDR_NORM))
+	{
+		TfInit(TF_MODE_BLACKLIST);
+		return 4;
+	}
+	/// Settings out of range disable repeat caller detection
+	if (RcSetup(LD_WORD(hdr + TF_IMG_HDR_RCCALLS),
+			LD_WORD(hdr + TF_IMG_HDR_RCWINDOW),
+			LD_WORD(hdr + TF_IMG_HDR_RCBLOCK))) RcSetup(0, 0, 0);
+
+	return 0;
+}
+
 /// Temporal buffer length
-#define TMP_BUFLEN	20
-/************************************************************************//**
- * \brief Parses configuration file stored inside the microSD card. It
- * configures the blacklist/whitelist mode and adds previously stored
- * numbers to the phone book.
- *
- * \return 0 if OK, nonzero otherwise.
- ****************************************************************************/
-char TfParseConfig(void)
+#define TMP_BUFLEN	SCHED_LINE_LEN
+
+/************************************************************************//**
+ * \brief Starts reading a text file with TfRdLine().
+ *
+ * \param[out] rd  Reader state.
+ * \param[in]  f   Open file, positioned at its start.
+ * \param[in]  buf Chunk buffer, TF_RD_CHUNK bytes long.
+ ****************************************************************************/
+static void TfRdInit(TfReader *rd, FIL *f, BYTE buf[])
+{
+	rd->f = f;
+	rd->buf = buf;
+	rd->pos = rd->len = 0;
+	rd->line = 0;
+}
+
+/************************************************************************//**
+ * \brief Reads the next line of a text file. The file is read in
+ * TF_RD_CHUNK byte chunks, that are sector aligned, so f_read() transfers
+ * each sector straight from the card to the chunk buffer, and lines are
+ * then split from the buffer without further card accesses.
+ *
+ * \param[inout] rd   Reader state.
+ * \param[out]   line Buffer receiving the line, without line ending.
+ *               Lines longer than the buffer are truncated.
+ * \param[in]    max  Length of the line buffer.
+ *
+ * \return Pointer to the line, skipping leading blanks, with trailing
+ * blanks removed. NULL if there are no more lines.
+ ****************************************************************************/
+static char *TfRdLine(TfReader *rd, char line[], WORD max)
+{
+	WORD n = 0;
+	char c, eof = TRUE;
+	UINT br;
+
+	rd->eol = FALSE;
+	rd->trunc = FALSE;
+	while (TRUE)
+	{
+		/// Read the next chunk once the buffer has been parsed
+		if (rd->pos == rd->len)
+		{
+			rd->pos = rd->len = 0;
+			if (f_read(rd->f, rd->buf, TF_RD_CHUNK, &br) || !br) break;
+			rd->len = br;
+		}
+		eof = FALSE;
+		c = rd->buf[rd->pos++];
+		if ('\n' == c)
+		{
+			rd->eol = TRUE;
+			break;
+		}
+		if (n < (max - 1)) line[n++] = c;
+		else rd->trunc = TRUE;
+	}
+	if (eof) return NULL;
+
+	rd->line++;
+	while (n && ((' ' == line[n - 1]) || ('\t' == line[n - 1]) ||
+				('\r' == line[n - 1]))) n--;
+	line[n] = '\0';
+	while ((' ' == *line) || ('\t' == *line)) line++;
+	return line;
+}
+
+/************************************************************************//**
+ * \brief Records a rejected line of the text configuration file.
+ *
+ * \param[in] line Line number.
+ ****************************************************************************/
+static void TfReject(WORD line)
+{
+	if (nRej < TF_REJ_MAX) rejLine[nRej] = line;
+	nRej++;
+}
+
+/************************************************************************//**
+ * \brief Parses the text configuration file. Empty lines and lines
+ * starting with '#' are skipped, other lines not valid are recorded (see
+ * TfCfgRejects()).
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char TfParseText(void)
 {
 	/// FatFs file to store system configuration
 	/// \warning Test if making this file local can overflow stack.
 	FIL fCfg;
+	/// Chunk buffer. It is only needed while parsing, so it lives in the
+	/// stack instead of taking RAM all the time.
+	BYTE chunk[TF_RD_CHUNK];
+	TfReader rd;
 	BYTE retVal;
 	char tmpBuf[TMP_BUFLEN];
+	char *line;
+	BYTE key[TN_PACK_LEN];
+	BYTE rec[SCHED_REC_LEN];
+	BYTE act;
 
 	/// Open configuration file for reading
-	if ((retVal = f_open(&fCfg, "BALSAMO.CFG", FA_READ | FA_OPEN_EXISTING)))
+	if ((retVal = f_open(&fCfg, TF_CFG_FILE, FA_READ | FA_OPEN_EXISTING)))
 		return retVal;
+	TfRdInit(&rd, &fCfg, chunk);
 	/// First line is filter behaviour: either BLACKLIST or WHITELIST
-	if (!f_gets(tmpBuf, TMP_BUFLEN, &fCfg)) return 1;
-	if (!strcmp(tmpBuf, "BLACKLIST\n")) TfInit(TF_MODE_BLACKLIST);
-	else if (!strcmp(tmpBuf, "WHITELIST\n")) TfInit(TF_MODE_WHITELIST);
-	else return 2;
+	line = TfRdLine(&rd, tmpBuf, TMP_BUFLEN);
+	if (!line) retVal = 1;
+	else if (!strcmp(line, "BLACKLIST")) TfInit(TF_MODE_BLACKLIST);
+	else if (!strcmp(line, "WHITELIST")) TfInit(TF_MODE_WHITELIST);
+	else retVal = 2;
 	/// Second line is BLACKLIST_UNKNOWN to blacklist unknown numbers, or
 	/// ALLOW_UNKNOWN to allow unknown numbers
-	if (!f_gets(tmpBuf, TMP_BUFLEN, &fCfg)) return 1;
-	if (!strcmp(tmpBuf, "BLACKLIST_UNKNOWN\n")) filtHidden = TRUE;
-	else if(!strcmp(tmpBuf, "ALLOW_UNKNOWN\n")) filtHidden = FALSE;
-	else return 2;
+	if (!retVal)
+	{
+		line = TfRdLine(&rd, tmpBuf, TMP_BUFLEN);
+		if (!line) retVal = 1;
+		else if (!strcmp(line, "BLACKLIST_UNKNOWN")) filtHidden = TRUE;
+		else if(!strcmp(line, "ALLOW_UNKNOWN")) filtHidden = FALSE;
+		else retVal = 2;
+	}
+	if (retVal)
+	{
+		/// A missing line is reported as the line following the last one
+		TfReject(line?rd.line:rd.line + 1);
+		f_close(&fCfg);
+		return retVal;
+	}
 
-	/// Remaining lines are the filtered telephone numbers
-	while (f_gets(tmpBuf, TMP_BUFLEN, &fCfg))
+	/// Remaining lines are the filtered telephone numbers, each one followed
+	/// by its action, if any. Lines setting the normalization prefixes apply
+	/// to the numbers following them. Schedule and list action lines can be
+	/// anywhere. Repeat caller detection is disabled unless there is a line
+	/// enabling it.
+	TnNormReset();
+	RcSetup(0, 0, 0);
+	while ((line = TfRdLine(&rd, tmpBuf, TMP_BUFLEN)))
 	{
-		/// Add a number, checking for errors
-		/// \todo Enhance error handling (e.g. show a warning)
-		if (TfNumAdd(tmpBuf)) break;
+		if (!*line || ('#' == *line)) continue;
+		/// Truncated lines would be parsed wrong
+		if (rd.trunc)
+		{
+			TfReject(rd.line);
+			continue;
+		}
+		if ((1 != (retVal = TnPrefixParse(line))) ||
+			(1 != (retVal = RcCfgParse(line))) ||
+			(1 != (retVal = CaCfgParse(line, listAct))))
+		{
+			if (retVal) TfReject(rd.line);
+			continue;
+		}
+		if (1 != (retVal = SchedParse(line, rec)))
+		{
+			/// Records not fitting in the table are rejected too
+			if (!retVal && (nSched < SCHED_MAX))
+				memcpy(sched[nSched++], rec, SCHED_REC_LEN);
+			else TfReject(rd.line);
+			continue;
+		}
+		/// Add a number, with its action if any
+		if ((CA_INVALID == (act = CaParse(line))) || TnPackNorm(line, key))
+			TfReject(rd.line);
+		/// Numbers not fitting in the phone book are rejected
+		else if (TfNumInsert(key, act)) TfReject(rd.line);
 	}
 	f_close(&fCfg);
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Applies the changes in the journal to the phone book. The journal
+ * is deleted before a rewritten configuration file replaces the old one,
+ * so it is only applied over the file it was written for.
+ ****************************************************************************/
+static void TfJnlReplay(void)
+{
+	FIL fJnl;
+	BYTE chunk[TF_RD_CHUNK];
+	TfReader rd;
+	char tmpBuf[TMP_BUFLEN];
+	char *line;
+	BYTE key[TN_PACK_LEN];
+	WORD i;
+
+	if (f_open(&fJnl, TF_JNL_FILE, FA_READ | FA_OPEN_EXISTING)) return;
+	TfRdInit(&rd, &fJnl, chunk);
+	while ((line = TfRdLine(&rd, tmpBuf, TMP_BUFLEN)))
+	{
+		/// Records truncated by a power failure have no line ending
+		if (!rd.eol || rd.trunc || (strlen(line) < 2) ||
+				TnPackNorm(line + 1, key)) continue;
+		i = TfNumFind(key);
+		if (('+' == line[0]) && (i == end)) TfNumInsert(key, CA_DEFAULT);
+		else if (('-' == line[0]) && (i < end)) TfNumCut(i);
+	}
+	f_close(&fJnl);
+}
+
+/************************************************************************//**
+ * \brief Parses configuration file stored inside the microSD card. It
+ * configures the blacklist/whitelist mode and adds previously stored
+ * numbers to the phone book. The compiled image (TF_IMG_FILE) is loaded if
+ * available and valid, the text file (TF_CFG_FILE) is parsed otherwise.
+ * Then the changes in the journal (TF_JNL_FILE) are applied.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char TfParseConfig(void)
+{
+	FILINFO fi;
+	char retVal;
+
+	nRej = 0;
+	/// If power failed while replacing the configuration file, the new file
+	/// has not been renamed yet. It is complete, as the old one is deleted
+	/// only after closing it, and it already holds the journal changes.
+	fi.lfname = NULL;
+	fi.lfsize = 0;
+	if ((FR_NO_FILE == f_stat(TF_CFG_FILE, &fi)) && !f_stat(TF_TMP_FILE, &fi))
+	{
+		f_unlink(TF_JNL_FILE);
+		f_rename(TF_TMP_FILE, TF_CFG_FILE);
+	}
+	/// Fall back to the text file if the image cannot be used
+	if (TfLoadImage() && (retVal = TfParseText())) return retVal;
+	TfJnlReplay();
+	TfSchedUpdate();
+
+	/// Open the on-card number index. It is optional, so if it is missing
+	/// or not valid, only the RAM phone book is used. If the flash list
+	/// holds a copy of it, the index is not needed anymore. The flash list
+	/// cannot hold actions, so indexes with actions are kept open and used
+	/// from the card. In both cases, the flash copy of a previous index is
+	/// cleared, so its numbers are not found anymore.
+	if (NidxOpen(NIDX_FILE) || NidxHasActions()) NflClear();
+	else if (!NflSync(NIDX_FILE)) NidxClose();
 	return 0;
 }
 
 /************************************************************************//**
- * \brief Saves the current configuration and phone book to the SD card.
+ * \brief Gets the lines of the text configuration file rejected by the
+ * last TfParseConfig() call. Compiled images are checked by balcfg, so
+ * nothing is rejected when loading them.
+ *
+ * \param[out] lines Buffer of TF_REJ_MAX entries receiving the numbers of
+ *             the first rejected lines.
+ *
+ * \return Number of rejected lines. Only the first TF_REJ_MAX are stored
+ * in lines.
+ ****************************************************************************/
+WORD TfCfgRejects(WORD lines[])
+{
+	memcpy(lines, rejLine, (nRej < TF_REJ_MAX?nRej:TF_REJ_MAX) * sizeof(WORD));
+	return nRej;
+}
+
+/************************************************************************//**
+ * \brief Computes the CRC of the configuration and phone book contents.
+ *
+ * \return CRC16 of the filter mode, hidden numbers policy, normalization
+ * prefixes, list actions, schedule and phone book.
+ ****************************************************************************/
+static WORD TfBookCrc(void)
+{
+	BYTE cfg[3 + TN_NORM_LEN + CA_LIST_NUM];
+	WORD crc;
+
+	cfg[0] = mode;
+	cfg[1] = filtHidden;
+	cfg[2] = nSched;
+	TnNormGet(cfg + 3);
+	memcpy(cfg + 3 + TN_NORM_LEN, listAct, CA_LIST_NUM);
+	crc = Crc16(CRC16_INIT, cfg, sizeof(cfg));
+	crc = Crc16(crc, sched[0], nSched * SCHED_REC_LEN);
+	crc = Crc16(crc, book[0], end * TN_PACK_LEN);
+	return Crc16(crc, bookAct, end);
+}
+
+/************************************************************************//**
+ * \brief Loads the configuration snapshot stored in data EEPROM. Does not
+ * need the SD card.
+ *
+ * \return TF_SNAP_FULL if configuration and phone book were loaded,
+ * TF_SNAP_NO_NUMS if only the configuration was loaded (phone book is
+ * empty), or TF_SNAP_INVALID if the snapshot is not valid.
+ ****************************************************************************/
+char TfSnapLoad(void)
+{
+	BYTE hdr[TF_SNAP_HDR_LEN];
+	BYTE key[TN_PACK_LEN];
+	WORD i, n, ofs, crc;
+
+	EeRead(EE_TF_SNAP_OFS, hdr, TF_SNAP_HDR_LEN);
+	n = LD_WORD(hdr + TF_SNAP_HDR_NNUMS);
+	if ((LD_WORD(hdr + TF_SNAP_HDR_MAGIC) != TF_SNAP_MAGIC) ||
+		(LD_WORD(hdr + TF_SNAP_HDR_VERSION) != TF_SNAP_VERSION) ||
+		(LD_WORD(hdr + TF_SNAP_HDR_HDRCRC) !=
+		 Crc16(CRC16_INIT, hdr, TF_SNAP_HDR_HDRCRC)) ||
+		(hdr[TF_SNAP_HDR_MODE] > TF_MODE_WHITELIST) ||
+		(n > TF_SNAP_MAX_NUMS) ||
+		(LD_WORD(hdr + TF_SNAP_HDR_NSCHED) > SCHED_MAX) ||
+		TnNormSet(hdr + TF_SNAP_HDR_NORM)) return TF_SNAP_INVALID;
+
+	TfInit(hdr[TF_SNAP_HDR_MODE]);
+	filtHidden = hdr[TF_SNAP_HDR_HIDDEN]?TRUE:FALSE;
+	filtDisabled = hdr[TF_SNAP_HDR_DISABLE]?TRUE:FALSE;
+	nSched = LD_WORD(hdr + TF_SNAP_HDR_NSCHED);
+	memcpy(sched, hdr + TF_SNAP_HDR_SCHED, nSched * SCHED_REC_LEN);
+	memcpy(listAct, hdr + TF_SNAP_HDR_ACTS, CA_LIST_NUM);
+	TfSchedUpdate();
+	if (!(hdr[TF_SNAP_HDR_FLAGS] & TF_SNAP_F_NUMS)) return TF_SNAP_NO_NUMS;
+
+	/// Add numbers and then their actions, computing their CRC
+	crc = CRC16_INIT;
+	ofs = EE_TF_SNAP_OFS + TF_SNAP_NUMS;
+	for (i = 0; i < n; i++, ofs += TN_PACK_LEN)
+	{
+		EeRead(ofs, key, TN_PACK_LEN);
+		crc = Crc16(crc, key, TN_PACK_LEN);
+		if (TfNumInsert(key, CA_DEFAULT)) break;
+	}
+	if (i == n)
+	{
+		EeRead(EE_TF_SNAP_OFS + TF_SNAP_ACTS, bookAct, (n + 1) & ~1);
+		crc = Crc16(crc, bookAct, n);
+	}
+	if ((i < n) || (crc != LD_WORD(hdr + TF_SNAP_HDR_NUMSCRC)))
+	{
+		/// Keep the configuration, but clear the phone book
+		end = 0;
+		return TF_SNAP_NO_NUMS;
+	}
+
+	return TF_SNAP_FULL;
+}
+
+/************************************************************************//**
+ * \brief Updates the configuration snapshot in data EEPROM, if the current
+ * configuration or phone book differ from the stored ones.
+ ****************************************************************************/
+void TfSnapSave(void)
+{
+	BYTE hdr[TF_SNAP_HDR_LEN];
+	BYTE row[EE_ROW_LEN];
+	WORD i, n, pos, bookCrc, crc;
+
+	/// Repeat caller settings and table are kept apart
+	RcSave();
+	/// Nothing to do if the snapshot is up to date
+	bookCrc = TfBookCrc();
+	EeRead(EE_TF_SNAP_OFS, hdr, TF_SNAP_HDR_LEN);
+	if ((LD_WORD(hdr + TF_SNAP_HDR_MAGIC) == TF_SNAP_MAGIC) &&
+		(LD_WORD(hdr + TF_SNAP_HDR_VERSION) == TF_SNAP_VERSION) &&
+		(LD_WORD(hdr + TF_SNAP_HDR_HDRCRC) ==
+		 Crc16(CRC16_INIT, hdr, TF_SNAP_HDR_HDRCRC)) &&
+		(LD_WORD(hdr + TF_SNAP_HDR_BOOKCRC) == bookCrc) &&
+		(hdr[TF_SNAP_HDR_DISABLE] == (filtDisabled?TRUE:FALSE))) return;
+
+	/// Store numbers while they fit, a whole row at a time. Unchanged rows
+	/// are not written again.
+	memset(hdr, 0, TF_SNAP_HDR_LEN);
+	hdr[TF_SNAP_HDR_FLAGS] = TF_SNAP_F_NUMS;
+	crc = CRC16_INIT;
+	pos = 0;
+	/// Phone book is walked directly, to keep the UI read position
+	for (i = n = 0; i < end; i++, n++)
+	{
+		pos = (n * TN_PACK_LEN) % EE_ROW_LEN;
+		if (n == TF_SNAP_MAX_NUMS)
+		{
+			hdr[TF_SNAP_HDR_FLAGS] = 0;
+			n = pos = 0;
+			break;
+		}
+		memcpy(row + pos, book[i], TN_PACK_LEN);
+		crc = Crc16(crc, row + pos, TN_PACK_LEN);
+		pos += TN_PACK_LEN;
+		if (EE_ROW_LEN == pos)
+		{
+			EeWrite(EE_TF_SNAP_OFS + TF_SNAP_NUMS + (n + 1) * TN_PACK_LEN -
+					EE_ROW_LEN, row, EE_ROW_LEN);
+			pos = 0;
+		}
+	}
+	if (pos) EeWrite(EE_TF_SNAP_OFS + TF_SNAP_NUMS + n * TN_PACK_LEN - pos,
+			row, pos);
+	/// Actions are stored apart, as the phone book holds them
+	if (n)
+	{
+		EeWrite(EE_TF_SNAP_OFS + TF_SNAP_ACTS, bookAct, (n + 1) & ~1);
+		crc = Crc16(crc, bookAct, n);
+	}
+
+	ST_WORD(hdr + TF_SNAP_HDR_MAGIC, TF_SNAP_MAGIC);
+	ST_WORD(hdr + TF_SNAP_HDR_VERSION, TF_SNAP_VERSION);
+	hdr[TF_SNAP_HDR_MODE] = mode;
+	hdr[TF_SNAP_HDR_HIDDEN] = filtHidden?TRUE:FALSE;
+	hdr[TF_SNAP_HDR_DISABLE] = filtDisabled?TRUE:FALSE;
+	TnNormGet(hdr + TF_SNAP_HDR_NORM);
+	memcpy(hdr + TF_SNAP_HDR_ACTS, listAct, CA_LIST_NUM);
+	ST_WORD(hdr + TF_SNAP_HDR_NSCHED, nSched);
+	memcpy(hdr + TF_SNAP_HDR_SCHED, sched, nSched * SCHED_REC_LEN);
+	ST_WORD(hdr + TF_SNAP_HDR_NNUMS, n);
+	ST_WORD(hdr + TF_SNAP_HDR_BOOKCRC, bookCrc);
+	ST_WORD(hdr + TF_SNAP_HDR_NUMSCRC, crc);
+	ST_WORD(hdr + TF_SNAP_HDR_HDRCRC,
+			Crc16(CRC16_INIT, hdr, TF_SNAP_HDR_HDRCRC));
+	EeWrite(EE_TF_SNAP_OFS, hdr, TF_SNAP_HDR_LEN);
+}
+
+/************************************************************************//**
+ * \brief Rewrites the text configuration file with the current
+ * configuration and phone book, and deletes the journal and the compiled
+ * image. The new file is written to TF_TMP_FILE and then renamed, so a
+ * power failure never leaves a truncated configuration file.
  *
  * \return 0 if OK, nonzero otherwise.
  ****************************************************************************/
-char TfCfgSave(void)
-{
-	FIL fCfg;
-	char retVal, retVal2;
-	char *num;
-
-	/// Open configuration file for writing
-	if ((retVal = f_open(&fCfg, "BALSAMO.CFG", FA_WRITE | FA_CREATE_ALWAYS)))
-		return retVal;
-
+static char TfCfgWrite(void)
+{
+	FIL fCfg;
+	char retVal, retVal2;
+	char *num;
+	char line[SCHED_LINE_LEN];
+	BYTE i;
+
+	/// Open temporary file for writing
+	if ((retVal = f_open(&fCfg, TF_TMP_FILE, FA_WRITE | FA_CREATE_ALWAYS)))
+		return retVal;
+
 	/// First line is filter behaviour: either BLACKLIST or WHITELIST
 	if (TF_MODE_BLACKLIST == mode) retVal = f_puts("BLACKLIST\n", &fCfg);
 	else retVal = f_puts("WHITELIST\n", &fCfg);
@@ -247,11 +891,55 @@ char TfCfgSave(void)
 		f_close(&fCfg);
 		return 2;
 	}
-	/// Remaining lines are the filtered telephone numbers
+	/// Then the normalization prefixes, so the file is parsed with the
+	/// same settings
+	for (i = 0; i < TN_PFX_NUM; i++)
+	{
+		if ((f_puts(TnPrefixName(i), &fCfg) < 0) ||
+			(f_putc('=', &fCfg) < 0) ||
+			(f_puts(TnPrefixGet(i), &fCfg) < 0) ||
+			(f_putc('\n', &fCfg) < 0))
+		{
+			f_close(&fCfg);
+			return 2;
+		}
+	}
+	/// Repeat caller detection line, if enabled
+	RcCfgFormat(line);
+	if (line[0] && ((f_puts(line, &fCfg) < 0) || (f_putc('\n', &fCfg) < 0)))
+	{
+		f_close(&fCfg);
+		return 2;
+	}
+	/// List action lines, for the lists not using the default action
+	for (i = 0; i < CA_LIST_NUM; i++)
+	{
+		CaCfgFormat(i, listAct[i], line);
+		if (line[0] &&
+			((f_puts(line, &fCfg) < 0) || (f_putc('\n', &fCfg) < 0)))
+		{
+			f_close(&fCfg);
+			return 2;
+		}
+	}
+	/// Schedule lines
+	for (i = 0; i < nSched; i++)
+	{
+		SchedFormat(sched[i], line);
+		if ((f_puts(line, &fCfg) < 0) || (f_putc('\n', &fCfg) < 0))
+		{
+			f_close(&fCfg);
+			return 2;
+		}
+	}
+	/// Remaining lines are the filtered telephone numbers, followed by their
+	/// actions, if any
 	num = TfNumGetFirst();
 	while (num)
 	{
 		retVal  = f_puts(num, &fCfg);
+		if (bookAct[pos] && (retVal >= 0) && ((f_putc(' ', &fCfg) < 0) ||
+				(f_puts(CaName(bookAct[pos]), &fCfg) < 0))) retVal = -1;
 		retVal2 = f_putc('\n', &fCfg);
 		if (retVal < 0 || retVal2 < 0)
 		{
@@ -260,36 +948,181 @@ char TfCfgSave(void)
 		}
 		num = TfNumGetNext();
 	}
+	if (f_close(&fCfg)) return 4;
 
-	f_close(&fCfg);
+	/// Image would not match the new text file. Then replace the text file.
+	/// The new file may hold changes that are not in the journal, so the
+	/// journal must not be replayed over it: it is deleted before the new
+	/// file is renamed. If power fails after deleting the old file,
+	/// TfParseConfig() deletes the journal and renames the new file.
+	f_unlink(TF_IMG_FILE);
+	f_unlink(TF_CFG_FILE);
+	f_unlink(TF_JNL_FILE);
+	if (f_rename(TF_TMP_FILE, TF_CFG_FILE)) return 5;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Appends the journal records not saved yet to the journal file.
+ *
+ * \param[out] size Size of the journal file after appending the records.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char TfJnlAppend(DWORD *size)
+{
+	FIL fJnl;
+	char retVal;
+
+	if ((retVal = f_open(&fJnl, TF_JNL_FILE, FA_WRITE | FA_OPEN_ALWAYS)))
+		return retVal;
+	retVal = f_lseek(&fJnl, f_size(&fJnl)) || (f_puts(jnl, &fJnl) < 0);
+	*size = f_size(&fJnl);
+	if (f_close(&fJnl)) retVal = 1;
+	if (retVal) return 1;
+	jnl[0] = '\0';
+	jnlLen = 0;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Saves the changes made to the phone book since the last save. The
+ * changes are appended to the journal, or if it grows too long, the text
+ * configuration file is rewritten. The EEPROM snapshot is updated first, so
+ * it is kept even if the card cannot be written.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char TfCfgSave(void)
+{
+	DWORD size;
+	char retVal;
+
+	TfSnapSave();
+	if (!jnlLen && !jnlFull) return 0;
+
+	/// Append changes to the journal, unless they did not fit in RAM
+	if (!jnlFull)
+	{
+		if (TfJnlAppend(&size)) return 1;
+		if (size <= TF_JNL_MAX_LEN) return 0;
+	}
+
+	/// Rewrite the configuration file, including all the changes
+	if ((retVal = TfCfgWrite())) return retVal;
+	jnl[0] = '\0';
+	jnlLen = 0;
+	jnlFull = FALSE;
 	return 0;
 }
 
 /************************************************************************//**
- * \brief Tells if hidden numbers are either allowed or filtered out.
+ * \brief Reloads the configuration from the SD card, e.g. when the card has
+ * been inserted again. There is no RAM for a second phone book, so the
+ * EEPROM snapshot is the shadow copy: the new configuration is parsed over
+ * the phone book, and if it is not valid the snapshot is loaded back. If
+ * there is no valid snapshot either, all calls are allowed (empty
+ * blacklist) until a valid configuration is loaded.
  *
+ * Changes made from the keypad while the card was not available are
+ * appended to the journal of the new card first, so they are applied over
+ * the new configuration. If they did not fit in the pending journal
+ * records, they are lost: rewriting the configuration file would overwrite
+ * the new one.
+ *
+ * \warning The phone book is not valid while reloading, so calls must not
+ * be checked until this function returns.
+ *
+ * \return 0 if the new configuration was loaded, nonzero otherwise.
+ ****************************************************************************/
+char TfCfgReload(void)
+{
+	DWORD size;
+
+	if (jnlLen && !jnlFull) TfJnlAppend(&size);
+
+	if (TfParseConfig())
+	{
+		if (TF_SNAP_INVALID == TfSnapLoad()) TfInit(TF_MODE_BLACKLIST);
+		return 1;
+	}
+	TfSnapSave();
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Evaluates the schedule records against the current date and time,
+ * and updates the active filter mode and hidden numbers policy. Must be
+ * called each minute, and when date or time are set, so checking numbers
+ * does not need to evaluate the schedule.
+ ****************************************************************************/
+void TfSchedUpdate(void)
+{
+	BYTE mon, day, hour, min, sec, wday, i;
+	BYTE newMode = SCHED_KEEP, newHidden = SCHED_KEEP;
+	WORD year, now;
+
+	/// Time and weekday must come from the same reading, or at midnight
+	/// a range wrapping around it could be matched against the wrong day
+	RtcGetDateTime(&year, &mon, &day, &hour, &min, &sec);
+	wday = RtcWeekDay(year, mon, day);
+	now = (WORD)hour * 60 + min;
+	/// Each setting is taken from the first active record changing it.
+	/// Values not valid are ignored.
+	for (i = 0; i < nSched; i++)
+	{
+		if (!SchedMatch(sched[i], wday, now)) continue;
+		if ((SCHED_KEEP == newMode) &&
+			(SchedMode(sched[i]) <= TF_MODE_ALLOW_ALL))
+			newMode = SchedMode(sched[i]);
+		if ((SCHED_KEEP == newHidden) && (SchedHidden(sched[i]) <= TRUE))
+			newHidden = SchedHidden(sched[i]);
+	}
+	actMode = (SCHED_KEEP == newMode)?mode:newMode;
+	actHidden = (SCHED_KEEP == newHidden)?filtHidden:newHidden;
+}
+
+/************************************************************************//**
+ * \brief Tells if hidden numbers are either allowed or filtered out.
+ *
+ * \param[out] act Action to take if the call is rejected (see
+ *             call_act.h).
+ *
  * \return TF_HID_OK if hidden calls must not be filtered, TF_HID_REJECT if
  * hidden calls must be rejected, or TF_HID_DISABLED if hidden call should
- * be rejected but call filter is disabled.
- ****************************************************************************/
-char TfFilterHidden(void)
+ * be rejected but call filter is disabled.
+ ****************************************************************************/
+char TfFilterHidden(BYTE *act)
 {
-	if (filtHidden) return filtDisabled?TF_HID_DISABLED:TF_HID_REJECT;
+	*act = listAct[CA_LIST_HIDDEN];
+	if (actHidden) return filtDisabled?TF_HID_DISABLED:TF_HID_REJECT;
 	else return TF_HID_OK;
 }
 
 /************************************************************************//**
- * \brief Disables call filtering.
+ * \brief Disables call filtering. The state is kept in the EEPROM snapshot.
  ****************************************************************************/
 void TfDisable(void)
 {
 	filtDisabled = TRUE;
+	TfSnapSave();
 }
 
 /************************************************************************//**
- * \brief Enables call filtering.
+ * \brief Enables call filtering. The state is kept in the EEPROM snapshot.
  ****************************************************************************/
 void TfEnable(void)
 {
 	filtDisabled = FALSE;
+	TfSnapSave();
+}
+
+/************************************************************************//**
+ * \brief Tells if call filtering is enabled.
+ *
+ * \return TRUE if call filtering is enabled, FALSE otherwise.
+ ****************************************************************************/
+char TfEnabled(void)
+{
+	return !filtDisabled;
 }
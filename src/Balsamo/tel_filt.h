@@ -24,6 +24,10 @@
 
 #ifndef _TEL_FILT_H_
 #define _TEL_FILT_H_
+
+#include "tel_num.h"
+#include "sched.h"
+#include "call_act.h"
 
 /** \defgroup tel_filt_api tel_filt
  *
@@ -35,6 +39,8 @@
 #define TF_MODE_BLACKLIST	0
 /// Whitelist mode. Each number NOT in the list must be blacklisted
 #define TF_MODE_WHITELIST	1
+/// All numbers are allowed. Only used by schedule records (see sched.h)
+#define TF_MODE_ALLOW_ALL	2
 
 /// The checked number is not blacklisted
 #define TF_NUM_OK			0
@@ -48,6 +54,130 @@
 #define TF_HID_REJECT		4
 /// Hidden calls should be rejected but filter is disabled.
 #define TF_HID_DISABLED		5
+/// The checked number is allowed by the lists, but is calling too often
+/// (see rep_call.h)
+#define TF_NUM_REPEAT		6
+
+/// Numbers in the RAM phone book. Numbers are stored normalized and packed
+/// (see tel_num.h), so each one takes TN_PACK_LEN bytes.
+#define TF_BOOK_NUMS		128
+
+/// Text configuration file name
+#define TF_CFG_FILE			"BALSAMO.CFG"
+/// Compiled configuration image file name
+#define TF_IMG_FILE			"BALSAMO.BIN"
+/// Change journal file name. Holds one record per line: '+' followed by a
+/// number that was added, or '-' followed by a number that was deleted.
+/// Numbers are written in canonical form, preceded by '+'.
+#define TF_JNL_FILE			"BALSAMO.JNL"
+/// Temporary file used to rewrite the text configuration file
+#define TF_TMP_FILE			"BALSAMO.TMP"
+/// When the journal grows beyond this length, the configuration file is
+/// rewritten and the journal is deleted.
+#define TF_JNL_MAX_LEN		512
+/// Length of the buffer holding journal records not saved yet
+#define TF_JNL_PEND_LEN		48
+/// Length of the chunks text files are read in. Must be the sector length,
+/// so each sector is read straight from the card.
+#define TF_RD_CHUNK			512
+/// Number of rejected configuration lines recorded (see TfCfgRejects())
+#define TF_REJ_MAX			4
+
+/** \addtogroup tf_img Compiled configuration image. It is built from the
+ * text configuration file by the balcfg host tool, and is made of 512 byte
+ * sectors. Sector 0 holds the header (multi-byte fields are little endian).
+ * Packed numbers (see tel_num.h) follow, sorted and back to back, starting
+ * at the sector in the TF_IMG_HDR_NUMSECT field. The rule table starts at
+ * the sector in the TF_IMG_HDR_RULESECT field, and holds the action (see
+ * call_act.h) of each number, in the first byte of each TF_IMG_HDR_RULELEN
+ * byte record, in the same order as the numbers. It is empty if all the
+ * numbers have the default action. The image is only used if the text
+ * configuration file is missing, or if its size and modification date and
+ * time match the ones recorded in the header. Numbers are normalized with
+ * the prefixes in the TF_IMG_HDR_NORM field. The schedule records (see
+ * sched.h), the repeat caller settings (see rep_call.h) and the list
+ * actions are stored in the header.
+ * \{ */
+#define TF_IMG_MAGIC		"BCFG"	///< Image magic number
+#define TF_IMG_VERSION		6		///< Image format version
+#define TF_IMG_SECT_LEN		512		///< Image sector length
+
+#define TF_IMG_HDR_MAGIC	0	///< Magic number (4 bytes)
+#define TF_IMG_HDR_VERSION	4	///< Format version (WORD)
+#define TF_IMG_HDR_MODE		6	///< Filter mode (BYTE)
+#define TF_IMG_HDR_HIDDEN	7	///< Filter hidden numbers (BYTE)
+#define TF_IMG_HDR_SRCSIZE	8	///< Size of the source text file (DWORD)
+#define TF_IMG_HDR_NNUMS	12	///< Number of packed numbers (WORD)
+#define TF_IMG_HDR_NUMSECT	14	///< First sector of the numbers (WORD)
+#define TF_IMG_HDR_NRULES	16	///< Number of rule records (WORD)
+#define TF_IMG_HDR_RULESECT	18	///< First sector of the rules (WORD)
+#define TF_IMG_HDR_RULELEN	20	///< Length of each rule record (WORD)
+#define TF_IMG_HDR_BODYCRC	22	///< CRC16 of sectors after header (WORD)
+#define TF_IMG_HDR_NSCHED	24	///< Number of schedule records (WORD)
+#define TF_IMG_HDR_SCHED	26	///< Schedule records (SCHED_MAX records)
+#define TF_IMG_HDR_NORM		(TF_IMG_HDR_SCHED + SCHED_MAX * SCHED_REC_LEN)
+									///< Normalization prefixes (TN_NORM_LEN)
+#define TF_IMG_HDR_RCCALLS	(TF_IMG_HDR_NORM + TN_NORM_LEN)
+									///< Repeat calls to block (WORD)
+#define TF_IMG_HDR_RCWINDOW	(TF_IMG_HDR_RCCALLS + 2)
+									///< Repeat calls window (WORD)
+#define TF_IMG_HDR_RCBLOCK	(TF_IMG_HDR_RCWINDOW + 2)
+									///< Repeat caller block time (WORD)
+#define TF_IMG_HDR_ACTS		(TF_IMG_HDR_RCBLOCK + 2)
+									///< List actions (CA_LIST_NUM bytes)
+#define TF_IMG_HDR_SRCDATE	(TF_IMG_HDR_ACTS + CA_LIST_NUM)
+									///< FAT date of the source file (WORD)
+#define TF_IMG_HDR_SRCTIME	(TF_IMG_HDR_SRCDATE + 2)
+									///< FAT time of the source file (WORD)
+#define TF_IMG_HDR_HDRCRC	(TF_IMG_HDR_SRCTIME + 2)	///< CRC16 of
+										///< previous header bytes (WORD)
+#define TF_IMG_HDR_LEN		(TF_IMG_HDR_HDRCRC + 2)	///< Header length
+/** \} */
+
+/** \addtogroup tf_snap Configuration snapshot stored in data EEPROM, at
+ * EE_TF_SNAP_OFS. Allows filtering calls right after boot, or if the card
+ * cannot be read. The header is followed by the packed numbers of the RAM
+ * phone book (if they fit), starting at the next EEPROM row, and then by
+ * their actions, one byte per number, at TF_SNAP_ACTS. EEPROM is
+ * accessed in words, so header length must be even.
+ * \{ */
+#define TF_SNAP_MAGIC		0x5342	///< Snapshot magic number ("BS")
+#define TF_SNAP_VERSION		4		///< Snapshot format version
+#define TF_SNAP_MAX_NUMS	TF_BOOK_NUMS	///< Maximum numbers in the snapshot
+
+#define TF_SNAP_HDR_MAGIC	0	///< Magic number (WORD)
+#define TF_SNAP_HDR_VERSION	2	///< Format version (WORD)
+#define TF_SNAP_HDR_MODE	4	///< Filter mode (BYTE)
+#define TF_SNAP_HDR_HIDDEN	5	///< Filter hidden numbers (BYTE)
+#define TF_SNAP_HDR_DISABLE	6	///< Call filter disabled (BYTE)
+#define TF_SNAP_HDR_FLAGS	7	///< TF_SNAP_F_* flags (BYTE)
+#define TF_SNAP_HDR_NNUMS	8	///< Number of packed numbers (WORD)
+#define TF_SNAP_HDR_BOOKCRC	10	///< CRC16 of the phone book contents (WORD)
+#define TF_SNAP_HDR_NUMSCRC	12	///< CRC16 of the packed numbers (WORD)
+#define TF_SNAP_HDR_NSCHED	14	///< Number of schedule records (WORD)
+#define TF_SNAP_HDR_SCHED	16	///< Schedule records (SCHED_MAX records)
+#define TF_SNAP_HDR_NORM	(TF_SNAP_HDR_SCHED + SCHED_MAX * SCHED_REC_LEN)
+									///< Normalization prefixes (TN_NORM_LEN)
+#define TF_SNAP_HDR_ACTS	(TF_SNAP_HDR_NORM + TN_NORM_LEN)
+									///< List actions (CA_LIST_NUM bytes)
+#define TF_SNAP_HDR_HDRCRC	((TF_SNAP_HDR_ACTS + CA_LIST_NUM + 1) & ~1)
+									///< CRC16 of previous header bytes (WORD)
+#define TF_SNAP_HDR_LEN		(TF_SNAP_HDR_HDRCRC + 2)	///< Header length
+#define TF_SNAP_NUMS		96	///< Offset of the packed numbers
+/// Offset of the number actions
+#define TF_SNAP_ACTS		(TF_SNAP_NUMS + TF_SNAP_MAX_NUMS * TN_PACK_LEN)
+
+/// The snapshot holds the whole phone book
+#define TF_SNAP_F_NUMS		0x01
+/** \} */
+
+/// Snapshot holds configuration and phone book
+#define TF_SNAP_FULL		0
+/// Snapshot holds configuration, but phone book did not fit
+#define TF_SNAP_NO_NUMS		1
+/// Snapshot is not valid
+#define TF_SNAP_INVALID		2
+
 /************************************************************************//**
  * \brief Module initialization. Must be called before using any other
  * function.
@@ -58,45 +188,101 @@
 void TfInit(char filterMode);
 
 /************************************************************************//**
- * \brief Adds a number to the phone book
+ * \brief Adds a number to the phone book, with the default action. The
+ * change is saved by the next TfCfgSave() call.
  *
- * \param[in] number Telephone number to add to the phone book.
+ * \param[in] number Telephone number to add to the phone book. It is
+ *            normalized before storing it (see tel_num.h).
  *
- * \return 0 if OK, nonzero otherwise.
+ * \return 0 if OK, nonzero if the number is not valid or the phone book
+ * is full.
  ****************************************************************************/
 char TfNumAdd(char number[]);
 
 /************************************************************************//**
- * \brief Checks if a telephone number is blacklisted.
- *
- * \param[in] number Telephone number to check.
- *
+ * \brief Checks if a telephone number is blacklisted. The number is first
+ * searched in the RAM phone book, then in the on-card index (if any, and
+ * not copied to the flash list), and then in the flash list. Numbers with
+ * an action follow it, other numbers follow the filter mode (see
+ * call_act.h). Numbers allowed and not whitelisted are passed to the
+ * repeat caller detector.
+ *
+ * \param[in]  key Packed canonical telephone number to check (see
+ *             TnPackNorm()), or NULL if the number could not be normalized.
+ * \param[out] act Action to take if the call is rejected: the action of
+ *             the number, or the action of the list rejecting it.
+ *
  * \return TF_NUM_OK if the number is allowed, TF_NUM_REJECT if the number
- * is blacklisted (or not in the whitelist), TF_NUM_FILTER_DISABLED if the
- * number should be rejected, but call filter is disabled.
- ****************************************************************************/
-char TfNumCheck(char number[]);
+ * is blacklisted (or not in the whitelist), TF_NUM_REPEAT if the number
+ * is calling too often, TF_NUM_FILTER_DISABLED if the number should be
+ * rejected, but call filter is disabled.
+ ****************************************************************************/
+char TfNumCheck(const BYTE key[], BYTE *act);
 
 /************************************************************************//**
  * \brief Parses configuration file stored inside the microSD card. It
  * configures the blacklist/whitelist mode and adds previously stored
- * numbers to the phone book.
+ * numbers to the phone book. The compiled image (TF_IMG_FILE) is loaded if
+ * available and valid, the text file (TF_CFG_FILE) is parsed otherwise.
+ * Then the changes in the journal (TF_JNL_FILE) are applied.
  *
  * \return 0 if OK, nonzero otherwise.
  ****************************************************************************/
 char TfParseConfig(void);
 
+/************************************************************************//**
+ * \brief Gets the lines of the text configuration file rejected by the
+ * last TfParseConfig() call. Compiled images are checked by balcfg, so
+ * nothing is rejected when loading them.
+ *
+ * \param[out] lines Buffer of TF_REJ_MAX entries receiving the numbers of
+ *             the first rejected lines.
+ *
+ * \return Number of rejected lines. Only the first TF_REJ_MAX are stored
+ * in lines.
+ ****************************************************************************/
+WORD TfCfgRejects(WORD lines[]);
+
+/************************************************************************//**
+ * \brief Loads the configuration snapshot stored in data EEPROM. Does not
+ * need the SD card.
+ *
+ * \return TF_SNAP_FULL if configuration and phone book were loaded,
+ * TF_SNAP_NO_NUMS if only the configuration was loaded (phone book is
+ * empty), or TF_SNAP_INVALID if the snapshot is not valid.
+ ****************************************************************************/
+char TfSnapLoad(void);
+
+/************************************************************************//**
+ * \brief Updates the configuration snapshot in data EEPROM, if the current
+ * configuration or phone book differ from the stored ones.
+ ****************************************************************************/
+void TfSnapSave(void);
+
 /************************************************************************//**
- * \brief Tells if hidden numbers are either allowed or filtered out.
- *
+ * \brief Evaluates the schedule records against the current date and time,
+ * and updates the active filter mode and hidden numbers policy. Must be
+ * called each minute, and when date or time are set, so checking numbers
+ * does not need to evaluate the schedule.
+ ****************************************************************************/
+void TfSchedUpdate(void);
+
+/************************************************************************//**
+ * \brief Tells if hidden numbers are either allowed or filtered out.
+ *
+ * \param[out] act Action to take if the call is rejected (see
+ *             call_act.h).
+ *
  * \return TF_HID_OK if hidden calls must not be filtered, TF_HID_REJECT if
  * hidden calls must be rejected, or TF_HID_DISABLED if hidden call should
- * be rejected but call filter is disabled.
- ****************************************************************************/
-char TfFilterHidden(void);
+ * be rejected but call filter is disabled.
+ ****************************************************************************/
+char TfFilterHidden(BYTE *act);
 
 /************************************************************************//**
- * \brief Gets the first number stored in the telephone book.
+ * \brief Gets the first number stored in the telephone book. Numbers are
+ * returned in canonical form, preceded by '+', and are overwritten by the
+ * next TfNumGet* call.
  *
  * \return The first number stored in the telephone book, or NULL if there
  * is no one.
@@ -121,26 +307,58 @@ char* TfNumGetPrev(void);
 
 /************************************************************************//**
  * \brief Deletes the current telephone number from the telephone book.
+ * The change is saved by the next TfCfgSave() call.
  ****************************************************************************/
 void TfNumDelete(void);
 
 /************************************************************************//**
- * \brief Saves the current configuration and phone book to the SD card.
+ * \brief Saves the changes made to the phone book since the last save. The
+ * changes are appended to the journal, or if it grows too long, the text
+ * configuration file is rewritten. The EEPROM snapshot is updated first, so
+ * it is kept even if the card cannot be written.
  *
  * \return 0 if OK, nonzero otherwise.
  ****************************************************************************/
 char TfCfgSave(void);
+
+/************************************************************************//**
+ * \brief Reloads the configuration from the SD card, e.g. when the card has
+ * been inserted again. There is no RAM for a second phone book, so the
+ * EEPROM snapshot is the shadow copy: the new configuration is parsed over
+ * the phone book, and if it is not valid the snapshot is loaded back. If
+ * there is no valid snapshot either, all calls are allowed (empty
+ * blacklist) until a valid configuration is loaded.
+ *
+ * Changes made from the keypad while the card was not available are
+ * appended to the journal of the new card first, so they are applied over
+ * the new configuration. If they did not fit in the pending journal
+ * records, they are lost: rewriting the configuration file would overwrite
+ * the new one.
+ *
+ * \warning The phone book is not valid while reloading, so calls must not
+ * be checked until this function returns.
+ *
+ * \return 0 if the new configuration was loaded, nonzero otherwise.
+ ****************************************************************************/
+char TfCfgReload(void);
 
 /************************************************************************//**
- * \brief Disables call filtering.
+ * \brief Disables call filtering. The state is kept in the EEPROM snapshot.
  ****************************************************************************/
 void TfDisable(void);
 
 /************************************************************************//**
- * \brief Enables call filtering.
+ * \brief Enables call filtering. The state is kept in the EEPROM snapshot.
  ****************************************************************************/
 void TfEnable(void);
 
+/************************************************************************//**
+ * \brief Tells if call filtering is enabled.
+ *
+ * \return TRUE if call filtering is enabled, FALSE otherwise.
+ ****************************************************************************/
+char TfEnabled(void);
+
 /** \} */
 
 #endif /*_TEL_FILT_H_*/
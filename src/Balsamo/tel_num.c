@@ -0,0 +1,293 @@
+/************************************************************************//**
+ * \file  tel_num.c
+ * \brief Telephone number packing. Converts ASCII telephone numbers to a
+ * fixed length packed BCD form (and back), suitable for storing numbers in
+ * binary files and for comparing them with a single memcmp().
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \note This module does not depend on the hardware, and is also built by
+ * the host tools under src/balidx.
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tel_num.h"
+
+/// Normalization prefixes
+static char prefix[TN_PFX_NUM][TN_PFX_LEN] = {
+	TN_DEF_COUNTRY, TN_DEF_TRUNK, TN_DEF_INTL
+};
+/// Configuration directives setting each prefix
+static const char * const prefixName[TN_PFX_NUM] = {
+	"COUNTRY_CODE", "TRUNK_PREFIX", "INTL_PREFIX"
+};
+
+/************************************************************************//**
+ * \brief Packs an ASCII telephone number. The number ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  num    Null terminated ASCII telephone number.
+ * \param[out] packed Buffer of TN_PACK_LEN bytes receiving the packed number.
+ *
+ * \return 0 if OK, nonzero if the number is empty, too long or has
+ * characters other than digits.
+ ****************************************************************************/
+char TnPack(const char num[], BYTE packed[])
+{
+	BYTE i;
+	char c;
+
+	/// Fill with padding nibbles
+	memset(packed, (TN_PAD << 4) | TN_PAD, TN_PACK_LEN);
+
+	for (i = 0; (c = num[i]) && (c != '\n') && (c != '\r'); i++)
+	{
+		if ((c < '0') || (c > '9') || (i >= TN_MAX_DIGITS)) return 1;
+		/// Even digits go to the high nibble, odd digits to the low one
+		if (i & 1) packed[i>>1] = (packed[i>>1] & 0xF0) | (c - '0');
+		else packed[i>>1] = ((c - '0')<<4) | TN_PAD;
+	}
+
+	return i?0:1;
+}
+
+/************************************************************************//**
+ * \brief Unpacks a telephone number previously packed with TnPack().
+ *
+ * \param[in]  packed Packed number (TN_PACK_LEN bytes).
+ * \param[out] num    Buffer receiving the null terminated ASCII number. Must
+ *             be at least TN_MAX_DIGITS + 1 characters long.
+ ****************************************************************************/
+void TnUnpack(const BYTE packed[], char num[])
+{
+	BYTE i, nib;
+
+	for (i = 0; i < TN_MAX_DIGITS; i++)
+	{
+		nib = (i & 1)?(packed[i>>1] & 0x0F):(packed[i>>1]>>4);
+		if (nib > 9) break;
+		num[i] = '0' + nib;
+	}
+	num[i] = '\0';
+}
+
+/************************************************************************//**
+ * \brief Restores the default normalization prefixes.
+ ****************************************************************************/
+void TnNormReset(void)
+{
+	strcpy(prefix[TN_PFX_COUNTRY], TN_DEF_COUNTRY);
+	strcpy(prefix[TN_PFX_TRUNK], TN_DEF_TRUNK);
+	strcpy(prefix[TN_PFX_INTL], TN_DEF_INTL);
+}
+
+/************************************************************************//**
+ * \brief Sets a normalization prefix.
+ *
+ * \param[in] pfx   Prefix to set (TN_PFX_COUNTRY, TN_PFX_TRUNK or
+ *                  TN_PFX_INTL).
+ * \param[in] value Null terminated prefix digits. Can be empty.
+ *
+ * \return 0 if OK, nonzero if the prefix is too long or has characters other
+ * than digits.
+ ****************************************************************************/
+char TnPrefixSet(BYTE pfx, const char value[])
+{
+	BYTE i;
+
+	if (pfx >= TN_PFX_NUM) return 1;
+	for (i = 0; value[i]; i++)
+		if ((value[i] < '0') || (value[i] > '9') || (i >= (TN_PFX_LEN - 1)))
+			return 1;
+	strcpy(prefix[pfx], value);
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Gets a normalization prefix.
+ *
+ * \param[in] pfx Prefix to get (TN_PFX_COUNTRY, TN_PFX_TRUNK or
+ *                TN_PFX_INTL).
+ *
+ * \return Null terminated prefix digits.
+ ****************************************************************************/
+const char *TnPrefixGet(BYTE pfx)
+{
+	return prefix[pfx];
+}
+
+/************************************************************************//**
+ * \brief Gets the configuration file directive setting a prefix.
+ *
+ * \param[in] pfx Prefix (TN_PFX_COUNTRY, TN_PFX_TRUNK or TN_PFX_INTL).
+ *
+ * \return Directive name. It is followed by '=' and the prefix digits.
+ ****************************************************************************/
+const char *TnPrefixName(BYTE pfx)
+{
+	return prefixName[pfx];
+}
+
+/************************************************************************//**
+ * \brief Parses a configuration line setting a prefix, e.g.
+ * "COUNTRY_CODE=34". The line ends with the first '\0', '\r' or '\n'.
+ *
+ * \param[in] line Configuration line.
+ *
+ * \return 0 if the prefix was set, 1 if the line is not a prefix directive,
+ * 2 if the prefix value is not valid.
+ ****************************************************************************/
+char TnPrefixParse(const char line[])
+{
+	char value[TN_PFX_LEN];
+	BYTE pfx, len, i;
+
+	for (pfx = 0; pfx < TN_PFX_NUM; pfx++)
+	{
+		len = strlen(prefixName[pfx]);
+		if (!strncmp(line, prefixName[pfx], len) && ('=' == line[len])) break;
+	}
+	if (pfx == TN_PFX_NUM) return 1;
+
+	/// Copy the value, without the line ending
+	line += len + 1;
+	for (i = 0; line[i] && (line[i] != '\r') && (line[i] != '\n'); i++)
+	{
+		if (i >= (TN_PFX_LEN - 1)) return 2;
+		value[i] = line[i];
+	}
+	value[i] = '\0';
+
+	return TnPrefixSet(pfx, value)?2:0;
+}
+
+/************************************************************************//**
+ * \brief Copies the normalization settings to a buffer, so they can be
+ * stored along with the packed numbers.
+ *
+ * \param[out] norm Buffer of TN_NORM_LEN bytes receiving the settings.
+ ****************************************************************************/
+void TnNormGet(BYTE norm[])
+{
+	BYTE i;
+
+	/// Unused bytes are cleared, so the settings can be compared
+	memset(norm, 0, TN_NORM_LEN);
+	for (i = 0; i < TN_PFX_NUM; i++)
+		strcpy((char*)norm + i * TN_PFX_LEN, prefix[i]);
+}
+
+/************************************************************************//**
+ * \brief Loads normalization settings previously obtained with TnNormGet().
+ *
+ * \param[in] norm Buffer of TN_NORM_LEN bytes holding the settings.
+ *
+ * \return 0 if OK, nonzero if the settings are not valid (current settings
+ * are kept).
+ ****************************************************************************/
+char TnNormSet(const BYTE norm[])
+{
+	char tmp[TN_PFX_NUM][TN_PFX_LEN];
+	BYTE i;
+
+	/// Check every prefix before changing any of them
+	memcpy(tmp, prefix, TN_NORM_LEN);
+	for (i = 0; i < TN_PFX_NUM; i++)
+	{
+		if (norm[(i + 1) * TN_PFX_LEN - 1] ||
+			TnPrefixSet(i, (const char*)norm + i * TN_PFX_LEN))
+		{
+			memcpy(prefix, tmp, TN_NORM_LEN);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Normalizes a telephone number to its canonical international form.
+ * The number ends with the first '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  num   Null terminated ASCII telephone number.
+ * \param[out] canon Buffer receiving the null terminated canonical number.
+ *              Must be at least TN_MAX_DIGITS + 1 characters long.
+ *
+ * \return 0 if OK, nonzero if the number has no digits, has characters
+ * other than digits, blanks and separators (" -./()"), or the canonical
+ * number is too long.
+ ****************************************************************************/
+char TnNormalize(const char num[], char canon[])
+{
+	/// Digits of the number, with room for the country code
+	char digits[TN_MAX_DIGITS + TN_PFX_LEN];
+	const char *p;
+	char intl = FALSE;
+	BYTE len, i;
+	char c;
+
+	/// Keep only the digits, skipping blanks and separators. A '+' before
+	/// them marks an international number.
+	for (len = i = 0; (c = num[i]) && (c != '\n') && (c != '\r'); i++)
+	{
+		if ((c >= '0') && (c <= '9'))
+		{
+			if (len >= (TN_MAX_DIGITS + TN_PFX_LEN - 1)) return 1;
+			digits[len++] = c;
+		}
+		else if (('+' == c) && !len && !intl) intl = TRUE;
+		else if (!strchr(" \t-./()", c)) return 1;
+	}
+	digits[len] = '\0';
+	p = digits;
+
+	/// Remove the international prefix, or the trunk prefix and add the
+	/// country code to national numbers
+	i = strlen(prefix[TN_PFX_INTL]);
+	if (!intl && i && !strncmp(p, prefix[TN_PFX_INTL], i))
+	{
+		p += i;
+		intl = TRUE;
+	}
+	canon[0] = '\0';
+	if (!intl)
+	{
+		i = strlen(prefix[TN_PFX_TRUNK]);
+		if (i && !strncmp(p, prefix[TN_PFX_TRUNK], i)) p += i;
+		strcpy(canon, prefix[TN_PFX_COUNTRY]);
+	}
+	if (!*p || ((strlen(canon) + strlen(p)) > TN_MAX_DIGITS)) return 1;
+	strcat(canon, p);
+
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Normalizes (see TnNormalize()) and packs a telephone number.
+ *
+ * \param[in]  num    Null terminated ASCII telephone number.
+ * \param[out] packed Buffer of TN_PACK_LEN bytes receiving the packed
+ *             canonical number.
+ *
+ * \return 0 if OK, nonzero if the number cannot be normalized.
+ ****************************************************************************/
+char TnPackNorm(const char num[], BYTE packed[])
+{
+	char canon[TN_MAX_DIGITS + 1];
+
+	if (TnNormalize(num, canon)) return 1;
+	return TnPack(canon, packed);
+}
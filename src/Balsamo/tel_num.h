@@ -0,0 +1,191 @@
+/************************************************************************//**
+ * \file  tel_num.h
+ * \brief Telephone number packing. Converts ASCII telephone numbers to a
+ * fixed length packed BCD form (and back), suitable for storing numbers in
+ * binary files and for comparing them with a single memcmp().
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEL_NUM_H_
+#define _TEL_NUM_H_
+
+#include "types.h"
+#include <string.h>
+
+/** \defgroup tel_num_api tel_num
+ *
+ * Telephone number packing. Each digit is stored in a nibble (most
+ * significant nibble first), and unused nibbles are filled with 0xF. As
+ * 0xF is greater than any digit, packed numbers sort the same way when
+ * compared with memcmp(), on the firmware and on the host tools.
+ *
+ * Numbers are normalized to a canonical international form before being
+ * packed, so the same line is matched however the number is written or
+ * received: "+34 612 345 678", "0034612345678" and "612345678" all become
+ * 34612345678 with the default settings. Normalization removes blanks and
+ * separators, then removes the international prefix (or a leading '+'),
+ * or if there is none, removes the trunk prefix and prepends the country
+ * code.
+ * \{ */
+
+/// Length in bytes of a packed telephone number
+#define TN_PACK_LEN		8
+/// Maximum number of digits a packed telephone number can hold
+#define TN_MAX_DIGITS	(2 * TN_PACK_LEN)
+/// Nibble used to fill unused digit positions
+#define TN_PAD			0x0F
+
+/// Country code prepended to national numbers
+#define TN_PFX_COUNTRY	0
+/// Trunk prefix removed from national numbers
+#define TN_PFX_TRUNK	1
+/// International call prefix
+#define TN_PFX_INTL		2
+/// Number of normalization prefixes
+#define TN_PFX_NUM		3
+/// Length of each prefix, including the terminating '\0'
+#define TN_PFX_LEN		5
+/// Length of the normalization settings, as stored by TnNormGet()
+#define TN_NORM_LEN		(TN_PFX_NUM * TN_PFX_LEN)
+
+/// Default country code (Spain)
+#define TN_DEF_COUNTRY	"34"
+/// Default trunk prefix (none in Spain)
+#define TN_DEF_TRUNK	""
+/// Default international call prefix
+#define TN_DEF_INTL		"00"
+
+/// Compares two packed numbers. Returns <0, 0 or >0 as memcmp() does.
+#define TnCmp(a, b)		memcmp((a), (b), TN_PACK_LEN)
+
+/************************************************************************//**
+ * \brief Packs an ASCII telephone number. The number ends with the first
+ * '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  num    Null terminated ASCII telephone number.
+ * \param[out] packed Buffer of TN_PACK_LEN bytes receiving the packed number.
+ *
+ * \return 0 if OK, nonzero if the number is empty, too long or has
+ * characters other than digits.
+ ****************************************************************************/
+char TnPack(const char num[], BYTE packed[]);
+
+/************************************************************************//**
+ * \brief Unpacks a telephone number previously packed with TnPack().
+ *
+ * \param[in]  packed Packed number (TN_PACK_LEN bytes).
+ * \param[out] num    Buffer receiving the null terminated ASCII number. Must
+ *             be at least TN_MAX_DIGITS + 1 characters long.
+ ****************************************************************************/
+void TnUnpack(const BYTE packed[], char num[]);
+
+/************************************************************************//**
+ * \brief Restores the default normalization prefixes.
+ ****************************************************************************/
+void TnNormReset(void);
+
+/************************************************************************//**
+ * \brief Sets a normalization prefix.
+ *
+ * \param[in] pfx   Prefix to set (TN_PFX_COUNTRY, TN_PFX_TRUNK or
+ *                  TN_PFX_INTL).
+ * \param[in] value Null terminated prefix digits. Can be empty.
+ *
+ * \return 0 if OK, nonzero if the prefix is too long or has characters other
+ * than digits.
+ ****************************************************************************/
+char TnPrefixSet(BYTE pfx, const char value[]);
+
+/************************************************************************//**
+ * \brief Gets a normalization prefix.
+ *
+ * \param[in] pfx Prefix to get (TN_PFX_COUNTRY, TN_PFX_TRUNK or
+ *                TN_PFX_INTL).
+ *
+ * \return Null terminated prefix digits.
+ ****************************************************************************/
+const char *TnPrefixGet(BYTE pfx);
+
+/************************************************************************//**
+ * \brief Gets the configuration file directive setting a prefix.
+ *
+ * \param[in] pfx Prefix (TN_PFX_COUNTRY, TN_PFX_TRUNK or TN_PFX_INTL).
+ *
+ * \return Directive name. It is followed by '=' and the prefix digits.
+ ****************************************************************************/
+const char *TnPrefixName(BYTE pfx);
+
+/************************************************************************//**
+ * \brief Parses a configuration line setting a prefix, e.g.
+ * "COUNTRY_CODE=34". The line ends with the first '\0', '\r' or '\n'.
+ *
+ * \param[in] line Configuration line.
+ *
+ * \return 0 if the prefix was set, 1 if the line is not a prefix directive,
+ * 2 if the prefix value is not valid.
+ ****************************************************************************/
+char TnPrefixParse(const char line[]);
+
+/************************************************************************//**
+ * \brief Copies the normalization settings to a buffer, so they can be
+ * stored along with the packed numbers.
+ *
+ * \param[out] norm Buffer of TN_NORM_LEN bytes receiving the settings.
+ ****************************************************************************/
+void TnNormGet(BYTE norm[]);
+
+/************************************************************************//**
+ * \brief Loads normalization settings previously obtained with TnNormGet().
+ *
+ * \param[in] norm Buffer of TN_NORM_LEN bytes holding the settings.
+ *
+ * \return 0 if OK, nonzero if the settings are not valid (current settings
+ * are kept).
+ ****************************************************************************/
+char TnNormSet(const BYTE norm[]);
+
+/************************************************************************//**
+ * \brief Normalizes a telephone number to its canonical international form.
+ * The number ends with the first '\0', '\r' or '\n' character found.
+ *
+ * \param[in]  num   Null terminated ASCII telephone number.
+ * \param[out] canon Buffer receiving the null terminated canonical number.
+ *              Must be at least TN_MAX_DIGITS + 1 characters long.
+ *
+ * \return 0 if OK, nonzero if the number has no digits, has characters
+ * other than digits, blanks and separators (" -./()"), or the canonical
+ * number is too long.
+ ****************************************************************************/
+char TnNormalize(const char num[], char canon[]);
+
+/************************************************************************//**
+ * \brief Normalizes (see TnNormalize()) and packs a telephone number.
+ *
+ * \param[in]  num    Null terminated ASCII telephone number.
+ * \param[out] packed Buffer of TN_PACK_LEN bytes receiving the packed
+ *             canonical number.
+ *
+ * \return 0 if OK, nonzero if the number cannot be normalized.
+ ****************************************************************************/
+char TnPackNorm(const char num[], BYTE packed[]);
+
+/** \} */
+
+#endif /*_TEL_NUM_H_*/
@@ -25,6 +25,7 @@
 
 #include "user_if.h"
 #include "tel_filt.h"
+#include "call_hist.h"
 #include "utils.h"
 #include <string.h>
 #include "tim_evt.h"
@@ -36,9 +37,6 @@
 #define FALSE 0
 #endif
 
-/// Maximum number of recent numbers in list
-#define UIF_NUM_RECENT_NUMS		10
-
 /// Code used to bounce the LCD position back one character
 #define UIF_CHR_BACK			0x7F
 /// Character representing the end of the string
@@ -92,12 +90,7 @@ typedef struct
 typedef struct
 {
 	UifState s;                           ///< Module state
-	char recNum[UIF_NUM_RECENT_NUMS][17]; ///< Received call list (circ. buf)
-	unsigned char numFirst;               ///< First num in list
-	unsigned char numLast;                ///< Last num in list
-	unsigned char numPos;                 ///< Position in list
-	unsigned char numLastReturned;        ///< Position of the last returned
-	char full;                            ///< TRUE if list full
+	WORD numPos;                          ///< Age of the call shown
 	UifFlags f;                           ///< Module flags
 	UifStrEntry str;                      ///< String entry data
 } UifData;
@@ -127,27 +120,6 @@ static char sNum[14];
 /// Used for generic yes/no queries
 static char yesQuery;
 
-/// Advances one position in the received call list
-/// \warning: use only for list insertions
-#define UifAdvance(cursor)									\
-{															\
-	if (++cursor == UIF_NUM_RECENT_NUMS) cursor = 0;		\
-}
-
-/// Goes back one position in the received call list
-#define UifBack(cursor)										\
-{															\
-	cursor = cursor?cursor - 1:UIF_NUM_RECENT_NUMS - 1;		\
-}
-
-/// Returns the number of available items in the list
-#define UifAvailable()	 									\
-{															\
-	ud.full?UIF_NUM_RECENT_NUMS:ud.numLast >= ud.numFirst?	\
-		ud.numLast - ud.NumFirst:							\
-		UIF_NUM_RECENT_NUMS - ud.numFirst + ud.numLast;		\
-}
-
 /************************************************************************//**
  * \brief Prints a string in line 2 of the LCD. If the string has less than
  * 16 characters, blanks are printed until 16 characters are filled.
@@ -167,40 +139,17 @@ static void UifPrintStrLine2(char* str)
 	}
 }
 
-/************************************************************************//**
- * \brief Insert a number in the received call list. Overwrites the older
- * number if the list is full.
- *
- * \param[in] num Number to insert in the list
- ****************************************************************************/
-static void UifInsert(char num[])
-{
-	strncpy((char*)&ud.recNum[ud.numLast], num, 16);
-	UifAdvance(ud.numLast);
-	if (ud.full) ud.numFirst = ud.numLast;
-	else if (ud.numFirst == ud.numLast) ud.full = TRUE;
-}
-
-/************************************************************************//**
- * \brief Returns the first (i.e. oldest) number in the received call list.
- *
- * \return First number in the list, or NULL if there is none.
+/************************************************************************//**
+ * \brief Returns the first (i.e. oldest) number in the received call list,
+ * kept by the call_hist module.
+ *
+ * \return First number in the list, or NULL if there is none.
  ****************************************************************************/
 static char *UifNumGetFirst(void)
 {
-	char *retVal;
-
-	ud.numPos = ud.numFirst;
-
-	/// Check there is at least a number
-	if (!ud.full && ud.numPos == ud.numLast) return NULL;
-
-	/// Get the number and advance
-	retVal = ud.recNum[ud.numPos];
-	ud.numLastReturned = ud.numPos;
-	UifAdvance(ud.numPos);
-
-	return retVal;
+	/// If there are no calls, numPos is out of range and NULL is returned
+	ud.numPos = ChCount() - 1;
+	return ChNum(ud.numPos);
 }
 
 /************************************************************************//**
@@ -212,17 +161,10 @@ static char *UifNumGetFirst(void)
  ****************************************************************************/
 static char *UifNumGetNext(void)
 {
-	char *retVal;
-
 	/// Check if we reached end of list
-	if (ud.numPos == ud.numLast) return UifNumGetFirst();
-
-	/// Get the number and advance.
-	retVal = ud.recNum[ud.numPos];
-	ud.numLastReturned = ud.numPos;
-	UifAdvance(ud.numPos);
+	if (!ud.numPos) return UifNumGetFirst();
 
-	return retVal;
+	return ChNum(--ud.numPos);
 }
 
 /************************************************************************//**
@@ -232,15 +174,8 @@ static char *UifNumGetNext(void)
  ****************************************************************************/
 static char *UifNumGetLast(void)
 {
-	ud.numPos = ud.numLast;
-
-	/// Check there is at least a number
-	if (!ud.full && ud.numPos == ud.numFirst) return NULL;
-
-	/// Get the number
-	UifBack(ud.numPos);
-	ud.numLastReturned = ud.numPos;
-	return ud.recNum[ud.numPos];
+	ud.numPos = 0;
+	return ChNum(ud.numPos);
 }
 
 /************************************************************************//**
@@ -252,11 +187,9 @@ static char *UifNumGetLast(void)
  ****************************************************************************/
 static char *UifNumGetPrev(void)
 {
-	if (ud.numPos == ud.numFirst) return UifNumGetLast();
+	if ((ud.numPos + 1) >= ChCount()) return UifNumGetLast();
 
-	UifBack(ud.numPos);
-	ud.numLastReturned = ud.numPos;
-	return ud.recNum[ud.numPos];
+	return ChNum(++ud.numPos);
 }
 
 /************************************************************************//**
@@ -266,7 +199,7 @@ static char *UifNumGetPrev(void)
  * \return String with the last number returned previously by other of the
  * UifGet* functions.
  ****************************************************************************/
-#define UifNumGetLastReturned()	(ud.recNum[ud.numLastReturned])
+#define UifNumGetLastReturned()	ChNum(ud.numPos)
 
 /************************************************************************//**
  * \brief Prepares the interface for the user to input a string.
@@ -622,20 +555,11 @@ static void UifStateLeave(UifState os)
  ****************************************************************************/
 int UifInit(void)
 {
-	int i;
-
-	ud.numFirst = ud.numLast = ud.numPos = ud.numLastReturned = 0;
-	ud.full = FALSE;
-	ud.f.filter_enabled = TRUE;	// Filter enabled by default
+	ud.numPos = 0;
+	// Filter state is kept in the configuration snapshot
+	ud.f.filter_enabled = TfEnabled()?TRUE:FALSE;
 	// Start in the year set state, to avoid working with a wrong year
 	UifStateEnter(UIF_YEAR_SET);
-	// Initialize recent calls storage
-	for (i = 0; i < UIF_NUM_RECENT_NUMS; i++)
-	{
-		ud.recNum[i][0] = '\0';
-		// Just to ensure we are safe when using strncpy().
-		ud.recNum[i][16] = '\0';
-	}
 
 	return UIF_OK;
 }
@@ -1133,14 +1057,12 @@ void UifEventParse(SysEvent sysEvt, char eventData[], int dataLen)
 					XLCD_PUTS(eventData);
 					XLCD_LINE2();
 					XLCD_PUTS("ALLOWED");
-					UifInsert(eventData);
 					break;
 				case SYS_CALL_RESTRICTED:
 					XLCD_CLEAR();
 					XLCD_PUTS(eventData);
 					XLCD_LINE2();
 					XLCD_PUTS("BLOCKED");
-					UifInsert(eventData);
 					break;
 				case SYS_CALL_NOT_SENT:
 					XLCD_CLEAR();
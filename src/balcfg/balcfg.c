@@ -0,0 +1,400 @@
+/************************************************************************//**
+ * \file  balcfg.c
+ * \brief Compiles the BALSAMO text configuration file (BALSAMO.CFG) into
+ * the binary image (BALSAMO.BIN) loaded by the firmware at boot.
+ *
+ * The image holds the filter mode, the hidden numbers policy and the sorted
+ * packed numbers, protected by CRCs, so the firmware does not have to parse
+ * text. Empty lines and lines starting with '#' are ignored. Invalid lines
+ * are reported along with their line number, and skipped. Duplicated numbers
+ * are stored only once.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "tel_num.h"
+#include "sched.h"
+#include "rep_call.h"
+#include "call_act.h"
+#include "tel_filt.h"
+#include "crc.h"
+
+/// Maximum length of an input line
+#define LINE_MAX_LEN	256
+/// Maximum number of numbers in the image (TF_IMG_HDR_NNUMS is a WORD)
+#define MAX_NUMS		0xFFFF
+/// Length of each entry in keys: packed number followed by its action
+#define KEY_LEN			(TN_PACK_LEN + 1)
+
+/// Packed numbers read from the input file, along with their actions
+static BYTE keys[MAX_NUMS][KEY_LEN];
+/// Number of entries in keys
+static size_t nKeys;
+/// Schedule records
+static BYTE sched[SCHED_MAX][SCHED_REC_LEN];
+/// Number of schedule records
+static unsigned int nSched;
+/// Repeat caller settings: calls, window and block time (see rep_call.h)
+static unsigned int repeat[3];
+/// List actions (see call_act.h)
+static BYTE listAct[CA_LIST_NUM];
+
+/// Stores a 16-bit value, little endian
+static void PutWord(BYTE *p, unsigned int val)
+{
+	p[0] = val;
+	p[1] = val>>8;
+}
+
+/// Stores a 32-bit value, little endian
+static void PutDword(BYTE *p, unsigned long val)
+{
+	PutWord(p, val & 0xFFFF);
+	PutWord(p + 2, val>>16);
+}
+
+/// qsort() compare function for packed numbers
+static int KeyCmp(const void *a, const void *b)
+{
+	return TnCmp((const BYTE*)a, (const BYTE*)b);
+}
+
+/// Reads a line, trimming leading and trailing blanks. Returns NULL on EOF.
+static char *LineRead(char line[], FILE *in, unsigned long *lineNum)
+{
+	char *p;
+	size_t len;
+
+	if (!fgets(line, LINE_MAX_LEN, in)) return NULL;
+	(*lineNum)++;
+	for (p = line; isspace((unsigned char)*p); p++);
+	len = strlen(p);
+	while (len && isspace((unsigned char)p[len - 1])) p[--len] = '\0';
+
+	return p;
+}
+
+/// Reads the configuration file. Returns the number of rejected lines, or
+/// -1 if the header lines are not valid.
+static long CfgRead(FILE *in, BYTE *mode, BYTE *hidden)
+{
+	char line[LINE_MAX_LEN];
+	char *p;
+	unsigned long lineNum = 0;
+	long rejected = 0;
+	BYTE key[TN_PACK_LEN];
+	BYTE rec[SCHED_REC_LEN];
+	BYTE act;
+	char c;
+
+	/// First line is filter behaviour: either BLACKLIST or WHITELIST
+	p = LineRead(line, in, &lineNum);
+	if (p && !strcmp(p, "BLACKLIST")) *mode = TF_MODE_BLACKLIST;
+	else if (p && !strcmp(p, "WHITELIST")) *mode = TF_MODE_WHITELIST;
+	else
+	{
+		fprintf(stderr, "line 1: expected BLACKLIST or WHITELIST\n");
+		return -1;
+	}
+	/// Second line is BLACKLIST_UNKNOWN or ALLOW_UNKNOWN
+	p = LineRead(line, in, &lineNum);
+	if (p && !strcmp(p, "BLACKLIST_UNKNOWN")) *hidden = TRUE;
+	else if (p && !strcmp(p, "ALLOW_UNKNOWN")) *hidden = FALSE;
+	else
+	{
+		fprintf(stderr, "line 2: expected BLACKLIST_UNKNOWN or "
+				"ALLOW_UNKNOWN\n");
+		return -1;
+	}
+
+	/// Remaining lines are the filtered telephone numbers, normalized as
+	/// the firmware does. Prefix directives apply to the numbers following
+	/// them, but the image stores only the last value of each prefix, so
+	/// they should be set before any number.
+	while ((p = LineRead(line, in, &lineNum)))
+	{
+		if (!*p || ('#' == *p)) continue;
+
+		switch (TnPrefixParse(p))
+		{
+			case 0:
+				if (nKeys) fprintf(stderr, "line %lu: WARNING: prefix set "
+						"after some numbers\n", lineNum);
+				continue;
+			case 2:
+				fprintf(stderr, "line %lu: invalid prefix \"%s\", skipped\n",
+						lineNum, p);
+				rejected++;
+				continue;
+		}
+		if (!strncmp(p, "REPEAT_BLOCK=", 13))
+		{
+			if ((sscanf(p + 13, "%u %u %u %c", &repeat[0], &repeat[1],
+						&repeat[2], &c) != 3) || (repeat[0] == 1) ||
+				(repeat[0] > RC_HIST) || (repeat[0] && (!repeat[1] ||
+				(repeat[1] > RC_MAX_WINDOW) || !repeat[2] ||
+				(repeat[2] > 0xFFFF))))
+			{
+				fprintf(stderr, "line %lu: invalid repeat caller settings "
+						"\"%s\", skipped\n", lineNum, p);
+				repeat[0] = repeat[1] = repeat[2] = 0;
+				rejected++;
+			}
+			continue;
+		}
+		switch (CaCfgParse(p, listAct))
+		{
+			case 0:
+				continue;
+			case 2:
+				fprintf(stderr, "line %lu: invalid list action \"%s\", "
+						"skipped\n", lineNum, p);
+				rejected++;
+				continue;
+		}
+		switch (SchedParse(p, rec))
+		{
+			case 0:
+				if (nSched < SCHED_MAX)
+					memcpy(sched[nSched++], rec, SCHED_REC_LEN);
+				else
+				{
+					fprintf(stderr, "line %lu: more than %d schedule lines, "
+							"skipped\n", lineNum, SCHED_MAX);
+					rejected++;
+				}
+				continue;
+			case 2:
+				fprintf(stderr, "line %lu: invalid schedule \"%s\", "
+						"skipped\n", lineNum, p);
+				rejected++;
+				continue;
+		}
+		if (CA_INVALID == (act = CaParse(p)))
+		{
+			fprintf(stderr, "line %lu: invalid action \"%s\", skipped\n",
+					lineNum, p);
+			rejected++;
+		}
+		else if (TnPackNorm(p, key))
+		{
+			fprintf(stderr, "line %lu: invalid number \"%s\", skipped\n",
+					lineNum, p);
+			rejected++;
+		}
+		else if (nKeys == MAX_NUMS)
+		{
+			fprintf(stderr, "line %lu: too many numbers, skipped\n",
+					lineNum);
+			rejected++;
+		}
+		else
+		{
+			memcpy(keys[nKeys], key, TN_PACK_LEN);
+			keys[nKeys++][TN_PACK_LEN] = act;
+		}
+	}
+
+	return rejected;
+}
+
+/// Warns if the numbers do not fit in the firmware RAM phone book
+static void CapacityCheck(void)
+{
+	if (nKeys > TF_BOOK_NUMS)
+		fprintf(stderr, "WARNING: %lu numbers do not fit in the %d number "
+				"phone book, the firmware will not use this image. Use "
+				"balidx for big lists!\n", (unsigned long)nKeys, TF_BOOK_NUMS);
+	else printf("%lu of %d phone book numbers used\n", (unsigned long)nKeys,
+			TF_BOOK_NUMS);
+}
+
+/// Fills a body sector: number sectors come first, then the rule table with
+/// one action byte per number
+static void BodySect(BYTE sect[], unsigned long i, unsigned long nSect)
+{
+	unsigned int perSect = TF_IMG_SECT_LEN / TN_PACK_LEN;
+	unsigned long j;
+
+	memset(sect, 0xFF, TF_IMG_SECT_LEN);
+	if (i < nSect)
+	{
+		for (j = 0; (j < perSect) && ((i * perSect + j) < nKeys); j++)
+			memcpy(sect + j * TN_PACK_LEN, keys[i * perSect + j], TN_PACK_LEN);
+		return;
+	}
+	i -= nSect;
+	for (j = 0; (j < TF_IMG_SECT_LEN) && ((i * TF_IMG_SECT_LEN + j) < nKeys);
+			j++) sect[j] = keys[i * TF_IMG_SECT_LEN + j][TN_PACK_LEN];
+}
+
+/// Writes the configuration image. Returns 0 if OK.
+static int ImgWrite(FILE *out, BYTE mode, BYTE hidden, unsigned long srcSize,
+		DWORD srcTime)
+{
+	BYTE sect[TF_IMG_SECT_LEN];
+	unsigned int perSect = TF_IMG_SECT_LEN / TN_PACK_LEN;
+	unsigned long nSect = (nKeys + perSect - 1) / perSect;
+	unsigned long nRules = 0, nRuleSect, nActs = 0;
+	unsigned long i;
+	WORD crc = CRC16_INIT;
+
+	/// Rule table is only needed if some number has an action
+	for (i = 0; i < nKeys; i++) if (keys[i][TN_PACK_LEN]) nActs++;
+	if (nActs) nRules = nKeys;
+	nRuleSect = (nRules + TF_IMG_SECT_LEN - 1) / TF_IMG_SECT_LEN;
+
+	/// Body CRC is needed for the header, so compute it first
+	for (i = 0; i < nSect + nRuleSect; i++)
+	{
+		BodySect(sect, i, nSect);
+		crc = Crc16(crc, sect, TF_IMG_SECT_LEN);
+	}
+
+	/// Header
+	memset(sect, 0, TF_IMG_SECT_LEN);
+	memcpy(sect + TF_IMG_HDR_MAGIC, TF_IMG_MAGIC, 4);
+	PutWord(sect + TF_IMG_HDR_VERSION, TF_IMG_VERSION);
+	sect[TF_IMG_HDR_MODE] = mode;
+	sect[TF_IMG_HDR_HIDDEN] = hidden;
+	PutDword(sect + TF_IMG_HDR_SRCSIZE, srcSize);
+	PutWord(sect + TF_IMG_HDR_SRCDATE, srcTime>>16);
+	PutWord(sect + TF_IMG_HDR_SRCTIME, srcTime);
+	PutWord(sect + TF_IMG_HDR_NNUMS, nKeys);
+	PutWord(sect + TF_IMG_HDR_NUMSECT, 1);
+	/// Rule table with the number actions follows the numbers
+	PutWord(sect + TF_IMG_HDR_NRULES, nRules);
+	PutWord(sect + TF_IMG_HDR_RULESECT, 1 + nSect);
+	PutWord(sect + TF_IMG_HDR_RULELEN, 1);
+	PutWord(sect + TF_IMG_HDR_BODYCRC, crc);
+	PutWord(sect + TF_IMG_HDR_NSCHED, nSched);
+	memcpy(sect + TF_IMG_HDR_SCHED, sched, nSched * SCHED_REC_LEN);
+	TnNormGet(sect + TF_IMG_HDR_NORM);
+	PutWord(sect + TF_IMG_HDR_RCCALLS, repeat[0]);
+	PutWord(sect + TF_IMG_HDR_RCWINDOW, repeat[1]);
+	PutWord(sect + TF_IMG_HDR_RCBLOCK, repeat[2]);
+	memcpy(sect + TF_IMG_HDR_ACTS, listAct, CA_LIST_NUM);
+	PutWord(sect + TF_IMG_HDR_HDRCRC,
+			Crc16(CRC16_INIT, sect, TF_IMG_HDR_HDRCRC));
+	if (fwrite(sect, TF_IMG_SECT_LEN, 1, out) != 1) return 1;
+
+	/// Number and rule sectors
+	for (i = 0; i < nSect + nRuleSect; i++)
+	{
+		BodySect(sect, i, nSect);
+		if (fwrite(sect, TF_IMG_SECT_LEN, 1, out) != 1) return 1;
+	}
+
+	printf("%s, %s hidden numbers, %lu numbers, %lu bytes\n",
+			TF_MODE_BLACKLIST == mode?"blacklist":"whitelist",
+			hidden?"blocking":"allowing", (unsigned long)nKeys,
+			(1 + nSect + nRuleSect) * TF_IMG_SECT_LEN);
+	printf("country code \"%s\", trunk prefix \"%s\", international prefix "
+			"\"%s\"\n", TnPrefixGet(TN_PFX_COUNTRY),
+			TnPrefixGet(TN_PFX_TRUNK), TnPrefixGet(TN_PFX_INTL));
+	if (nSched) printf("%u schedule records\n", nSched);
+	if (repeat[0]) printf("blocking numbers calling %u times in %u minutes, "
+			"for %u minutes\n", repeat[0], repeat[1], repeat[2]);
+	if (nActs) printf("%lu numbers with actions\n", nActs);
+	for (i = 0; i < CA_LIST_NUM; i++)
+		if (listAct[i]) printf("%s list action: %s\n", i == CA_LIST_REJECT?
+				"reject":(i == CA_LIST_HIDDEN?"hidden":"repeat"),
+				CaName(listAct[i]));
+	return 0;
+}
+
+/// Gets the modification date and time of a file as FAT stores them (local
+/// time, date in the upper 16 bits). Returns 0 if not available.
+static DWORD FatTime(const char *name)
+{
+	struct stat st;
+	struct tm *tm;
+
+	if (stat(name, &st) || !(tm = localtime(&st.st_mtime))) return 0;
+	return	  ((DWORD)(tm->tm_year - 80) << 25)
+			| ((DWORD)(tm->tm_mon + 1) << 21)
+			| ((DWORD)tm->tm_mday << 16)
+			| (WORD)(tm->tm_hour << 11)
+			| (WORD)(tm->tm_min << 5)
+			| (WORD)(tm->tm_sec >> 1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *inName, *outName = TF_IMG_FILE;
+	FILE *in, *out;
+	size_t i, j;
+	long rejected, srcSize;
+	BYTE mode, hidden;
+	int err;
+
+	if ((argc < 2) || (argc > 3))
+	{
+		fprintf(stderr, "Usage: %s config.cfg [output]\n", argv[0]);
+		return 1;
+	}
+	inName = argv[1];
+	if (argc > 2) outName = argv[2];
+
+	if (!(in = fopen(inName, "rb")))
+	{
+		perror(inName);
+		return 1;
+	}
+	rejected = CfgRead(in, &mode, &hidden);
+	/// Firmware checks the image against the size of the text file
+	fseek(in, 0, SEEK_END);
+	srcSize = ftell(in);
+	fclose(in);
+	if (rejected < 0) return 1;
+
+	/// Sort numbers and remove duplicates
+	qsort(keys, nKeys, KEY_LEN, KeyCmp);
+	for (i = j = 0; i < nKeys; i++)
+		if (!j || KeyCmp(keys[i], keys[j - 1])) memcpy(keys[j++], keys[i],
+				KEY_LEN);
+	if (j < nKeys) printf("%lu duplicated numbers removed\n",
+			(unsigned long)(nKeys - j));
+	nKeys = j;
+	CapacityCheck();
+
+	if (!(out = fopen(outName, "wb")))
+	{
+		perror(outName);
+		return 1;
+	}
+	err = ImgWrite(out, mode, hidden, srcSize, FatTime(inName));
+	fclose(out);
+	if (err)
+	{
+		fprintf(stderr, "error writing %s\n", outName);
+		remove(outName);
+		return 1;
+	}
+	if (rejected) printf("%ld lines rejected\n", rejected);
+
+	return 0;
+}
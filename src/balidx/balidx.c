@@ -0,0 +1,380 @@
+/************************************************************************//**
+ * \file  balidx.c
+ * \brief Builds the on-card number index (BLOCK.IDX) used by BALSAMO, from
+ * a text file containing one telephone number per line. Also builds the
+ * Bloom filter file (BLOCK.BLM) matching the index, and can measure the
+ * Bloom filter false positive rate for different filter lengths.
+ *
+ * Empty lines and lines starting with '#' are ignored. Invalid lines are
+ * reported along with their line number, and skipped. Duplicated numbers
+ * are stored only once.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "num_idx.h"
+#include "bloom.h"
+#include "call_act.h"
+
+/// Maximum length of an input line
+#define LINE_MAX_LEN	256
+/// Number of random numbers tested to measure Bloom false positive rate
+#define BLOOM_TESTS		1000000
+/// Minimum Bloom filter length tested in statistics mode
+#define BLOOM_STAT_MIN	256
+/// Maximum Bloom filter length tested in statistics mode
+#define BLOOM_STAT_MAX	8192
+/// Length of each entry in keys: packed number followed by its action
+#define KEY_LEN			(TN_PACK_LEN + 1)
+
+/// Packed numbers read from the input file, along with their actions
+static BYTE (*keys)[KEY_LEN];
+/// Number of entries in keys
+static size_t nKeys;
+/// Allocated entries in keys
+static size_t keysCap;
+/// Number of entries with an action other than CA_DEFAULT
+static size_t nActs;
+
+/// Stores a 16-bit value, little endian
+static void PutWord(BYTE *p, unsigned int val)
+{
+	p[0] = val;
+	p[1] = val>>8;
+}
+
+/// Stores a 32-bit value, little endian
+static void PutDword(BYTE *p, unsigned long val)
+{
+	PutWord(p, val & 0xFFFF);
+	PutWord(p + 2, val>>16);
+}
+
+/// qsort() compare function for packed numbers
+static int KeyCmp(const void *a, const void *b)
+{
+	return TnCmp((const BYTE*)a, (const BYTE*)b);
+}
+
+/// Adds a packed number and its action to the key list
+static void KeyAdd(const BYTE key[], BYTE act)
+{
+	if (nKeys == keysCap)
+	{
+		keysCap = keysCap?2 * keysCap:1024;
+		keys = realloc(keys, keysCap * KEY_LEN);
+		if (!keys)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(keys[nKeys], key, TN_PACK_LEN);
+	keys[nKeys++][TN_PACK_LEN] = act;
+}
+
+/// Reads the input number list. Returns the number of rejected lines.
+static unsigned long ListRead(FILE *in)
+{
+	char line[LINE_MAX_LEN];
+	char *p;
+	size_t len;
+	unsigned long lineNum = 0, rejected = 0;
+	BYTE key[TN_PACK_LEN];
+	BYTE act;
+
+	while (fgets(line, LINE_MAX_LEN, in))
+	{
+		lineNum++;
+		/// Trim leading and trailing blanks
+		for (p = line; isspace((unsigned char)*p); p++);
+		len = strlen(p);
+		while (len && isspace((unsigned char)p[len - 1])) p[--len] = '\0';
+		if (!len || ('#' == *p)) continue;
+
+		/// Numbers are normalized as the firmware does, with the prefixes
+		/// set by the previous lines (if any)
+		switch (TnPrefixParse(p))
+		{
+			case 0:
+				continue;
+			case 2:
+				fprintf(stderr, "line %lu: invalid prefix \"%s\", skipped\n",
+						lineNum, p);
+				rejected++;
+				continue;
+		}
+		/// Numbers can be followed by their action (see call_act.h)
+		if (CA_INVALID == (act = CaParse(p)))
+		{
+			fprintf(stderr, "line %lu: invalid action \"%s\", skipped\n",
+					lineNum, p);
+			rejected++;
+		}
+		else if (TnPackNorm(p, key))
+		{
+			fprintf(stderr, "line %lu: invalid number \"%s\", skipped\n",
+					lineNum, p);
+			rejected++;
+		}
+		else KeyAdd(key, act);
+	}
+
+	return rejected;
+}
+
+/// Writes the index file. Returns 0 if OK.
+static int IdxWrite(FILE *out, unsigned int recLen)
+{
+	BYTE sect[NIDX_SECT_LEN];
+	unsigned int recPerSect = NIDX_SECT_LEN / recLen;
+	unsigned long nData = (nKeys + recPerSect - 1) / recPerSect;
+	unsigned long nFence = (nData + NIDX_FENCE_PER_SECT - 1) /
+		NIDX_FENCE_PER_SECT;
+	unsigned long i, j;
+
+	if (nFence > NIDX_MAX_FENCE)
+	{
+		fprintf(stderr, "too many numbers (%lu), the maximum is %lu\n",
+				(unsigned long)nKeys, (unsigned long)NIDX_MAX_FENCE *
+				NIDX_FENCE_PER_SECT * recPerSect);
+		return 1;
+	}
+
+	/// Header
+	memset(sect, 0, NIDX_SECT_LEN);
+	memcpy(sect + NIDX_HDR_MAGIC, NIDX_MAGIC, 4);
+	PutWord(sect + NIDX_HDR_VERSION, NIDX_VERSION);
+	PutWord(sect + NIDX_HDR_RECLEN, recLen);
+	PutDword(sect + NIDX_HDR_NREC, nKeys);
+	PutDword(sect + NIDX_HDR_NDATA, nData);
+	PutWord(sect + NIDX_HDR_NFENCE, nFence);
+	if (fwrite(sect, NIDX_SECT_LEN, 1, out) != 1) return 1;
+
+	/// Fence sectors: first key of each data sector
+	for (i = 0; i < nFence; i++)
+	{
+		memset(sect, 0xFF, NIDX_SECT_LEN);
+		for (j = 0; (j < NIDX_FENCE_PER_SECT) &&
+				((i * NIDX_FENCE_PER_SECT + j) < nData); j++)
+			memcpy(sect + j * TN_PACK_LEN,
+					keys[(i * NIDX_FENCE_PER_SECT + j) * recPerSect],
+					TN_PACK_LEN);
+		if (fwrite(sect, NIDX_SECT_LEN, 1, out) != 1) return 1;
+	}
+
+	/// Data sectors
+	for (i = 0; i < nData; i++)
+	{
+		memset(sect, 0xFF, NIDX_SECT_LEN);
+		for (j = 0; (j < recPerSect) && ((i * recPerSect + j) < nKeys); j++)
+			memcpy(sect + j * recLen, keys[i * recPerSect + j],
+					recLen < KEY_LEN?recLen:KEY_LEN);
+		if (fwrite(sect, NIDX_SECT_LEN, 1, out) != 1) return 1;
+	}
+
+	printf("%lu numbers, %lu data sectors, %lu fence sectors, %lu bytes\n",
+			(unsigned long)nKeys, nData, nFence,
+			(1 + nFence + nData) * NIDX_SECT_LEN);
+	if (nActs) printf("%lu numbers with actions\n", (unsigned long)nActs);
+	return 0;
+}
+
+/// Builds a Bloom filter holding all the keys. Returns the number of hashes.
+static BYTE BloomBuild(BYTE bits[], WORD len)
+{
+	BYTE k = BloomHashes(len, nKeys);
+	size_t i;
+
+	memset(bits, 0, len);
+	for (i = 0; i < nKeys; i++) BloomAdd(bits, len, k, keys[i]);
+
+	return k;
+}
+
+/// Writes the Bloom filter file matching the index. Returns 0 if OK.
+static int BloomWrite(const char *name)
+{
+	BYTE sect[NIDX_SECT_LEN];
+	BYTE bits[NIDX_BLOOM_FILE_LEN];
+	BYTE k;
+	FILE *out;
+	int err;
+
+	k = BloomBuild(bits, NIDX_BLOOM_FILE_LEN);
+	if (!k) fprintf(stderr, "WARNING: %d byte Bloom filter is too small for "
+			"%lu numbers, it will not be used!\n", NIDX_BLOOM_FILE_LEN,
+			(unsigned long)nKeys);
+
+	memset(sect, 0, NIDX_SECT_LEN);
+	memcpy(sect + NIDX_BLM_MAGIC, NIDX_BLOOM_MAGIC, 4);
+	PutWord(sect + NIDX_BLM_VERSION, NIDX_BLOOM_VERSION);
+	PutWord(sect + NIDX_BLM_LEN, NIDX_BLOOM_FILE_LEN);
+	PutWord(sect + NIDX_BLM_NHASH, k);
+	PutDword(sect + NIDX_BLM_NREC, nKeys);
+
+	if (!(out = fopen(name, "wb")))
+	{
+		perror(name);
+		return 1;
+	}
+	err = (fwrite(sect, NIDX_SECT_LEN, 1, out) != 1) ||
+		(fwrite(bits, NIDX_BLOOM_FILE_LEN, 1, out) != 1);
+	fclose(out);
+	if (err) remove(name);
+
+	return err;
+}
+
+/// Returns a random number not in the key list, with the same length of a
+/// random number from the list (so the test numbers look like real ones).
+static void RandomMiss(BYTE key[])
+{
+	char num[TN_MAX_DIGITS + 1];
+	size_t len, i;
+
+	do {
+		TnUnpack(keys[(size_t)rand() % nKeys], num);
+		len = strlen(num);
+		/// Keep the first digits, to get a realistic prefix distribution
+		for (i = len > 4?4:0; i < len; i++) num[i] = '0' + rand() % 10;
+		TnPack(num, key);
+	} while (bsearch(key, keys, nKeys, KEY_LEN, KeyCmp));
+}
+
+/// Prints Bloom filter false positive rate for several filter lengths
+static void BloomStats(void)
+{
+	static BYTE bits[BLOOM_STAT_MAX];
+	BYTE key[TN_PACK_LEN];
+	unsigned long fp;
+	double theo;
+	WORD len;
+	BYTE k;
+	long i;
+
+	if (!nKeys) return;
+	printf("\nA 1%% false positive rate needs %lu bytes (9.6 bits per "
+			"number).\n", (unsigned long)ceil(nKeys * 9.585 / 8));
+	printf("%lu numbers. Bloom filter false positive rate:\n"
+			" bytes  bits/num  hashes  theoretical  measured\n",
+			(unsigned long)nKeys);
+	for (len = BLOOM_STAT_MIN; len && (len <= BLOOM_STAT_MAX); len *= 2)
+	{
+		k = BloomBuild(bits, len);
+		if (!k)
+		{
+			printf("%6u  %8.2f  (filter too small)\n", len,
+					8.0 * len / nKeys);
+			continue;
+		}
+		theo = pow(1 - exp(-(double)k * nKeys / (8.0 * len)), k);
+		srand(1);
+		for (i = 0, fp = 0; i < BLOOM_TESTS; i++)
+		{
+			RandomMiss(key);
+			if (BloomCheck(bits, len, k, key)) fp++;
+		}
+		printf("%6u  %8.2f  %6u  %10.2f%%  %7.2f%%\n", len,
+				8.0 * len / nKeys, k, 100 * theo, 100.0 * fp / BLOOM_TESTS);
+	}
+}
+
+/// Prints program usage
+static void Usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s] list.txt [output]\n"
+			"Builds a BALSAMO number index (default output: %s) and its Bloom "
+			"filter\n(%s) from a text file with one telephone number per "
+			"line, optionally\nfollowed by its action (e.g. BUSY).\n"
+			"  -s: print Bloom filter false positive rates for different "
+			"lengths.\n", prog, NIDX_FILE, NIDX_BLOOM_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out;
+	const char *outName = NIDX_FILE;
+	char *blmName, *dot;
+	int stats = 0, arg = 1;
+	size_t i, j;
+
+	if ((argc > 1) && !strcmp(argv[1], "-s"))
+	{
+		stats = 1;
+		arg++;
+	}
+	if ((argc - arg < 1) || (argc - arg > 2))
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+	if (argc - arg == 2) outName = argv[arg + 1];
+
+	if (!(in = fopen(argv[arg], "r")))
+	{
+		perror(argv[arg]);
+		return 1;
+	}
+	if (ListRead(in)) fprintf(stderr, "WARNING: some lines were rejected!\n");
+	fclose(in);
+
+	/// Sort and remove duplicates
+	qsort(keys, nKeys, KEY_LEN, KeyCmp);
+	for (i = j = 0; i < nKeys; i++)
+	{
+		if (j && !TnCmp(keys[j - 1], keys[i])) continue;
+		if (i != j) memcpy(keys[j], keys[i], KEY_LEN);
+		if (keys[j][TN_PACK_LEN]) nActs++;
+		j++;
+	}
+	nKeys = j;
+
+	if (!(out = fopen(outName, "wb")))
+	{
+		perror(outName);
+		return 1;
+	}
+	/// Records only hold the action byte if some number has an action
+	if (IdxWrite(out, nActs?KEY_LEN:TN_PACK_LEN))
+	{
+		fclose(out);
+		remove(outName);
+		return 1;
+	}
+	fclose(out);
+
+	/// Bloom filter file has the index name, with BLM extension
+	blmName = malloc(strlen(outName) + 5);
+	strcpy(blmName, outName);
+	if ((dot = strrchr(blmName, '.')) && !strchr(dot, '/')) *dot = '\0';
+	strcat(blmName, ".BLM");
+	if (BloomWrite(blmName)) return 1;
+	free(blmName);
+
+	if (stats) BloomStats();
+	free(keys);
+
+	return 0;
+}
@@ -0,0 +1,370 @@
+/************************************************************************//**
+ * \file  ballog.c
+ * \brief Decodes the binary call logs (BALSAMO.BLG) written by BALSAMO.
+ * Converts them to CSV or JSON, or prints statistics computed over the
+ * logs of one or more devices.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ev_log.h"
+#include "tel_filt.h"
+
+/// Output formats
+enum
+{
+	OUT_CSV,	///< One line per record, comma separated
+	OUT_JSON,	///< Array of objects, one per record
+	OUT_STATS	///< Statistics over all the records
+};
+
+/// Number of call events
+#define EV_NUM			(LOG_EV_CID_ERROR + 1)
+/// Number of filter decision codes
+#define REASON_NUM		(TF_NUM_REPEAT + 1)
+/// Numbers listed in the most blocked numbers statistics
+#define TOP_NUMS		10
+
+/// Decoded record
+typedef struct
+{
+	unsigned year, month, day, hour, min, sec;
+	char num[TN_MAX_DIGITS + 2];	///< '+' followed by the digits
+	BYTE key[TN_PACK_LEN];
+	BYTE event, reason, act, flags;
+} LogRec;
+
+/// Blocked call, used to find the most blocked numbers
+typedef struct
+{
+	BYTE key[TN_PACK_LEN];
+	unsigned file;
+} Blocked;
+
+/// Event names
+static const char *evName[EV_NUM] =
+{
+	"ALLOWED", "BLOCKED", "NOT_SENT", "CID_ERROR"
+};
+
+/// Filter decision names, indexed by TF_* code
+static const char *reasonName[REASON_NUM] =
+{
+	"NUM_OK", "NUM_REJECT", "FILTER_DISABLED", "HID_OK", "HID_REJECT",
+	"HID_DISABLED", "NUM_REPEAT"
+};
+
+/// Statistics counters
+static unsigned long nRecs, nLost, nNoNum;
+static unsigned long evCount[EV_NUM + 1];
+static unsigned long reasonCount[REASON_NUM + 1];
+static unsigned long actCount[256];
+static unsigned long hourCount[24];
+/// First and last record dates, as yyyymmdd
+static unsigned long first, last;
+/// Blocked calls with a number
+static Blocked *blocked;
+static size_t nBlocked, blockedCap;
+
+/// Loads a 32-bit value, little endian
+static unsigned long GetDword(const BYTE *p)
+{
+	return p[0] | (p[1]<<8) | ((unsigned long)p[2]<<16) |
+		((unsigned long)p[3]<<24);
+}
+
+/// Decodes a binary record
+static void RecDecode(const BYTE raw[], LogRec *r)
+{
+	unsigned long t = GetDword(raw + LOG_REC_TIME);
+
+	/// FAT timestamp, as get_fattime()
+	r->year  = 1980 + (t>>25);
+	r->month = (t>>21) & 0x0F;
+	r->day   = (t>>16) & 0x1F;
+	r->hour  = (t>>11) & 0x1F;
+	r->min   = (t>>5) & 0x3F;
+	r->sec   = (t & 0x1F) * 2;
+	memcpy(r->key, raw + LOG_REC_NUM, TN_PACK_LEN);
+	r->event  = raw[LOG_REC_EVENT];
+	r->reason = raw[LOG_REC_REASON];
+	r->act    = raw[LOG_REC_ACTION];
+	r->flags  = raw[LOG_REC_FLAGS];
+	if (r->flags & LOG_F_NO_NUM) r->num[0] = '\0';
+	else
+	{
+		r->num[0] = '+';
+		TnUnpack(r->key, r->num + 1);
+	}
+}
+
+/// Gets the name of an event
+static const char *EvName(BYTE ev)
+{
+	return ev < EV_NUM?evName[ev]:"UNKNOWN";
+}
+
+/// Gets the name of a filter decision
+static const char *ReasonName(BYTE reason)
+{
+	if (LOG_NO_REASON == reason) return "";
+	return reason < REASON_NUM?reasonName[reason]:"UNKNOWN";
+}
+
+/// Gets the name of an action, CA_DEFAULT being "DEFAULT"
+static const char *ActName(BYTE act)
+{
+	const char *name = CaName(act);
+
+	return *name?name:"DEFAULT";
+}
+
+/// Prints a record in CSV format
+static void CsvPrint(const char *dev, const LogRec *r)
+{
+	printf("%s,%04u-%02u-%02u,%02u:%02u:%02u,%s,%s,%s,%s,%s%s%s\n", dev,
+			r->year, r->month, r->day, r->hour, r->min, r->sec, r->num,
+			EvName(r->event), ReasonName(r->reason), ActName(r->act),
+			(r->flags & LOG_F_NO_NUM)?"NO_NUM":"",
+			((r->flags & LOG_F_NO_NUM) && (r->flags & LOG_F_LOST))?"|":"",
+			(r->flags & LOG_F_LOST)?"LOST":"");
+}
+
+/// Prints a record in JSON format
+static void JsonPrint(const char *dev, const LogRec *r, int firstRec)
+{
+	const char *p;
+
+	printf("%s\n  {\"device\": \"", firstRec?"":",");
+	/// Escape the file name
+	for (p = dev; *p; p++)
+	{
+		if (('"' == *p) || ('\\' == *p)) putchar('\\');
+		putchar(*p);
+	}
+	printf("\", \"time\": \"%04u-%02u-%02uT%02u:%02u:%02u\", ", r->year,
+			r->month, r->day, r->hour, r->min, r->sec);
+	if (r->num[0]) printf("\"number\": \"%s\", ", r->num);
+	else printf("\"number\": null, ");
+	printf("\"event\": \"%s\", ", EvName(r->event));
+	if (LOG_NO_REASON == r->reason) printf("\"reason\": null, ");
+	else printf("\"reason\": \"%s\", ", ReasonName(r->reason));
+	printf("\"action\": \"%s\", \"lost_before\": %s}", ActName(r->act),
+			(r->flags & LOG_F_LOST)?"true":"false");
+}
+
+/// Adds a record to the statistics
+static void StatsAdd(unsigned file, const LogRec *r)
+{
+	unsigned long date = r->year * 10000UL + r->month * 100 + r->day;
+
+	nRecs++;
+	if (!first || (date < first)) first = date;
+	if (date > last) last = date;
+	evCount[r->event < EV_NUM?r->event:EV_NUM]++;
+	if (r->flags & LOG_F_LOST) nLost++;
+	if (r->flags & LOG_F_NO_NUM) nNoNum++;
+	if (r->hour < 24) hourCount[r->hour]++;
+	if (LOG_EV_BLOCKED != r->event) return;
+
+	reasonCount[r->reason < REASON_NUM?r->reason:REASON_NUM]++;
+	actCount[r->act]++;
+	if (r->flags & LOG_F_NO_NUM) return;
+	if (nBlocked == blockedCap)
+	{
+		blockedCap = blockedCap?2 * blockedCap:1024;
+		if (!(blocked = realloc(blocked, blockedCap * sizeof(Blocked))))
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(blocked[nBlocked].key, r->key, TN_PACK_LEN);
+	blocked[nBlocked++].file = file;
+}
+
+/// qsort() compare function for blocked calls: by number, then by file
+static int BlockedCmp(const void *a, const void *b)
+{
+	const Blocked *x = a, *y = b;
+	int cmp = TnCmp(x->key, y->key);
+
+	if (cmp) return cmp;
+	return (x->file > y->file) - (x->file < y->file);
+}
+
+/// Prints a percentage of the records
+static void PctPrint(const char *name, unsigned long n, unsigned long total)
+{
+	printf("  %-16s %8lu  %5.1f%%\n", name, n, total?100.0 * n / total:0.0);
+}
+
+/// Prints the statistics
+static void StatsPrint(unsigned nFiles)
+{
+	/// Most blocked numbers: count, devices and position in blocked
+	unsigned long topCount[TOP_NUMS] = {0}, topDevs[TOP_NUMS] = {0};
+	size_t topPos[TOP_NUMS] = {0};
+	unsigned long count, devs;
+	size_t i, j, k;
+	char num[TN_MAX_DIGITS + 1];
+
+	printf("Devices: %u\nRecords: %lu\n", nFiles, nRecs);
+	if (!nRecs) return;
+	printf("From %04lu-%02lu-%02lu to %04lu-%02lu-%02lu\n", first / 10000,
+			first / 100 % 100, first % 100, last / 10000, last / 100 % 100,
+			last % 100);
+	printf("Records without number: %lu\nRecords after lost ones: %lu\n",
+			nNoNum, nLost);
+
+	printf("\nCalls by event:\n");
+	for (i = 0; i < EV_NUM; i++) PctPrint(evName[i], evCount[i], nRecs);
+	if (evCount[EV_NUM]) PctPrint("UNKNOWN", evCount[EV_NUM], nRecs);
+
+	printf("\nBlocked calls by reason:\n");
+	for (i = 0; i < REASON_NUM; i++)
+		if (reasonCount[i])
+			PctPrint(reasonName[i], reasonCount[i], evCount[LOG_EV_BLOCKED]);
+	if (reasonCount[REASON_NUM])
+		PctPrint("UNKNOWN", reasonCount[REASON_NUM], evCount[LOG_EV_BLOCKED]);
+
+	printf("\nBlocked calls by action:\n");
+	for (i = 0; i < 256; i++)
+		if (actCount[i])
+			PctPrint(ActName(i), actCount[i], evCount[LOG_EV_BLOCKED]);
+
+	printf("\nCalls by hour:\n");
+	for (i = 0; i < 24; i++)
+		printf("  %02u:00 %8lu\n", (unsigned)i, hourCount[i]);
+
+	/// Count the calls and devices of each blocked number, keeping the top
+	qsort(blocked, nBlocked, sizeof(Blocked), BlockedCmp);
+	for (i = 0; i < nBlocked; i = j)
+	{
+		for (j = i, count = devs = 0; (j < nBlocked) &&
+				!TnCmp(blocked[i].key, blocked[j].key); j++)
+		{
+			count++;
+			if ((j == i) || (blocked[j].file != blocked[j - 1].file)) devs++;
+		}
+		for (k = TOP_NUMS; k && (count > topCount[k - 1]); k--)
+		{
+			if (k < TOP_NUMS)
+			{
+				topCount[k] = topCount[k - 1];
+				topDevs[k] = topDevs[k - 1];
+				topPos[k] = topPos[k - 1];
+			}
+		}
+		if (k < TOP_NUMS)
+		{
+			topCount[k] = count;
+			topDevs[k] = devs;
+			topPos[k] = i;
+		}
+	}
+	printf("\nMost blocked numbers:\n  %-18s %8s %8s\n", "number", "calls",
+			"devices");
+	for (k = 0; (k < TOP_NUMS) && topCount[k]; k++)
+	{
+		TnUnpack(blocked[topPos[k]].key, num);
+		printf("  +%-17s %8lu %8lu\n", num, topCount[k], topDevs[k]);
+	}
+}
+
+/// Prints usage instructions
+static void Usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-j | -s] log.blg [log.blg ...]\n"
+			"Decodes BALSAMO binary call logs (%s). Records are printed in "
+			"CSV format\n(device,date,time,number,event,reason,action,flags) "
+			"by default, the device\nbeing the name of the log file.\n"
+			"  -j: print records in JSON format.\n"
+			"  -s: print statistics over all the logs.\n", prog,
+			LOG_BIN_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in;
+	BYTE raw[LOG_REC_LEN];
+	LogRec r;
+	int out = OUT_CSV, arg = 1, firstRec = 1, err = 0;
+	unsigned file;
+	long size;
+
+	if ((argc > 1) && !strcmp(argv[1], "-j")) out = OUT_JSON;
+	else if ((argc > 1) && !strcmp(argv[1], "-s")) out = OUT_STATS;
+	if (OUT_CSV != out) arg++;
+	if (argc - arg < 1)
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	if (OUT_JSON == out) printf("[");
+	for (file = 0; arg < argc; arg++, file++)
+	{
+		if (!(in = fopen(argv[arg], "rb")))
+		{
+			perror(argv[arg]);
+			err = 1;
+			continue;
+		}
+		/// The firmware overwrites a partial record left by a power failure
+		fseek(in, 0, SEEK_END);
+		size = ftell(in);
+		rewind(in);
+		if (size % LOG_REC_LEN)
+			fprintf(stderr, "%s: ignoring %ld trailing bytes\n", argv[arg],
+					size % LOG_REC_LEN);
+
+		for (; size >= LOG_REC_LEN; size -= LOG_REC_LEN)
+		{
+			if (fread(raw, LOG_REC_LEN, 1, in) != 1)
+			{
+				perror(argv[arg]);
+				err = 1;
+				break;
+			}
+			RecDecode(raw, &r);
+			switch (out)
+			{
+				case OUT_CSV:
+					CsvPrint(argv[arg], &r);
+					break;
+				case OUT_JSON:
+					JsonPrint(argv[arg], &r, firstRec);
+					firstRec = 0;
+					break;
+				default:
+					StatsAdd(file, &r);
+			}
+		}
+		fclose(in);
+	}
+	if (OUT_JSON == out) printf("\n]\n");
+	if (OUT_STATS == out) StatsPrint(file);
+	free(blocked);
+
+	return err;
+}
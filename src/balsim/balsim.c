@@ -0,0 +1,494 @@
+/************************************************************************//**
+ * \file  balsim.c
+ * \brief Runs the BALSAMO storage modules on the host, over a FAT image
+ * file, to benchmark them and to check their behavior on power cuts.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "img_disk.h"
+#include "host.h"
+#include "tel_filt.h"
+#include "num_idx.h"
+#include "ev_log.h"
+#include "fs_map.h"
+#include "rawplay/rawplay.h"
+#include "fatfs/ff.h"
+
+/// Copy buffer length
+#define COPY_LEN		4096
+/// Numbers in the configuration written when the image has none
+#define SAVE_DEF_NUMS	16
+/// Room for the phone book contents, one canonical number per line
+#define BOOK_TXT_LEN	(TF_BOOK_NUMS * (TN_MAX_DIGITS + 3))
+
+/// Mounted volume
+static FATFS vol;
+/// Write half of the sector the power is cut at
+static char torn;
+
+/// Prints the usage and exits
+static void Usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-l cmd,sect,busy] [-r n] [-w n] [-t] "
+			"image command [args]\n\n", prog);
+	fprintf(stderr, "Options:\n"
+			"  -l cmd,sect,busy  Latencies in microseconds (default "
+			"%u,%u,%u)\n"
+			"  -r n              Fail the n-th sector read\n"
+			"  -w n              Fail the n-th sector write\n"
+			"  -t                Half write the sector at power cuts\n\n",
+			IMG_CMD_US, IMG_SECT_US, IMG_BUSY_US);
+	fprintf(stderr, "Commands:\n"
+			"  mkfs mb           Create and format a new image\n"
+			"  put file [name]   Copy a file to the image root\n"
+			"  get name [file]   Copy a file from the image\n"
+			"  cfg n [n ...]     Time loading BALSAMO.CFG with n numbers\n"
+			"  log n [s]         Log n lines, syncing each s lines\n"
+			"  save [n ...]      Cut power at each write of a save adding "
+			"n numbers\n"
+			"  play name         Play an audio file, counting underruns\n");
+	exit(1);
+}
+
+/// Prints a virtual time in milliseconds
+static void TimePrint(DWORD us)
+{
+	printf("%lu.%03lu ms", us / 1000, us % 1000);
+}
+
+/// Prints the transfer counters
+static void StatsPrint(void)
+{
+	ImgStats st;
+
+	ImgStatsGet(&st);
+	printf("%lu sectors read (%lu cmds), %lu written (%lu cmds), %lu syncs",
+			st.rdSects, st.rdCmds, st.wrSects, st.wrCmds, st.syncs);
+	if (st.errors) printf(", %lu errors injected", st.errors);
+}
+
+/// Mounts the volume again, dropping the state kept in RAM by FatFs and the
+/// firmware modules, as a reboot does
+static void Remount(void)
+{
+	NidxClose();
+	f_mount(0, NULL);
+	f_mount(0, &vol);
+	FmInit();
+}
+
+/// Boots: mounts the volume and loads the configuration
+static char Boot(void)
+{
+	Remount();
+	TfInit(TF_MODE_BLACKLIST);
+	return TfParseConfig();
+}
+
+/// Gets the phone book contents, one number per line
+static void BookText(char txt[])
+{
+	char *num;
+
+	txt[0] = '\0';
+	for (num = TfNumGetFirst(); num; num = TfNumGetNext())
+	{
+		strcat(txt, num);
+		strcat(txt, "\n");
+	}
+}
+
+/// Gets the number of numbers in the phone book
+static DWORD BookCount(void)
+{
+	DWORD n = 0;
+	char *num;
+
+	for (num = TfNumGetFirst(); num; num = TfNumGetNext()) n++;
+	return n;
+}
+
+/// Writes a configuration file with n numbers, removing the image and the
+/// journal, so the text file is parsed
+static char CfgWrite(DWORD n)
+{
+	FIL f;
+	DWORD i;
+	char retVal;
+
+	f_unlink(TF_IMG_FILE);
+	f_unlink(TF_JNL_FILE);
+	if (f_open(&f, TF_CFG_FILE, FA_WRITE | FA_CREATE_ALWAYS)) return 1;
+	retVal = f_puts("BLACKLIST\nALLOW_UNKNOWN\n", &f) < 0;
+	for (i = 0; !retVal && (i < n); i++)
+		retVal = f_printf(&f, "6%08lu\n", i) < 0;
+	if (f_close(&f)) retVal = 1;
+	return retVal;
+}
+
+/// Creates and formats a new image
+static int CmdMkfs(const char *img, int argc, char *argv[])
+{
+	DWORD mb;
+
+	if ((argc != 1) || !(mb = strtoul(argv[0], NULL, 0))) return -1;
+	if (ImgCreate(img, mb * 2048))
+	{
+		perror(img);
+		return 1;
+	}
+	f_mount(0, &vol);
+	if (f_mkfs(0, 0, 0))
+	{
+		fprintf(stderr, "%s: format failed\n", img);
+		return 1;
+	}
+	return 0;
+}
+
+/// Copies a file to the image root
+static int CmdPut(int argc, char *argv[])
+{
+	static BYTE buf[COPY_LEN];
+	const char *name;
+	FILE *in;
+	FIL f;
+	size_t len;
+	UINT bw;
+	int retVal = 0;
+
+	if ((argc < 1) || (argc > 2)) return -1;
+	/// Image file name defaults to the host one, without the path
+	name = (argc > 1)?argv[1]:strrchr(argv[0], '/')?
+		strrchr(argv[0], '/') + 1:argv[0];
+	if (!(in = fopen(argv[0], "rb")))
+	{
+		perror(argv[0]);
+		return 1;
+	}
+	if (f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS))
+	{
+		fprintf(stderr, "%s: cannot create\n", name);
+		fclose(in);
+		return 1;
+	}
+	while (!retVal && (len = fread(buf, 1, COPY_LEN, in)))
+		retVal = f_write(&f, buf, len, &bw) || (bw != len);
+	if (f_close(&f)) retVal = 1;
+	fclose(in);
+	if (retVal) fprintf(stderr, "%s: write failed\n", name);
+	return retVal;
+}
+
+/// Copies a file from the image
+static int CmdGet(int argc, char *argv[])
+{
+	static BYTE buf[COPY_LEN];
+	FILE *out;
+	FIL f;
+	UINT br;
+	int retVal = 0;
+
+	if ((argc < 1) || (argc > 2)) return -1;
+	if (f_open(&f, argv[0], FA_READ))
+	{
+		fprintf(stderr, "%s: not found\n", argv[0]);
+		return 1;
+	}
+	if (!(out = fopen((argc > 1)?argv[1]:argv[0], "wb")))
+	{
+		perror((argc > 1)?argv[1]:argv[0]);
+		f_close(&f);
+		return 1;
+	}
+	while (!(retVal = f_read(&f, buf, COPY_LEN, &br)) && br)
+		if (fwrite(buf, 1, br, out) != br) retVal = 1;
+	fclose(out);
+	f_close(&f);
+	if (retVal) fprintf(stderr, "%s: read failed\n", argv[0]);
+	return retVal;
+}
+
+/// Times loading configuration files with the given numbers of lines. The
+/// volume is mounted again before each load, so it includes the mount.
+static int CmdCfg(int argc, char *argv[])
+{
+	WORD lines[TF_REJ_MAX];
+	DWORD n, t;
+	int i;
+
+	if (argc < 1) return -1;
+	for (i = 0; i < argc; i++)
+	{
+		n = strtoul(argv[i], NULL, 0);
+		if (CfgWrite(n))
+		{
+			fprintf(stderr, "cannot write %s\n", TF_CFG_FILE);
+			return 1;
+		}
+		Remount();
+		TfInit(TF_MODE_BLACKLIST);
+		ImgStatsReset();
+		t = ImgTime();
+		if (TfParseConfig())
+		{
+			fprintf(stderr, "cannot load %s\n", TF_CFG_FILE);
+			return 1;
+		}
+		printf("%lu numbers: ", n);
+		TimePrint(ImgTime() - t);
+		printf(", ");
+		StatsPrint();
+		printf(", %u lines rejected\n", TfCfgRejects(lines));
+	}
+	return 0;
+}
+
+/// Logs lines as the firmware does between calls, counting the sectors
+/// touched per line
+static int CmdLog(int argc, char *argv[])
+{
+	ImgStats st;
+	DWORD n, s = 1, i, t;
+
+	if ((argc < 1) || (argc > 2) || !(n = strtoul(argv[0], NULL, 0)))
+		return -1;
+	if ((argc > 1) && !(s = strtoul(argv[1], NULL, 0))) return -1;
+	Remount();
+	ImgStatsReset();
+	t = ImgTime();
+	if (LogOpen())
+	{
+		fprintf(stderr, "cannot open %s\n", LOG_FILE);
+		return 1;
+	}
+	printf("open: ");
+	TimePrint(ImgTime() - t);
+	printf(", ");
+	StatsPrint();
+	printf("\n");
+
+	ImgStatsReset();
+	t = ImgTime();
+	for (i = 1; i <= n; i++)
+	{
+		LogNumStr("612345678", (i & 1)?"BLOCKED":"ALLOWED");
+		if (i % s) LogTask();
+		else LogSync();
+	}
+	LogSync();
+	t = ImgTime() - t;
+	ImgStatsGet(&st);
+	printf("%lu lines: ", n);
+	TimePrint(t);
+	printf(", ");
+	StatsPrint();
+	printf("\nper line: ");
+	TimePrint(t / n);
+	printf(", %.2f sectors read, %.2f written\n", (double)st.rdSects / n,
+			(double)st.wrSects / n);
+	return 0;
+}
+
+/// Adds numbers to the configuration and saves it, cutting the power at
+/// each sector write in turn. After each cut, the configuration loaded on
+/// the next boot must be either the old or the new one.
+static int SaveTest(DWORD adds)
+{
+	static char oldBook[BOOK_TXT_LEN], newBook[BOOK_TXT_LEN];
+	static char book[BOOK_TXT_LEN];
+	char num[24];
+	DWORD cut, i, nOld = 0, nNew = 0, nBad = 0;
+	size_t mark;
+	char saved;
+
+	Boot();
+	BookText(oldBook);
+	mark = ImgMark();
+	for (cut = 1; ; cut++)
+	{
+		Boot();
+		for (i = 0; i < adds; i++)
+		{
+			sprintf(num, "699%06lu", i);
+			TfNumAdd(num);
+		}
+		BookText(newBook);
+		ImgCut(cut, torn);
+		saved = !TfCfgSave();
+		/// Power is back, reboot
+		if (!ImgIsCut()) break;
+		ImgCut(0, FALSE);
+		if (Boot()) book[0] = '\0';
+		else BookText(book);
+		if (!strcmp(book, oldBook)) nOld++;
+		else if (!strcmp(book, newBook)) nNew++;
+		else
+		{
+			nBad++;
+			printf("cut at write %lu: configuration corrupted\n", cut);
+		}
+		ImgRollback(mark);
+	}
+	ImgCut(0, FALSE);
+	/// Without power cut, the new configuration must be loaded
+	if (!saved || Boot() || (BookText(book), strcmp(book, newBook)))
+	{
+		nBad++;
+		printf("no cut: configuration not saved\n");
+	}
+	ImgRollback(mark);
+	printf("%lu numbers added: %lu writes, %lu cuts loaded the old "
+			"configuration, %lu the new one, %lu failed\n", adds, cut - 1,
+			nOld, nNew, nBad);
+	return nBad?1:0;
+}
+
+/// Checks the configuration saves against power cuts, adding the given
+/// numbers of numbers. The default adds one number, appended to the
+/// journal, and then enough numbers to rewrite BALSAMO.CFG. The image is
+/// left as it was.
+static int CmdSave(int argc, char *argv[])
+{
+	DWORD adds, max = TF_JNL_PEND_LEN / 8;
+	size_t mark;
+	int i, retVal = 0;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (!(adds = strtoul(argv[i], NULL, 0))) return -1;
+		if (!i || (adds > max)) max = adds;
+	}
+
+	/// Start from the configuration in the image, unless it is not valid
+	/// or the added numbers would not fit in the RAM phone book
+	mark = ImgMark();
+	if ((Boot() || (BookCount() + max > TF_BOOK_NUMS)) &&
+			(CfgWrite(SAVE_DEF_NUMS) || Boot()))
+	{
+		fprintf(stderr, "cannot load %s\n", TF_CFG_FILE);
+		ImgRollback(mark);
+		return 1;
+	}
+	if (!argc)
+	{
+		retVal |= SaveTest(1);
+		retVal |= SaveTest(TF_JNL_PEND_LEN / 8);
+	}
+	for (i = 0; i < argc; i++) retVal |= SaveTest(strtoul(argv[i], NULL, 0));
+	ImgRollback(mark);
+	return retVal;
+}
+
+/// Plays an audio file, counting the buffers not read in time
+static int CmdPlay(int argc, char *argv[])
+{
+	DWORD bufs, unders, t;
+	BYTE retVal;
+
+	if (argc != 1) return -1;
+	Remount();
+	FmMap(argv[0]);
+	RawPlayInit();
+	ImgStatsReset();
+	t = ImgTime();
+	if ((retVal = RawPlayFile(argv[0])))
+	{
+		fprintf(stderr, "%s: play failed (%u)\n", argv[0], retVal);
+		return 1;
+	}
+	HostPlayStats(&bufs, &unders);
+	printf("%lu buffers in ", bufs);
+	TimePrint(ImgTime() - t);
+	printf(", %lu underruns, ", unders);
+	StatsPrint();
+	printf("\n");
+	return unders?1:0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long cmd = IMG_CMD_US, sect = IMG_SECT_US, busy = IMG_BUSY_US;
+	DWORD failRd = 0, failWr = 0;
+	const char *prog = argv[0], *img;
+	int opt, retVal;
+
+	while ((opt = getopt(argc, argv, "l:r:w:t")) != -1)
+	{
+		switch (opt)
+		{
+			case 'l':
+				if (sscanf(optarg, "%lu,%lu,%lu", &cmd, &sect, &busy) != 3)
+					Usage(prog);
+				break;
+
+			case 'r':
+				failRd = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'w':
+				failWr = strtoul(optarg, NULL, 0);
+				break;
+
+			case 't':
+				torn = TRUE;
+				break;
+
+			default:
+				Usage(prog);
+		}
+	}
+	if (argc - optind < 2) Usage(prog);
+	img = argv[optind];
+	argv += optind + 1;
+	argc -= optind + 1;
+	ImgLatency(cmd, sect, busy);
+
+	if (!strcmp(argv[0], "mkfs"))
+	{
+		if ((retVal = CmdMkfs(img, argc - 1, argv + 1)) < 0) Usage(prog);
+		ImgClose();
+		return retVal;
+	}
+	if (ImgOpen(img))
+	{
+		fprintf(stderr, "%s: cannot open image\n", img);
+		return 1;
+	}
+	f_mount(0, &vol);
+	ImgFailRead(failRd);
+	ImgFailWrite(failWr);
+
+	if (!strcmp(argv[0], "put")) retVal = CmdPut(argc - 1, argv + 1);
+	else if (!strcmp(argv[0], "get")) retVal = CmdGet(argc - 1, argv + 1);
+	else if (!strcmp(argv[0], "cfg")) retVal = CmdCfg(argc - 1, argv + 1);
+	else if (!strcmp(argv[0], "log")) retVal = CmdLog(argc - 1, argv + 1);
+	else if (!strcmp(argv[0], "save")) retVal = CmdSave(argc - 1, argv + 1);
+	else if (!strcmp(argv[0], "play")) retVal = CmdPlay(argc - 1, argv + 1);
+	else retVal = -1;
+	ImgClose();
+	if (retVal < 0) Usage(prog);
+
+	return retVal;
+}
@@ -0,0 +1,240 @@
+/************************************************************************//**
+ * \file  host.c
+ * \brief Host replacements for the firmware modules that drive the
+ * hardware: data EEPROM, flash number list, RTC and PWM audio output.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "host.h"
+#include "img_disk.h"
+#include "eeprom.h"
+#include "num_flash.h"
+#include "rtc.h"
+#include "rawplay/pwmplay.h"
+#include <string.h>
+#include <time.h>
+
+/// EEPROM contents
+static BYTE ee[EE_LEN];
+/// TRUE once the EEPROM has been erased
+static BYTE eeInit;
+/// Audio data callback, NULL if not playing
+static BYTE* (*dCb)(UINT *len);
+/// Virtual time the buffer being played runs out
+static DWORD bEnd;
+/// Playback statistics
+static DWORD bufs, unders;
+
+/// Erases the EEPROM the first time it is used
+static void HostEeInit(void)
+{
+	if (eeInit) return;
+	memset(ee, 0xFF, EE_LEN);
+	eeInit = TRUE;
+}
+
+/// Reads data from the EEPROM
+void EeRead(WORD ofs, void *buf, WORD len)
+{
+	HostEeInit();
+	if ((DWORD)ofs + len <= EE_LEN) memcpy(buf, ee + ofs, len);
+}
+
+/// Writes data to the EEPROM
+void EeWrite(WORD ofs, const void *buf, WORD len)
+{
+	HostEeInit();
+	if ((DWORD)ofs + len <= EE_LEN) memcpy(ee + ofs, buf, len);
+}
+
+/// Initializes the flash list. The empty list is always valid.
+char NflInit(void)
+{
+	return 0;
+}
+
+/// The list is never synced with the index, so it is always read from the
+/// card
+char NflSync(const char file[])
+{
+	(void)file;
+	return 1;
+}
+
+/// Empties the flash list, that is always empty
+void NflClear(void)
+{
+}
+
+/// Looks up a number in the flash list, that is always empty
+char NflFind(const BYTE key[])
+{
+	(void)key;
+	return FALSE;
+}
+
+/// Returns the number of numbers in the flash list
+DWORD NflCount(void)
+{
+	return 0;
+}
+
+/// Gets the date and time, following the virtual clock
+static void HostTime(struct tm *tm)
+{
+	time_t t = (time_t)(HOST_EPOCH + ImgTime() / 1000000UL);
+
+	gmtime_r(&t, tm);
+}
+
+/// Gets time
+void RtcGetTime(BYTE *hour, BYTE *min, BYTE *sec)
+{
+	struct tm tm;
+
+	HostTime(&tm);
+	*hour = tm.tm_hour;
+	*min = tm.tm_min;
+	*sec = tm.tm_sec;
+}
+
+/// Gets date
+void RtcGetDate(WORD *year, BYTE *month, BYTE *day)
+{
+	struct tm tm;
+
+	HostTime(&tm);
+	*year = tm.tm_year + 1900;
+	*month = tm.tm_mon + 1;
+	*day = tm.tm_mday;
+}
+
+/// Gets date and time at once
+void RtcGetDateTime(WORD *year, BYTE *month, BYTE *day, BYTE *hour, BYTE *min,
+		BYTE *sec)
+{
+	struct tm tm;
+
+	HostTime(&tm);
+	*year = tm.tm_year + 1900;
+	*month = tm.tm_mon + 1;
+	*day = tm.tm_mday;
+	*hour = tm.tm_hour;
+	*min = tm.tm_min;
+	*sec = tm.tm_sec;
+}
+
+/// Computes the day of the week of a date, from 0 (Monday) to 6 (Sunday)
+BYTE RtcWeekDay(WORD year, BYTE month, BYTE day)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mon = month - 1;
+	tm.tm_mday = day;
+	tm.tm_hour = 12;
+	timegm(&tm);
+	return (tm.tm_wday + 6) % 7;
+}
+
+/// Gets the minutes elapsed since the start of the year
+DWORD RtcYearMinutes(void)
+{
+	struct tm tm;
+
+	HostTime(&tm);
+	return tm.tm_yday * 1440UL + tm.tm_hour * 60 + tm.tm_min;
+}
+
+/// Get timestamp formatted for fatfs
+DWORD get_fattime(void)
+{
+	struct tm tm;
+
+	HostTime(&tm);
+	return	  ((DWORD)(tm.tm_year - 80) << 25)
+			| ((DWORD)(tm.tm_mon + 1) << 21)
+			| ((DWORD)tm.tm_mday << 16)
+			| (WORD)(tm.tm_hour << 11)
+			| (WORD)(tm.tm_min << 5)
+			| (WORD)(tm.tm_sec >> 1);
+}
+
+/// Starts a new audio buffer, stopping if there is no more data
+static void HostPlayNext(void)
+{
+	UINT len;
+
+	if (!dCb(&len) || !len)
+	{
+		dCb = NULL;
+		return;
+	}
+	bEnd += len * (1000000UL / HOST_SAMPLE_HZ);
+	bufs++;
+}
+
+/// Module initialization
+void PwmPlayInit(void)
+{
+	dCb = NULL;
+}
+
+/// Starts playback, asking for the first buffer
+void PwmPlayStart(BYTE*(*DataCallback)(UINT *dataLen))
+{
+	dCb = DataCallback;
+	bEnd = ImgTime();
+	bufs = unders = 0;
+	HostPlayNext();
+}
+
+/// Stops the playback
+void PwmPlayStop(void)
+{
+	dCb = NULL;
+}
+
+/// Waits until the buffer being played runs out, and asks for the next one,
+/// as the timer interrupt does. The player reads the next buffer while the
+/// current one plays, so if it is not done by then, the interrupt gets a
+/// buffer that is still being read.
+void Idle(void)
+{
+	DWORD t = ImgTime();
+
+	if (!dCb) return;
+	if (t > bEnd) unders++;
+	else ImgWait(bEnd - t);
+	HostPlayNext();
+}
+
+/************************************************************************//**
+ * \brief Gets the playback statistics since the last PwmPlayStart() call.
+ *
+ * \param[out] buffers   Audio buffers played.
+ * \param[out] underruns Buffers not read in time.
+ ****************************************************************************/
+void HostPlayStats(DWORD *buffers, DWORD *underruns)
+{
+	*buffers = bufs;
+	*underruns = unders;
+}
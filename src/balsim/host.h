@@ -0,0 +1,60 @@
+/************************************************************************//**
+ * \file  host.h
+ * \brief Host replacements for the firmware modules that drive the
+ * hardware: data EEPROM, flash number list, RTC and PWM audio output.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "types.h"
+
+/** \defgroup host_api host
+ *
+ * The firmware modules are linked against these replacements, implementing
+ * the same interfaces (eeprom.h, num_flash.h, rtc.h and pwmplay.h):
+ * - EEPROM: held in RAM, so it survives the simulated power cuts, as the
+ *   real one does.
+ * - Flash number list: always empty. It is never synced with the on-card
+ *   index, so the index is always read from the card.
+ * - RTC: starts at HOST_EPOCH, and follows the virtual clock of the disk
+ *   driver (see img_disk.h).
+ * - PWM audio output: Idle() waits on the virtual clock until the buffer
+ *   being played runs out, and then asks for the next one. If the player
+ *   was still reading it, an underrun is counted.
+ * \{ */
+
+/// Date and time when the virtual clock is 0 (2026-10-18 09:00:00)
+#define HOST_EPOCH			1792314000UL
+/// Audio sample rate
+#define HOST_SAMPLE_HZ		8000
+
+/************************************************************************//**
+ * \brief Gets the playback statistics since the last PwmPlayStart() call.
+ *
+ * \param[out] buffers   Audio buffers played.
+ * \param[out] underruns Buffers not read in time.
+ ****************************************************************************/
+void HostPlayStats(DWORD *buffers, DWORD *underruns);
+
+/** \} */
+
+#endif /*_HOST_H_*/
@@ -0,0 +1,405 @@
+/************************************************************************//**
+ * \file  img_disk.c
+ * \brief FatFs disk driver for the host, backed by a FAT image file, with
+ * injectable latency, errors and power cuts.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "img_disk.h"
+#include "fatfs/diskio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Sector length
+#define IMG_SECT_LEN	512
+
+/// Previous contents of a written sector
+typedef struct
+{
+	DWORD sect;
+	BYTE data[IMG_SECT_LEN];
+} ImgUndo;
+
+/// Image file descriptor, -1 if closed
+static int fd = -1;
+/// Image length in sectors
+static DWORD nSects;
+/// Disk status
+static DSTATUS stat = STA_NOINIT;
+/// Latencies, in microseconds
+static DWORD cmdUs = IMG_CMD_US, sectUs = IMG_SECT_US, busyUs = IMG_BUSY_US;
+/// Virtual clock, in microseconds
+static DWORD now;
+/// Sector transfers left until the injected error or power cut, 0 if none
+static DWORD failRd, failWr, cutAt;
+/// Write half of the sector the power is cut at
+static char cutTorn;
+/// TRUE while the power is cut
+static char cut;
+/// Transfer counters
+static ImgStats st;
+/// Sectors written since ImgMark(), in write order
+static ImgUndo *undo;
+static size_t nUndo, undoCap;
+/// TRUE while recording the sectors written
+static char marking;
+#if MMC_CACHE_SECTS
+/// Memory lent with MMC_CACHE_LEND, as the mmc.c sector cache does
+static BYTE lend[MMC_CACHE_SECTS][IMG_SECT_LEN];
+#endif
+
+/************************************************************************//**
+ * \brief Writes a sector to the image, recording its previous contents if
+ * needed.
+ *
+ * \param[in] sect Sector number.
+ * \param[in] buf  Data to write.
+ * \param[in] len  Bytes to write, from the start of the sector.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+static char ImgPut(DWORD sect, const BYTE buf[], UINT len)
+{
+	ImgUndo *u;
+
+	if (marking)
+	{
+		if (nUndo == undoCap)
+		{
+			undoCap = undoCap?2 * undoCap:256;
+			if (!(u = realloc(undo, undoCap * sizeof(ImgUndo)))) return 1;
+			undo = u;
+		}
+		u = undo + nUndo;
+		u->sect = sect;
+		if (pread(fd, u->data, IMG_SECT_LEN, (off_t)sect * IMG_SECT_LEN) !=
+				IMG_SECT_LEN) return 1;
+		nUndo++;
+	}
+	return pwrite(fd, buf, len, (off_t)sect * IMG_SECT_LEN) == (ssize_t)len?
+		0:1;
+}
+
+/************************************************************************//**
+ * \brief Opens an image file. It must be a multiple of 512 bytes long.
+ *
+ * \param[in] file Image file name.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgOpen(const char file[])
+{
+	off_t len;
+
+	ImgClose();
+	if ((fd = open(file, O_RDWR)) < 0) return 1;
+	len = lseek(fd, 0, SEEK_END);
+	if ((len <= 0) || (len % IMG_SECT_LEN))
+	{
+		ImgClose();
+		return 2;
+	}
+	nSects = len / IMG_SECT_LEN;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Creates an image file filled with zeros, and opens it. The image
+ * must be formatted (e.g. with f_mkfs()) before mounting it.
+ *
+ * \param[in] file    Image file name.
+ * \param[in] sectors Image length in sectors.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgCreate(const char file[], DWORD sectors)
+{
+	ImgClose();
+	if ((fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return 1;
+	if (ftruncate(fd, (off_t)sectors * IMG_SECT_LEN))
+	{
+		ImgClose();
+		return 2;
+	}
+	nSects = sectors;
+	return 0;
+}
+
+/************************************************************************//**
+ * \brief Closes the image file, discarding the recorded sectors.
+ ****************************************************************************/
+void ImgClose(void)
+{
+	if (fd >= 0) close(fd);
+	fd = -1;
+	stat = STA_NOINIT;
+	marking = FALSE;
+	nUndo = 0;
+}
+
+/************************************************************************//**
+ * \brief Sets the latency of the commands and sectors transferred.
+ *
+ * \param[in] cmd  Latency of each command, in microseconds.
+ * \param[in] sect Latency of each sector read or written.
+ * \param[in] busy Busy time after each sector written.
+ ****************************************************************************/
+void ImgLatency(DWORD cmd, DWORD sect, DWORD busy)
+{
+	cmdUs = cmd;
+	sectUs = sect;
+	busyUs = busy;
+}
+
+/************************************************************************//**
+ * \brief Gets the virtual clock, advanced by each transfer.
+ *
+ * \return Virtual time in microseconds.
+ ****************************************************************************/
+DWORD ImgTime(void)
+{
+	return now;
+}
+
+/************************************************************************//**
+ * \brief Advances the virtual clock, e.g. while waiting for an interrupt.
+ *
+ * \param[in] us Microseconds to advance.
+ ****************************************************************************/
+void ImgWait(DWORD us)
+{
+	now += us;
+}
+
+/************************************************************************//**
+ * \brief Makes a sector read fail once, returning RES_ERROR.
+ *
+ * \param[in] n Sector read to fail, counting from 1 at the next one, or 0
+ *            to fail none.
+ ****************************************************************************/
+void ImgFailRead(DWORD n)
+{
+	failRd = n;
+}
+
+/************************************************************************//**
+ * \brief Makes a sector write fail once, returning RES_ERROR. The sector is
+ * not written.
+ *
+ * \param[in] n Sector write to fail, counting from 1 at the next one, or 0
+ *            to fail none.
+ ****************************************************************************/
+void ImgFailWrite(DWORD n)
+{
+	failWr = n;
+}
+
+/************************************************************************//**
+ * \brief Simulates a power cut at a sector write. The sectors before it are
+ * written, and from then on every transfer fails with RES_NOTRDY, until
+ * ImgCut() is called again (power is back).
+ *
+ * \param[in] n    Sector write the power is cut at, counting from 1 at the
+ *                 next one, or 0 to restore the power.
+ * \param[in] torn If nonzero, the first half of the sector is written.
+ ****************************************************************************/
+void ImgCut(DWORD n, char torn)
+{
+	cutAt = n;
+	cutTorn = torn;
+	cut = FALSE;
+}
+
+/************************************************************************//**
+ * \brief Tells if the power has been cut (see ImgCut()).
+ *
+ * \return TRUE if the power is cut, FALSE otherwise.
+ ****************************************************************************/
+char ImgIsCut(void)
+{
+	return cut;
+}
+
+/************************************************************************//**
+ * \brief Marks the current state of the image, so ImgRollback() can restore
+ * it. From the first mark on, the previous contents of the sectors written
+ * are recorded, until the image is closed.
+ *
+ * \return Mark to restore the image to.
+ ****************************************************************************/
+size_t ImgMark(void)
+{
+	marking = TRUE;
+	return nUndo;
+}
+
+/************************************************************************//**
+ * \brief Restores the sectors written since a mark was taken. Later marks
+ * are discarded.
+ *
+ * \param[in] mark Mark returned by ImgMark().
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgRollback(size_t mark)
+{
+	char retVal = 0;
+
+	/// Newest first, so the oldest contents of each sector remain
+	marking = FALSE;
+	while (nUndo > mark)
+	{
+		nUndo--;
+		if (ImgPut(undo[nUndo].sect, undo[nUndo].data, IMG_SECT_LEN))
+			retVal = 1;
+	}
+	marking = TRUE;
+	return retVal;
+}
+
+/************************************************************************//**
+ * \brief Gets the transfer counters.
+ *
+ * \param[out] stats Counters since the last ImgStatsReset() call.
+ ****************************************************************************/
+void ImgStatsGet(ImgStats *stats)
+{
+	*stats = st;
+}
+
+/************************************************************************//**
+ * \brief Clears the transfer counters.
+ ****************************************************************************/
+void ImgStatsReset(void)
+{
+	memset(&st, 0, sizeof(st));
+}
+
+/// Initializes the disk drive
+DSTATUS disk_initialize(BYTE pdrv)
+{
+	if (pdrv) return STA_NOINIT;
+	if (fd < 0) return STA_NOINIT | STA_NODISK;
+	stat = cut?STA_NOINIT:0;
+	return stat;
+}
+
+/// Gets the disk status
+DSTATUS disk_status(BYTE pdrv)
+{
+	if (pdrv) return STA_NOINIT;
+	return cut?STA_NOINIT:stat;
+}
+
+/// Reads sectors
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, BYTE count)
+{
+	if (pdrv || !count) return RES_PARERR;
+	if (cut || (stat & STA_NOINIT)) return RES_NOTRDY;
+	if ((sector >= nSects) || (count > nSects - sector)) return RES_PARERR;
+
+	st.rdCmds++;
+	now += cmdUs;
+	for (; count; count--, sector++, buff += IMG_SECT_LEN)
+	{
+		now += sectUs;
+		if (failRd && !--failRd)
+		{
+			st.errors++;
+			return RES_ERROR;
+		}
+		if (pread(fd, buff, IMG_SECT_LEN, (off_t)sector * IMG_SECT_LEN) !=
+				IMG_SECT_LEN) return RES_ERROR;
+		st.rdSects++;
+	}
+	return RES_OK;
+}
+
+/// Writes sectors
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, BYTE count)
+{
+	if (pdrv || !count) return RES_PARERR;
+	if (cut || (stat & STA_NOINIT)) return RES_NOTRDY;
+	if ((sector >= nSects) || (count > nSects - sector)) return RES_PARERR;
+
+	st.wrCmds++;
+	now += cmdUs;
+	for (; count; count--, sector++, buff += IMG_SECT_LEN)
+	{
+		now += sectUs + busyUs;
+		if (cutAt && !--cutAt)
+		{
+			/// Power fails while the card programs the sector
+			cut = TRUE;
+			if (cutTorn) ImgPut(sector, buff, IMG_SECT_LEN / 2);
+			return RES_NOTRDY;
+		}
+		if (failWr && !--failWr)
+		{
+			st.errors++;
+			return RES_ERROR;
+		}
+		if (ImgPut(sector, buff, IMG_SECT_LEN)) return RES_ERROR;
+		st.wrSects++;
+	}
+	return RES_OK;
+}
+
+/// Miscellaneous functions. The MMC_* commands used by the firmware modules
+/// are accepted, as there is no cache nor streaming to set up.
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+	if (pdrv) return RES_PARERR;
+	if (cut || (stat & STA_NOINIT)) return RES_NOTRDY;
+
+	switch (cmd)
+	{
+		case CTRL_SYNC:
+			st.syncs++;
+			return RES_OK;
+
+		case GET_SECTOR_COUNT:
+			*(DWORD*)buff = nSects;
+			return RES_OK;
+
+		case GET_BLOCK_SIZE:
+			*(DWORD*)buff = 1;
+			return RES_OK;
+
+		case MMC_CACHE_LEND:
+#if MMC_CACHE_SECTS
+			*(BYTE**)buff = lend[0];
+			return RES_OK;
+#else
+			return RES_PARERR;
+#endif
+
+		case MMC_CHK_CARD:
+		case MMC_STREAM:
+		case MMC_CACHE_PIN:
+		case MMC_CACHE_RETURN:
+			return RES_OK;
+
+		default:
+			return RES_PARERR;
+	}
+}
@@ -0,0 +1,182 @@
+/************************************************************************//**
+ * \file  img_disk.h
+ * \brief FatFs disk driver for the host, backed by a FAT image file, with
+ * injectable latency, errors and power cuts.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IMG_DISK_H_
+#define _IMG_DISK_H_
+
+#include "types.h"
+#include <stddef.h>
+
+/** \defgroup img_disk_api img_disk
+ *
+ * Implements the FatFs disk interface (see fatfs/diskio.h) over an image
+ * file, so the firmware storage modules run on the host as they do over
+ * mmc.c. Time is not measured but simulated: each command and sector
+ * transferred adds its latency to a virtual clock, so results do not depend
+ * on the host speed. The driver counts the commands and sectors transferred,
+ * can fail a given sector transfer, and can simulate a power cut at a given
+ * sector write. The sectors written can also be recorded, so the image can
+ * be rolled back to a previous state, e.g. to test each power cut point
+ * starting from the same image.
+ *
+ * The mmc.c sector cache is not simulated, so the counters tell the sectors
+ * FatFs transfers, before any caching.
+ * \{ */
+
+/// Default latency of each command, in microseconds
+#define IMG_CMD_US		100
+/// Default latency of each sector transferred. About 528 bytes (data, CRC
+/// and gaps) at the 5.5 MHz SPI clock.
+#define IMG_SECT_US		770
+/// Default busy time after each sector written, in microseconds
+#define IMG_BUSY_US		1500
+
+/// Transfer counters
+typedef struct
+{
+	DWORD rdCmds;	///< Read commands
+	DWORD wrCmds;	///< Write commands
+	DWORD rdSects;	///< Sectors read
+	DWORD wrSects;	///< Sectors written
+	DWORD syncs;	///< CTRL_SYNC requests
+	DWORD errors;	///< Injected errors returned
+} ImgStats;
+
+/************************************************************************//**
+ * \brief Opens an image file. It must be a multiple of 512 bytes long.
+ *
+ * \param[in] file Image file name.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgOpen(const char file[]);
+
+/************************************************************************//**
+ * \brief Creates an image file filled with zeros, and opens it. The image
+ * must be formatted (e.g. with f_mkfs()) before mounting it.
+ *
+ * \param[in] file    Image file name.
+ * \param[in] sectors Image length in sectors.
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgCreate(const char file[], DWORD sectors);
+
+/************************************************************************//**
+ * \brief Closes the image file, discarding the recorded sectors.
+ ****************************************************************************/
+void ImgClose(void);
+
+/************************************************************************//**
+ * \brief Sets the latency of the commands and sectors transferred.
+ *
+ * \param[in] cmd  Latency of each command, in microseconds.
+ * \param[in] sect Latency of each sector read or written.
+ * \param[in] busy Busy time after each sector written.
+ ****************************************************************************/
+void ImgLatency(DWORD cmd, DWORD sect, DWORD busy);
+
+/************************************************************************//**
+ * \brief Gets the virtual clock, advanced by each transfer.
+ *
+ * \return Virtual time in microseconds.
+ ****************************************************************************/
+DWORD ImgTime(void);
+
+/************************************************************************//**
+ * \brief Advances the virtual clock, e.g. while waiting for an interrupt.
+ *
+ * \param[in] us Microseconds to advance.
+ ****************************************************************************/
+void ImgWait(DWORD us);
+
+/************************************************************************//**
+ * \brief Makes a sector read fail once, returning RES_ERROR.
+ *
+ * \param[in] n Sector read to fail, counting from 1 at the next one, or 0
+ *            to fail none.
+ ****************************************************************************/
+void ImgFailRead(DWORD n);
+
+/************************************************************************//**
+ * \brief Makes a sector write fail once, returning RES_ERROR. The sector is
+ * not written.
+ *
+ * \param[in] n Sector write to fail, counting from 1 at the next one, or 0
+ *            to fail none.
+ ****************************************************************************/
+void ImgFailWrite(DWORD n);
+
+/************************************************************************//**
+ * \brief Simulates a power cut at a sector write. The sectors before it are
+ * written, and from then on every transfer fails with RES_NOTRDY, until
+ * ImgCut() is called again (power is back).
+ *
+ * \param[in] n    Sector write the power is cut at, counting from 1 at the
+ *                 next one, or 0 to restore the power.
+ * \param[in] torn If nonzero, the first half of the sector is written.
+ ****************************************************************************/
+void ImgCut(DWORD n, char torn);
+
+/************************************************************************//**
+ * \brief Tells if the power has been cut (see ImgCut()).
+ *
+ * \return TRUE if the power is cut, FALSE otherwise.
+ ****************************************************************************/
+char ImgIsCut(void);
+
+/************************************************************************//**
+ * \brief Marks the current state of the image, so ImgRollback() can restore
+ * it. From the first mark on, the previous contents of the sectors written
+ * are recorded, until the image is closed.
+ *
+ * \return Mark to restore the image to.
+ ****************************************************************************/
+size_t ImgMark(void);
+
+/************************************************************************//**
+ * \brief Restores the sectors written since a mark was taken. Later marks
+ * are discarded.
+ *
+ * \param[in] mark Mark returned by ImgMark().
+ *
+ * \return 0 if OK, nonzero otherwise.
+ ****************************************************************************/
+char ImgRollback(size_t mark);
+
+/************************************************************************//**
+ * \brief Gets the transfer counters.
+ *
+ * \param[out] stats Counters since the last ImgStatsReset() call.
+ ****************************************************************************/
+void ImgStatsGet(ImgStats *stats);
+
+/************************************************************************//**
+ * \brief Clears the transfer counters.
+ ****************************************************************************/
+void ImgStatsReset(void);
+
+/** \} */
+
+#endif /*_IMG_DISK_H_*/
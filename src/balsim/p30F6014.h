@@ -0,0 +1,35 @@
+/************************************************************************//**
+ * \file  p30F6014.h
+ * \brief Host stand-in for the device header included by the audio player
+ * (see ../Balsamo/rawplay/pwmplay.h). Only declares what the player uses
+ * outside the PWM driver, that host.c replaces.
+ *
+ * \author Jesus Alonso Fernandez (doragasu)
+ * \license GPL-3.0+ <http://www.gnu.org/licenses/gpl.html>
+ *****************************************************************************/
+/* This file is part of BALSAMO source package.
+ *
+ * BALSAMO is free software: you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Some open source application is distributed in the hope that it will
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with BALSAMO.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HOST_P30F6014_H_
+#define _HOST_P30F6014_H_
+
+/************************************************************************//**
+ * \brief Waits for the next interrupt. On the host, it runs the PWM timer
+ * interrupt asking for the next audio buffer (see host.c).
+ ****************************************************************************/
+void Idle(void);
+
+#endif /*_HOST_P30F6014_H_*/